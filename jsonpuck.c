@@ -32,3 +32,1208 @@
 
 #define JS_SOURCE 1
 #include "jsonpuck.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/*
+ * {{{ SIMD kernels dispatch
+ */
+
+#define JS_KERNELS_DECLARE(isa)						\
+const char *								\
+js_escape_scan_##isa(const char *s, const char *end);			\
+size_t									\
+js_fixint_run_u64_##isa(const char *s, size_t n, uint64_t *out);	\
+size_t									\
+js_fixint_run_i64_##isa(const char *s, size_t n, int64_t *out);		\
+bool									\
+js_utf8_valid_##isa(const char *s, const char *end);			\
+static const struct js_kernels js_kernels_##isa = {			\
+	/* .escape_scan = */ js_escape_scan_##isa,			\
+	/* .fixint_run_u64 = */ js_fixint_run_u64_##isa,		\
+	/* .fixint_run_i64 = */ js_fixint_run_i64_##isa,		\
+	/* .utf8_valid = */ js_utf8_valid_##isa,			\
+};
+
+JS_KERNELS_DECLARE(scalar)
+#if defined(JS_HAVE_SSE42)
+JS_KERNELS_DECLARE(sse42)
+#endif
+#if defined(JS_HAVE_AVX2)
+JS_KERNELS_DECLARE(avx2)
+#endif
+#if defined(JS_HAVE_AVX512)
+JS_KERNELS_DECLARE(avx512)
+#endif
+
+#undef JS_KERNELS_DECLARE
+
+/** Kernels of every instruction set, NULL if not built */
+static const struct js_kernels *const js_kernels_by_isa[JS_ISA_MAX] = {
+	/* [JS_ISA_SCALAR] = */ &js_kernels_scalar,
+#if defined(JS_HAVE_SSE42)
+	/* [JS_ISA_SSE42]  = */ &js_kernels_sse42,
+#else
+	/* [JS_ISA_SSE42]  = */ NULL,
+#endif
+#if defined(JS_HAVE_AVX2)
+	/* [JS_ISA_AVX2]   = */ &js_kernels_avx2,
+#else
+	/* [JS_ISA_AVX2]   = */ NULL,
+#endif
+#if defined(JS_HAVE_AVX512)
+	/* [JS_ISA_AVX512] = */ &js_kernels_avx512,
+#else
+	/* [JS_ISA_AVX512] = */ NULL,
+#endif
+};
+
+static const char *const js_isa_names[JS_ISA_MAX] = {
+	"scalar", "sse4.2", "avx2", "avx512"
+};
+
+/** JS_ISA_MAX until js_kernels_init() is called */
+static enum js_isa js_isa_current = JS_ISA_MAX;
+
+/**
+ * Detect the best instruction set supported by the running CPU and OS.
+ */
+static enum js_isa
+js_cpu_isa(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return JS_ISA_SCALAR;
+	if (!(ecx & bit_SSE4_2))
+		return JS_ISA_SCALAR;
+	/* AVX needs the OS to save YMM state: OSXSAVE + XCR0[2:1] */
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return JS_ISA_SSE42;
+	uint32_t xcr0_lo, xcr0_hi;
+	__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	if ((xcr0_lo & 0x6) != 0x6)
+		return JS_ISA_SSE42;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+	    !(ebx & bit_AVX2))
+		return JS_ISA_SSE42;
+	/* AVX-512 needs opmask and ZMM state as well: XCR0[7:5] */
+	if ((xcr0_lo & 0xe0) != 0xe0 ||
+	    !(ebx & bit_AVX512F) || !(ebx & bit_AVX512BW))
+		return JS_ISA_AVX2;
+	return JS_ISA_AVX512;
+#else
+	return JS_ISA_SCALAR;
+#endif
+}
+
+static void
+js_kernels_set(enum js_isa isa)
+{
+	const struct js_kernels *k = js_kernels_by_isa[isa];
+	__atomic_store_n(&js_kernels.escape_scan, k->escape_scan,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&js_kernels.fixint_run_u64, k->fixint_run_u64,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&js_kernels.fixint_run_i64, k->fixint_run_i64,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&js_kernels.utf8_valid, k->utf8_valid,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&js_isa_current, isa, __ATOMIC_RELAXED);
+}
+
+static void
+js_kernels_init(void)
+{
+	enum js_isa isa = js_cpu_isa();
+	/* Unknown names are ignored, see js_isa() */
+	const char *env = getenv("JSONPUCK_ISA");
+	if (env != NULL) {
+		enum js_isa i;
+		for (i = JS_ISA_SCALAR; i < JS_ISA_MAX; i++) {
+			if (strcmp(env, js_isa_names[i]) == 0 && i < isa)
+				isa = i;
+		}
+	}
+	while (js_kernels_by_isa[isa] == NULL)
+		isa--;
+	js_kernels_set(isa);
+}
+
+static const char *
+js_escape_scan_init(const char *s, const char *end)
+{
+	js_kernels_init();
+	return js_kernels.escape_scan(s, end);
+}
+
+static size_t
+js_fixint_run_u64_init(const char *s, size_t n, uint64_t *out)
+{
+	js_kernels_init();
+	return js_kernels.fixint_run_u64(s, n, out);
+}
+
+static size_t
+js_fixint_run_i64_init(const char *s, size_t n, int64_t *out)
+{
+	js_kernels_init();
+	return js_kernels.fixint_run_i64(s, n, out);
+}
+
+static bool
+js_utf8_valid_init(const char *s, const char *end)
+{
+	js_kernels_init();
+	return js_kernels.utf8_valid(s, end);
+}
+
+struct js_kernels js_kernels = {
+	/* .escape_scan = */ js_escape_scan_init,
+	/* .fixint_run_u64 = */ js_fixint_run_u64_init,
+	/* .fixint_run_i64 = */ js_fixint_run_i64_init,
+	/* .utf8_valid = */ js_utf8_valid_init,
+};
+
+enum js_isa
+js_isa(void)
+{
+	if (__atomic_load_n(&js_isa_current, __ATOMIC_RELAXED) == JS_ISA_MAX)
+		js_kernels_init();
+	return js_isa_current;
+}
+
+int
+js_isa_set(enum js_isa isa)
+{
+	if ((unsigned) isa >= JS_ISA_MAX || js_kernels_by_isa[isa] == NULL ||
+	    isa > js_cpu_isa())
+		return -1;
+	js_kernels_set(isa);
+	return 0;
+}
+
+const char *
+js_isa_name(enum js_isa isa)
+{
+	if ((unsigned) isa >= JS_ISA_MAX)
+		return "unknown";
+	return js_isa_names[isa];
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Scalar kernels
+ */
+
+const char *
+js_escape_scan_scalar(const char *s, const char *end)
+{
+	for (; s < end; s++) {
+		uint8_t c = (uint8_t) *s;
+		if (c < 128 && js_char2escape[c] != NULL)
+			break;
+	}
+	return s;
+}
+
+size_t
+js_fixint_run_u64_scalar(const char *s, size_t n, uint64_t *out)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		uint8_t c = (uint8_t) s[i];
+		if (c > 0x7f)
+			break;
+		out[i] = c;
+	}
+	return i;
+}
+
+size_t
+js_fixint_run_i64_scalar(const char *s, size_t n, int64_t *out)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		int8_t c = (int8_t) s[i];
+		if (c < -32)
+			break;
+		out[i] = c;
+	}
+	return i;
+}
+
+bool
+js_utf8_valid_scalar(const char *s, const char *end)
+{
+	const uint8_t *p = (const uint8_t *) s;
+	const uint8_t *e = (const uint8_t *) end;
+	while (p < e) {
+		/* ASCII runs are checked eight bytes at a time */
+		uint64_t word;
+		if (e - p >= 8) {
+			memcpy(&word, p, sizeof(word));
+			if ((word & 0x8080808080808080ULL) == 0) {
+				p += 8;
+				continue;
+			}
+		}
+		uint8_t c = *p;
+		if (c < 0x80) {
+			p++;
+			continue;
+		}
+		/* The range of the second byte depends on the lead byte */
+		uint8_t lo = 0x80, hi = 0xbf;
+		ptrdiff_t n;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 2;
+			if (c == 0xe0)
+				lo = 0xa0; /* overlong */
+			else if (c == 0xed)
+				hi = 0x9f; /* surrogates */
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			if (c == 0xf0)
+				lo = 0x90; /* overlong */
+			else if (c == 0xf4)
+				hi = 0x8f; /* > U+10FFFF */
+		} else {
+			return false;
+		}
+		if (e - p <= n || p[1] < lo || p[1] > hi)
+			return false;
+		ptrdiff_t i;
+		for (i = 2; i <= n; i++) {
+			if ((p[i] & 0xc0) != 0x80)
+				return false;
+		}
+		p += n + 1;
+	}
+	return true;
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Hot-path counters
+ */
+
+#if defined(JS_STATS)
+__thread struct js_stats js_stats_tls;
+#endif
+
+void
+js_stats_snapshot(struct js_stats *stats)
+{
+#if defined(JS_STATS)
+	*stats = js_stats_tls;
+#else
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void
+js_stats_reset(void)
+{
+#if defined(JS_STATS)
+	memset(&js_stats_tls, 0, sizeof(js_stats_tls));
+#endif
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Thread pool
+ */
+
+struct js_parallel_job {
+	void (*fn)(void *arg, uint32_t i);
+	void *arg;
+	uint32_t count;
+	/** the next item to take */
+	uint32_t next;
+};
+
+static void *
+js_parallel_worker(void *arg)
+{
+	struct js_parallel_job *job = (struct js_parallel_job *) arg;
+	for (;;) {
+		uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (i >= job->count)
+			break;
+		job->fn(job->arg, i);
+	}
+	return NULL;
+}
+
+/**
+ * Call fn(arg, i) for every i in [0, count) in the calling thread and
+ * \a nthreads - 1 extra threads. Items are taken in order from a shared
+ * counter, so threads which are done early take more items.
+ */
+static void
+js_parallel_for(int nthreads, uint32_t count,
+		void (*fn)(void *arg, uint32_t i), void *arg)
+{
+	struct js_parallel_job job;
+	job.fn = fn;
+	job.arg = arg;
+	job.count = count;
+	job.next = 0;
+	if (nthreads > (int) count)
+		nthreads = (int) count;
+#if !defined(_WIN32)
+	pthread_t *threads = NULL;
+	int started = 0;
+	if (nthreads > 1)
+		threads = (pthread_t *) malloc((nthreads - 1) * sizeof(*threads));
+	if (threads != NULL) {
+		for (; started < nthreads - 1; started++) {
+			if (pthread_create(&threads[started], NULL,
+					   js_parallel_worker, &job) != 0)
+				break;
+		}
+	}
+	js_parallel_worker(&job);
+	int t;
+	for (t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+#else
+	/* No threads, every item is done in the calling thread */
+	js_parallel_worker(&job);
+#endif
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Parallel validation
+ */
+
+/** Arrays with fewer elements are validated in the calling thread */
+enum { JS_PARALLEL_MIN_ELEMENTS = 1024 };
+/** Chunks per thread, to even out elements of different sizes */
+enum { JS_PARALLEL_CHUNKS_PER_THREAD = 8 };
+
+struct js_check_chunk {
+	/** the first element */
+	const char *data;
+	/** the end of the last element */
+	const char *end;
+	/** the number of elements */
+	uint32_t count;
+	/** values in the elements, including nested ones */
+	uint64_t elements;
+};
+
+struct js_check_job {
+	const struct js_check_opts *opts;
+	struct js_check_chunk *chunks;
+	/** set if any chunk is invalid */
+	int failed;
+};
+
+static void
+js_check_job_chunk(void *arg, uint32_t i)
+{
+	struct js_check_job *job = (struct js_check_job *) arg;
+	if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+		return;
+	struct js_check_chunk *chunk = &job->chunks[i];
+	const char *pos = chunk->data;
+	uint32_t k;
+	for (k = 0; k < chunk->count; k++) {
+		/* Elements are nested in the top-level array */
+		if (js_check_opts_internal(&pos, chunk->end, job->opts, 1,
+					   &chunk->elements) != 0) {
+			__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+}
+
+int
+js_check_parallel(const char **data, const char *end,
+		  const struct js_check_opts *opts, int nthreads)
+{
+	const char *pos = *data;
+	/*
+	 * Finding chunk boundaries costs as much as a structural check, so
+	 * threads only pay off when workers also read string payloads.
+	 */
+	if (opts == NULL || !opts->check_utf8)
+		return js_check_opts(data, end, opts);
+	if (pos >= end || js_typeof(*pos) != JS_ARRAY ||
+	    js_check_array(pos, end) > 0 || nthreads <= 1)
+		return js_check_opts(data, end, opts);
+	uint32_t size = js_decode_array(&pos);
+	if (size < JS_PARALLEL_MIN_ELEMENTS)
+		return js_check_opts(data, end, opts);
+	/* The top-level array itself */
+	if (opts->max_depth == 1)
+		return 1;
+
+	uint32_t chunk_count = (uint32_t) nthreads *
+			       JS_PARALLEL_CHUNKS_PER_THREAD;
+	if (chunk_count > size)
+		chunk_count = size;
+	struct js_check_chunk *chunks = (struct js_check_chunk *)
+		malloc(chunk_count * sizeof(*chunks));
+	if (chunks == NULL)
+		return js_check_opts(data, end, opts);
+
+	/*
+	 * Find chunk boundaries. Elements are skipped with js_check(),
+	 * i.e. with bounds checks, since the buffer is not trusted yet:
+	 * js_next() could run past the end on a hostile length.
+	 */
+	uint32_t per_chunk = size / chunk_count;
+	uint32_t extra = size % chunk_count;
+	uint32_t i;
+	for (i = 0; i < chunk_count; i++) {
+		uint32_t count = per_chunk + (i < extra);
+		chunks[i].data = pos;
+		chunks[i].count = count;
+		chunks[i].elements = 0;
+		for (; count > 0; count--) {
+			if (js_check(&pos, end) != 0) {
+				free(chunks);
+				return 1;
+			}
+		}
+		chunks[i].end = pos;
+	}
+
+	struct js_check_job job;
+	job.opts = opts;
+	job.chunks = chunks;
+	job.failed = 0;
+	js_parallel_for(nthreads, chunk_count, js_check_job_chunk, &job);
+	/* Chunks count against max_elements on their own, sum them up */
+	uint64_t elements = 1;
+	for (i = 0; i < chunk_count; i++)
+		elements += chunks[i].elements;
+	free(chunks);
+	if (job.failed ||
+	    (opts->max_elements != 0 && elements > opts->max_elements))
+		return 1;
+	*data = pos;
+	return 0;
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Parallel printing
+ */
+
+#if !defined(_WIN32)
+
+struct js_print_slice {
+	/** the first element */
+	const char *data;
+	/** the end of the last element */
+	const char *end;
+	/** the number of elements */
+	uint32_t count;
+	/** the output, valid when done is set */
+	char *buf;
+	size_t buf_size;
+	size_t len;
+	bool done;
+};
+
+struct js_print_job {
+	const struct js_allocator *allocator;
+	struct js_print_slice *slices;
+	uint32_t slice_count;
+	/** the next slice to take */
+	uint32_t next;
+	/** the number of slices written to the file */
+	uint32_t written;
+	/** the maximal number of slices in flight */
+	uint32_t window;
+	/** set on a memory allocation error */
+	bool failed;
+	pthread_mutex_t mutex;
+	/** signalled when a slice is done */
+	pthread_cond_t done_cond;
+	/** signalled when a slice is written */
+	pthread_cond_t written_cond;
+};
+
+/**
+ * Print elements of \a slice separated by ", " to a buffer of the given
+ * size. Return the number of characters in the output.
+ */
+static size_t
+js_print_slice_to(const struct js_print_slice *slice, char *buf, size_t size)
+{
+	struct js_printer printer;
+	printer.pos = buf;
+	printer.end = buf + size;
+	printer.total = 0;
+	const char *data = slice->data;
+	uint32_t i;
+	for (i = 0; i < slice->count; i++) {
+		if (i)
+			js_printer_write(&printer, ", ", 2);
+		js_snprint_internal(&printer, &data);
+	}
+	return printer.total;
+}
+
+static int
+js_print_slice(struct js_print_slice *slice,
+	       const struct js_allocator *allocator)
+{
+	/* JSON is usually larger than JSONPack, try a generous guess first */
+	size_t size = (slice->end - slice->data) * 4 + 64;
+	char *buf = (char *) allocator->alloc(allocator->ctx, size);
+	if (buf == NULL)
+		return -1;
+	size_t len = js_print_slice_to(slice, buf, size);
+	if (len > size) {
+		allocator->free(allocator->ctx, buf, size);
+		size = len;
+		buf = (char *) allocator->alloc(allocator->ctx, size);
+		if (buf == NULL)
+			return -1;
+		js_print_slice_to(slice, buf, size);
+	}
+	slice->buf = buf;
+	slice->buf_size = size;
+	slice->len = len;
+	return 0;
+}
+
+static void *
+js_print_worker(void *arg)
+{
+	struct js_print_job *job = (struct js_print_job *) arg;
+	pthread_mutex_lock(&job->mutex);
+	for (;;) {
+		while (job->next < job->slice_count && !job->failed &&
+		       job->next >= job->written + job->window)
+			pthread_cond_wait(&job->written_cond, &job->mutex);
+		if (job->next >= job->slice_count || job->failed)
+			break;
+		struct js_print_slice *slice = &job->slices[job->next++];
+		pthread_mutex_unlock(&job->mutex);
+		int rc = js_print_slice(slice, job->allocator);
+		pthread_mutex_lock(&job->mutex);
+		if (rc != 0)
+			job->failed = true;
+		slice->done = true;
+		pthread_cond_broadcast(&job->done_cond);
+	}
+	pthread_mutex_unlock(&job->mutex);
+	return NULL;
+}
+
+/**
+ * Write slices to \a file in order as soon as they are done.
+ */
+static int
+js_print_writer(struct js_print_job *job, FILE *file)
+{
+	int rc = 0;
+	if (fputc('[', file) < 0)
+		rc = -1;
+	uint32_t i;
+	for (i = 0; i < job->slice_count; i++) {
+		struct js_print_slice *slice = &job->slices[i];
+		pthread_mutex_lock(&job->mutex);
+		while (!slice->done && !job->failed)
+			pthread_cond_wait(&job->done_cond, &job->mutex);
+		bool failed = job->failed;
+		pthread_mutex_unlock(&job->mutex);
+		if (failed || !slice->done)
+			return -1;
+		if (rc == 0 && i > 0 && fputs(", ", file) < 0)
+			rc = -1;
+		if (rc == 0 &&
+		    fwrite(slice->buf, 1, slice->len, file) != slice->len)
+			rc = -1;
+		job->allocator->free(job->allocator->ctx, slice->buf,
+				     slice->buf_size);
+		slice->buf = NULL;
+		pthread_mutex_lock(&job->mutex);
+		job->written++;
+		/* Stop workers on a write error */
+		if (rc != 0)
+			job->failed = true;
+		pthread_cond_broadcast(&job->written_cond);
+		pthread_mutex_unlock(&job->mutex);
+		if (rc != 0)
+			return rc;
+	}
+	if (fputc(']', file) < 0)
+		rc = -1;
+	return rc;
+}
+
+int
+js_fprint_parallel(FILE *file, const char *data, int nthreads,
+		   const struct js_allocator *allocator)
+{
+	if (file == NULL)
+		file = stdout;
+	if (allocator == NULL)
+		allocator = &js_allocator_malloc;
+	if (nthreads < 1 || js_typeof(*data) != JS_ARRAY)
+		return js_fprint(file, data);
+
+	/* Split the array into slices at element boundaries */
+	const char *pos = data;
+	uint32_t size = js_decode_array(&pos);
+	uint32_t slice_count = 0, slice_cap = 0;
+	struct js_print_slice *slices = NULL;
+	const char *slice_start = pos;
+	uint32_t slice_elements = 0;
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		js_next(&pos);
+		slice_elements++;
+		if (pos - slice_start < JS_PRINT_SLICE_SIZE && i + 1 < size)
+			continue;
+		if (slice_count == slice_cap) {
+			uint32_t cap = slice_cap ? slice_cap * 2 : 64;
+			struct js_print_slice *p = (struct js_print_slice *)
+				allocator->alloc(allocator->ctx,
+						 cap * sizeof(*p));
+			if (p == NULL)
+				goto error;
+			if (slices != NULL) {
+				memcpy(p, slices, slice_count * sizeof(*p));
+				allocator->free(allocator->ctx, slices,
+						slice_cap * sizeof(*p));
+			}
+			slices = p;
+			slice_cap = cap;
+		}
+		struct js_print_slice *slice = &slices[slice_count++];
+		memset(slice, 0, sizeof(*slice));
+		slice->data = slice_start;
+		slice->end = pos;
+		slice->count = slice_elements;
+		slice_start = pos;
+		slice_elements = 0;
+	}
+	if (slice_count <= 1) {
+		if (slices != NULL)
+			allocator->free(allocator->ctx, slices,
+					slice_cap * sizeof(*slices));
+		return js_fprint(file, data);
+	}
+
+	struct js_print_job job;
+	job.allocator = allocator;
+	job.slices = slices;
+	job.slice_count = slice_count;
+	job.next = 0;
+	job.written = 0;
+	job.window = 2 * nthreads;
+	job.failed = false;
+	pthread_mutex_init(&job.mutex, NULL);
+	pthread_cond_init(&job.done_cond, NULL);
+	pthread_cond_init(&job.written_cond, NULL);
+
+	pthread_t *threads = (pthread_t *)
+		malloc(nthreads * sizeof(*threads));
+	int started = 0;
+	if (threads != NULL) {
+		for (; started < nthreads; started++) {
+			if (pthread_create(&threads[started], NULL,
+					   js_print_worker, &job) != 0)
+				break;
+		}
+	}
+	int rc;
+	if (started == 0) {
+		/*
+		 * No threads: converting in the calling thread would keep
+		 * every slice in memory until it is written, stream instead.
+		 */
+		free(threads);
+		pthread_cond_destroy(&job.written_cond);
+		pthread_cond_destroy(&job.done_cond);
+		pthread_mutex_destroy(&job.mutex);
+		allocator->free(allocator->ctx, slices,
+				slice_cap * sizeof(*slices));
+		return js_fprint(file, data);
+	}
+	rc = js_print_writer(&job, file);
+	if (rc != 0) {
+		pthread_mutex_lock(&job.mutex);
+		job.failed = true;
+		pthread_cond_broadcast(&job.written_cond);
+		pthread_mutex_unlock(&job.mutex);
+	}
+	int t;
+	for (t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	/* Free buffers which were not written because of an error */
+	for (i = 0; i < slice_count; i++) {
+		if (slices[i].buf != NULL)
+			allocator->free(allocator->ctx, slices[i].buf,
+					slices[i].buf_size);
+	}
+	pthread_cond_destroy(&job.written_cond);
+	pthread_cond_destroy(&job.done_cond);
+	pthread_mutex_destroy(&job.mutex);
+	allocator->free(allocator->ctx, slices, slice_cap * sizeof(*slices));
+	return rc;
+
+error:
+	if (slices != NULL)
+		allocator->free(allocator->ctx, slices,
+				slice_cap * sizeof(*slices));
+	return -1;
+}
+
+#else /* defined(_WIN32) */
+
+int
+js_fprint_parallel(FILE *file, const char *data, int nthreads,
+		   const struct js_allocator *allocator)
+{
+	(void) nthreads;
+	(void) allocator;
+	return js_fprint(file, data);
+}
+
+#endif /* defined(_WIN32) */
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Parallel JSON indexing
+ */
+
+/** Texts shorter than this are indexed in the calling thread */
+enum { JS_JSON_INDEX_MIN_BLOCK = 1 << 16 };
+
+struct js_json_index_job {
+	const char *text;
+	size_t len;
+	uint64_t *index;
+	uint32_t block_count;
+	size_t block_size;
+	/** per block: counts for starting outside/inside of a string */
+	size_t (*counts)[2];
+	/** per block: quote parity */
+	bool *parity;
+	/** per block: the starting state and output offset */
+	bool *in_string;
+	size_t *offset;
+};
+
+static void
+js_json_index_count(void *arg, uint32_t b)
+{
+	struct js_json_index_job *job = (struct js_json_index_job *) arg;
+	size_t begin = b * job->block_size;
+	size_t end = b + 1 == job->block_count ? job->len :
+		     begin + job->block_size;
+	/* Speculate that the block starts outside of a string */
+	bool s = false;
+	job->counts[b][0] = 0;
+	job->counts[b][1] = 0;
+	js_json_index_block(job->text, begin, end, &s, NULL, job->counts[b]);
+	job->parity[b] = s;
+}
+
+static void
+js_json_index_write(void *arg, uint32_t b)
+{
+	struct js_json_index_job *job = (struct js_json_index_job *) arg;
+	size_t begin = b * job->block_size;
+	size_t end = b + 1 == job->block_count ? job->len :
+		     begin + job->block_size;
+	bool s = job->in_string[b];
+	js_json_index_block(job->text, begin, end, &s,
+			    job->index + job->offset[b], NULL);
+}
+
+ptrdiff_t
+js_json_index_parallel(const char *text, size_t len, uint64_t *index,
+		       int nthreads)
+{
+	if (nthreads <= 1 || len < 2 * (size_t) JS_JSON_INDEX_MIN_BLOCK)
+		return js_json_index(text, len, index);
+	uint32_t block_count = (uint32_t) nthreads;
+	if (block_count > len / JS_JSON_INDEX_MIN_BLOCK)
+		block_count = len / JS_JSON_INDEX_MIN_BLOCK;
+
+	struct js_json_index_job job;
+	job.text = text;
+	job.len = len;
+	job.index = index;
+	job.block_count = block_count;
+	job.block_size = len / block_count;
+	job.counts = (size_t (*)[2]) malloc(block_count * sizeof(*job.counts));
+	job.parity = (bool *) malloc(block_count * sizeof(*job.parity));
+	job.in_string = (bool *) malloc(block_count * sizeof(*job.in_string));
+	job.offset = (size_t *) malloc(block_count * sizeof(*job.offset));
+	ptrdiff_t rc;
+	if (job.counts == NULL || job.parity == NULL ||
+	    job.in_string == NULL || job.offset == NULL) {
+		rc = js_json_index(text, len, index);
+		goto out;
+	}
+
+	js_parallel_for(nthreads, block_count, js_json_index_count, &job);
+
+	/* Reconcile in-string carry bits and output offsets */
+	bool s = false;
+	size_t offset = 0;
+	uint32_t b;
+	for (b = 0; b < block_count; b++) {
+		job.in_string[b] = s;
+		job.offset[b] = offset;
+		/* counts were taken as if the block started outside */
+		offset += job.counts[b][s];
+		s = s != job.parity[b];
+	}
+	if (s) {
+		rc = -1;
+		goto out;
+	}
+
+	js_parallel_for(nthreads, block_count, js_json_index_write, &job);
+	rc = (ptrdiff_t) offset;
+out:
+	free(job.offset);
+	free(job.in_string);
+	free(job.parity);
+	free(job.counts);
+	return rc;
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Memory-mapped reader
+ */
+
+#if !defined(_WIN32)
+
+int
+js_mmap_reader_open(struct js_mmap_reader *reader, const char *path)
+{
+	int saved_errno;
+	memset(reader, 0, sizeof(*reader));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		goto error;
+	reader->size = st.st_size;
+	if (reader->size == 0) {
+		close(fd);
+		return 0;
+	}
+	void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto error;
+	close(fd);
+	reader->data = (const char *) data;
+	madvise(data, reader->size, MADV_SEQUENTIAL);
+	return 0;
+error:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+/**
+ * Keep the read-ahead window in front of the cursor and release pages
+ * which are behind it.
+ */
+static void
+js_mmap_reader_advise(struct js_mmap_reader *reader)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	if (reader->pos + JS_MMAP_READAHEAD / 2 > reader->advised &&
+	    reader->advised < reader->size) {
+		size_t begin = reader->advised & ~(page - 1);
+		size_t end = reader->pos + JS_MMAP_READAHEAD;
+		if (end > reader->size)
+			end = reader->size;
+		madvise((char *) reader->data + begin, end - begin,
+			MADV_WILLNEED);
+		reader->advised = end;
+	}
+	size_t released = reader->pos & ~(page - 1);
+	if (released >= reader->released + JS_MMAP_READAHEAD) {
+		madvise((char *) reader->data + reader->released,
+			released - reader->released, MADV_DONTNEED);
+		reader->released = released;
+	}
+}
+
+int
+js_mmap_reader_next(struct js_mmap_reader *reader, const char **doc,
+		    const char **doc_end)
+{
+	if (reader->pos >= reader->size)
+		return 0;
+	js_mmap_reader_advise(reader);
+	const char *pos = reader->data + reader->pos;
+	const char *end = reader->data + reader->size;
+	*doc = pos;
+	if (js_check(&pos, end) != 0)
+		return -1;
+	*doc_end = pos;
+	reader->pos = pos - reader->data;
+	return 1;
+}
+
+void
+js_mmap_reader_close(struct js_mmap_reader *reader)
+{
+	if (reader->data != NULL)
+		munmap((void *) reader->data, reader->size);
+	memset(reader, 0, sizeof(*reader));
+}
+
+#endif /* !defined(_WIN32) */
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Record index
+ */
+
+void
+js_record_index_create(struct js_record_index *index,
+		       const struct js_allocator *allocator, uint32_t stride)
+{
+	memset(index, 0, sizeof(*index));
+	index->allocator = allocator != NULL ? allocator : &js_allocator_malloc;
+	index->stride = stride != 0 ? stride : JS_RECORD_INDEX_STRIDE;
+}
+
+void
+js_record_index_destroy(struct js_record_index *index)
+{
+	if (index->offsets != NULL) {
+		index->allocator->free(index->allocator->ctx, index->offsets,
+				       index->capacity * sizeof(uint64_t));
+	}
+	index->offsets = NULL;
+	index->capacity = 0;
+	index->count = 0;
+	index->scanned = 0;
+}
+
+static int
+js_record_index_reserve(struct js_record_index *index, uint64_t capacity)
+{
+	if (capacity <= index->capacity)
+		return 0;
+	uint64_t new_capacity = index->capacity > 0 ? index->capacity : 64;
+	while (new_capacity < capacity)
+		new_capacity *= 2;
+	uint64_t *offsets = (uint64_t *) index->allocator->alloc(
+		index->allocator->ctx, new_capacity * sizeof(uint64_t));
+	if (offsets == NULL)
+		return -1;
+	if (index->offsets != NULL) {
+		memcpy(offsets, index->offsets,
+		       index->capacity * sizeof(uint64_t));
+		index->allocator->free(index->allocator->ctx, index->offsets,
+				       index->capacity * sizeof(uint64_t));
+	}
+	index->offsets = offsets;
+	index->capacity = new_capacity;
+	return 0;
+}
+
+int64_t
+js_record_index_update(struct js_record_index *index, const char *data,
+		       size_t size)
+{
+	/* The log may come with an index loaded from a sidecar file */
+	if (size < index->scanned)
+		return -1;
+	const char *pos = data + index->scanned;
+	const char *end = data + size;
+	int64_t count = 0;
+	while (pos < end) {
+		const char *next = pos;
+		/*
+		 * A truncated record, e.g. the one being appended, can't be
+		 * told from a corrupted one: stop and retry it next time.
+		 */
+		if (js_check(&next, end) != 0)
+			break;
+		if (index->count % index->stride == 0) {
+			uint64_t slot = index->count / index->stride;
+			if (js_record_index_reserve(index, slot + 1) != 0)
+				return -1;
+			index->offsets[slot] = pos - data;
+		}
+		index->count++;
+		count++;
+		pos = next;
+		index->scanned = pos - data;
+	}
+	return count;
+}
+
+const char *
+js_record_index_seek(const struct js_record_index *index, const char *data,
+		     uint64_t n)
+{
+	if (n >= index->count)
+		return NULL;
+	/*
+	 * A loaded index may not match the log, so records are walked with
+	 * bounds checks, the one returned included.
+	 */
+	const char *end = data + index->scanned;
+	const char *pos = data + index->offsets[n / index->stride];
+	for (uint64_t i = n % index->stride; i > 0; i--) {
+		if (js_check(&pos, end) != 0)
+			return NULL;
+	}
+	const char *record = pos;
+	if (js_check(&pos, end) != 0)
+		return NULL;
+	return record;
+}
+
+uint64_t
+js_record_index_find(const struct js_record_index *index, const char *data,
+		     uint64_t offset)
+{
+	if (offset >= index->scanned)
+		return UINT64_MAX;
+	/* The last indexed offset which is <= offset */
+	uint64_t lo = 0, hi = (index->count + index->stride - 1) /
+			      index->stride;
+	while (hi - lo > 1) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (index->offsets[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	uint64_t n = lo * index->stride;
+	const char *end = data + index->scanned;
+	const char *pos = data + index->offsets[lo];
+	do {
+		if (js_check(&pos, end) != 0)
+			return UINT64_MAX;
+		n++;
+	} while ((uint64_t) (pos - data) <= offset);
+	return n - 1;
+}
+
+/** "JSIDX" + format version */
+static const char js_record_index_magic[8] = "JSIDX\0\0\1";
+
+/** Sidecar file header, followed by the offsets */
+struct js_record_index_header {
+	char magic[8];
+	/** 0x01020304 in the byte order of the writer */
+	uint32_t byte_order;
+	uint32_t stride;
+	uint64_t count;
+	uint64_t scanned;
+};
+
+int
+js_record_index_save(const struct js_record_index *index, FILE *file)
+{
+	struct js_record_index_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, js_record_index_magic, sizeof(header.magic));
+	header.byte_order = 0x01020304;
+	header.stride = index->stride;
+	header.count = index->count;
+	header.scanned = index->scanned;
+	uint64_t slots = (index->count + index->stride - 1) / index->stride;
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		return -1;
+	if (slots > 0 &&
+	    fwrite(index->offsets, sizeof(uint64_t), slots, file) != slots)
+		return -1;
+	return fflush(file) == 0 ? 0 : -1;
+}
+
+int
+js_record_index_load(struct js_record_index *index, FILE *file, size_t size)
+{
+	struct js_record_index_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1)
+		return -1;
+	if (memcmp(header.magic, js_record_index_magic,
+		   sizeof(header.magic)) != 0 ||
+	    header.byte_order != 0x01020304 || header.stride == 0)
+		return -1;
+	/* Every record takes at least one byte */
+	if (header.scanned > size || header.count > header.scanned ||
+	    (header.count == 0) != (header.scanned == 0))
+		return -1;
+	js_record_index_destroy(index);
+	index->stride = header.stride;
+	uint64_t slots = (header.count + header.stride - 1) / header.stride;
+	if (js_record_index_reserve(index, slots) != 0)
+		return -1;
+	if (slots > 0 &&
+	    fread(index->offsets, sizeof(uint64_t), slots, file) != slots)
+		return -1;
+	uint64_t i;
+	for (i = 0; i < slots; i++) {
+		if ((i == 0 && index->offsets[i] != 0) ||
+		    (i > 0 && index->offsets[i] <= index->offsets[i - 1]) ||
+		    index->offsets[i] >= header.scanned)
+			return -1;
+	}
+	index->count = header.count;
+	index->scanned = header.scanned;
+	return 0;
+}
+
+/*
+ * }}}
+ */
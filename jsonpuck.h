@@ -15,6 +15,10 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <limits.h>
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
 
 #if defined(__cplusplus)
 extern "C" {
@@ -562,17 +566,49 @@ js_encode_strl(char *data, uint32_t len);
 
 /**
  * \brief Encode a string of length \a len.
- * The function is equivalent to js_encode_strl() + memcpy.
+ * The string is quoted and escaped according to JSON rules (see
+ * js_char2escape), so up to 2 + 6 * \a len bytes are written.
  * \param data - a buffer
- * \param str - a pointer to string data
+ * \param str - a pointer to string data (is not required to be
+ * zero-terminated)
  * \param len - a string length
- * \return \a data + js_sizeof_str(len) ==
- * data + js_sizeof_strl(len) + len
+ * \return the end of the encoded string in \a data
  * \sa js_encode_strl
  */
 JS_PROTO char *
 js_encode_str(char *data, const char *str, uint32_t len);
 
+/**
+ * \brief Check that \a str of \a len bytes is valid UTF-8: no overlong
+ * forms, surrogates, code points above U+10FFFF or truncated sequences.
+ * \param str - a pointer to string data
+ * \param len - a string length
+ * \retval true if \a str is valid UTF-8
+ */
+JS_PROTO bool
+js_utf8_valid(const char *str, uint32_t len);
+
+/**
+ * \brief Equivalent to js_encode_str() but fails if \a str is not valid
+ * UTF-8 (see js_utf8_valid()), as required by JSON.
+ *
+ * Every run of bytes between two escaped characters is validated right
+ * after the escape scan has found it, while it is still in cache. The
+ * escaped characters are ASCII, which never occurs inside a multibyte
+ * sequence, so checking runs one by one is the same as checking the
+ * whole string.
+ *
+ * \param data - a buffer
+ * \param str - a pointer to string data
+ * \param len - a string length
+ * \return the end of the encoded string in \a data
+ * \retval NULL if \a str is not valid UTF-8, \a data is partially
+ * written
+ * \sa js_encode_str
+ */
+JS_PROTO char *
+js_encode_str_utf8(char *data, const char *str, uint32_t len);
+
 /**
  * \brief Encode a binstring header of length \a len.
  * See js_encode_strl() for more details.
@@ -659,6 +695,46 @@ js_vformat(char *data, size_t data_size, const char *format, va_list args);
 JS_PROTO int
 js_fprint(FILE* file, const char *data);
 
+/**
+ * \brief print to \a buf jsonpacked data in JSON format, like js_fprint().
+ * At most \a size bytes including the terminating zero are written.
+ * \param buf - a buffer (may be NULL if \a size is 0)
+ * \param size - the size of \a buf
+ * \param data - pointer to buffer containing jsonpack object
+ * \return the number of characters (excluding the terminating zero) which
+ * would be written if \a size was large enough, like snprintf() does.
+ * Unlike snprintf(), sizes are size_t, so output above 2 GB is fine.
+ */
+JS_PROTO size_t
+js_snprint(char *buf, size_t size, const char *data);
+
+struct js_allocator;
+
+/**
+ * \brief print to \a file jsonpacked data in JSON format, like js_fprint(),
+ * converting elements of a top-level array in \a nthreads threads.
+ *
+ * The array is split at element boundaries into slices of about
+ * JS_PRINT_SLICE_SIZE bytes. Worker threads take slices one by one and
+ * convert each into its own output buffer, while the calling thread writes
+ * the buffers to \a file in order with separators. The number of slices in
+ * flight is bounded, so memory does not grow with the size of \a data.
+ * Values other than arrays and small arrays are printed by js_fprint(),
+ * as well as any value if no worker thread can be started.
+ * \param file - pointer to file (or NULL for stdout)
+ * \param data - pointer to buffer containing jsonpack object
+ * \param nthreads - the number of worker threads
+ * \param allocator - memory for output buffers, NULL for malloc()
+ * \retval 0 - success
+ * \retval -1 - a write or memory allocation error
+ */
+int
+js_fprint_parallel(FILE *file, const char *data, int nthreads,
+		   const struct js_allocator *allocator);
+
+/** The size of a slice of input converted by one js_fprint_parallel() job */
+#define JS_PRINT_SLICE_SIZE (1 << 20)
+
 /**
  * \brief Check that \a cur buffer has enough bytes to decode a string header
  * \param cur buffer
@@ -828,6 +904,77 @@ js_check_bool(const char *cur, const char *end);
 JS_PROTO bool
 js_decode_bool(const char **data);
 
+/**
+ * \brief Encode an array header of \a size elements as JSONPack.
+ *
+ * js_encode_array() and other js_encode_*() functions emit JSON text;
+ * js_pack_*() functions emit JSONPack with the smallest header for the
+ * value, i.e. exactly js_sizeof_*() bytes. They are used to build and
+ * rewrite JSONPack documents (see js_canonicalize(), js_patch()).
+ * \param data - a buffer
+ * \param size - the number of elements
+ * \return \a data + js_sizeof_array(\a size)
+ */
+JS_PROTO char *
+js_pack_array(char *data, uint32_t size);
+
+/**
+ * \brief Encode a map header of \a size pairs as JSONPack.
+ * \return \a data + js_sizeof_map(\a size)
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_map(char *data, uint32_t size);
+
+/**
+ * \brief Encode an unsigned integer as JSONPack.
+ * \return \a data + js_sizeof_uint(\a num)
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_uint(char *data, uint64_t num);
+
+/**
+ * \brief Encode a negative integer as JSONPack.
+ * \return \a data + js_sizeof_int(\a num)
+ * \pre \a num < 0
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_int(char *data, int64_t num);
+
+/**
+ * \brief Encode a string as JSONPack.
+ * \return \a data + js_sizeof_str(\a len)
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_str(char *data, const char *str, uint32_t len);
+
+/**
+ * \brief Encode nil as JSONPack.
+ * \return \a data + js_sizeof_nil()
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_nil(char *data);
+
+/**
+ * \brief Encode a bool as JSONPack.
+ * \return \a data + js_sizeof_bool(\a val)
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_bool(char *data, bool val);
+
+/**
+ * \brief Encode a double as JSONPack.
+ * \return \a data + js_sizeof_double(\a num)
+ * \sa js_pack_array()
+ */
+JS_PROTO char *
+js_pack_double(char *data, double num);
+
 /**
  * \brief Skip one element in a packed \a data.
  *
@@ -902,1122 +1049,5268 @@ js_next(const char **data);
 JS_PROTO int
 js_check(const char **data, const char *end);
 
-/*
- * }}}
- */
+/** Maximal nesting of containers accepted by js_check_opts() */
+#define JS_CHECK_MAX_DEPTH 256
+
+/** Limits of js_check_opts(), 0 means no limit or check */
+struct js_check_opts {
+	/**
+	 * maximal nesting of containers, a scalar has depth 0, [[1]] has
+	 * depth 2; never exceeds JS_CHECK_MAX_DEPTH
+	 */
+	uint32_t max_depth;
+	/** maximal number of values, including nested ones and map keys */
+	uint64_t max_elements;
+	/** maximal length of a JS_STR or JS_BIN payload */
+	uint32_t max_str_len;
+	/** reject JS_STR payloads which are not valid UTF-8 */
+	bool check_utf8;
+};
 
-/*
- * {{{ Implementation
+/**
+ * \brief Equivalent to js_check() but also enforces \a opts limits.
+ *
+ * Every pending element takes at least one byte, so a container header
+ * claiming more elements than bytes left in the buffer is rejected
+ * right away. Hostile input fails in time proportional to its size
+ * rather than to the counts in its headers.
+ *
+ * \param data - the pointer to a buffer
+ * \param end - the end of a buffer
+ * \param opts - limits, NULL means no limits except JS_CHECK_MAX_DEPTH
+ * \retval 0 when JSONPack in \a data is valid and within the limits
+ * \retval != 0 otherwise
+ * \post *data = *data + js_sizeof_TYPE() where TYPE is js_typeof(**data)
+ * \post *data is not defined if JSONPack is not valid
+ * \sa js_check()
  */
+JS_PROTO int
+js_check_opts(const char **data, const char *end,
+	      const struct js_check_opts *opts);
 
-/** \cond false */
-extern const enum js_type js_type_hint[];
-extern const int8_t js_parser_hint[];
-extern const char *js_char2escape[];
+/**
+ * \brief Compare two JSONPack values in a total order.
+ *
+ * Values of different kinds are ordered as nil < bool < number < str <
+ * bin < array < map < ext. Numbers are compared by value across
+ * encodings and types: 5 as a fixint, 0xcc 0x05, 5.0f and 5.0 are all
+ * equal, -0.0 equals 0 and NaN is greater than any other number and
+ * equal to itself. Strings and bins are compared with memcmp(), a prefix
+ * goes first. Arrays are compared element by element, a prefix goes
+ * first. Maps are compared as arrays of key-value pairs in the encoded
+ * order (see js_canonicalize() to sort keys). Exts are compared by type,
+ * then as bins.
+ *
+ * Both values are walked in lockstep and the walk stops at the first
+ * difference, no subtree is decoded in advance.
+ * \param data_a - value a
+ * \param data_b - value b
+ * \retval < 0 when \a a < \a b
+ * \retval   0 when \a a == \a b
+ * \retval > 0 when \a a > \a b
+ */
+JS_PROTO __attribute__((pure)) int
+js_compare(const char *data_a, const char *data_b);
 
-JS_IMPL JS_ALWAYSINLINE enum js_type
-js_typeof(const char c)
-{
-	return js_type_hint[(uint8_t) c];
-}
+/**
+ * \brief Calculate a 64-bit hash of a JSONPack value.
+ *
+ * The hash is computed in one pass over a canonical view of the value:
+ * values which are equal according to js_compare() hash the same, e.g.
+ * 0x05, 0xcc 0x05 and 5.0 as a double. Strings and bins are hashed 16
+ * bytes at a time with a wyhash-style multiply-fold mix. The hash is not
+ * cryptographic.
+ * \param data - a value
+ * \param seed - a seed
+ * \return the hash
+ * \sa js_hash_unordered()
+ */
+JS_PROTO __attribute__((pure)) uint64_t
+js_hash(const char *data, uint64_t seed);
 
-JS_IMPL uint32_t
-js_sizeof_array(uint32_t size)
-{
-	if (size <= 15) {
-		return 1;
-	} else if (size <= UINT16_MAX) {
-		return 1 + sizeof(uint16_t);
-	} else {
-		return 1 + sizeof(uint32_t);
-	}
-}
+/**
+ * \brief Same as js_hash(), but maps with the same pairs in different
+ * order hash the same.
+ *
+ * Each key-value pair is hashed separately from \a seed and pair hashes
+ * are summed, so this is a bit slower than js_hash() on maps.
+ * \sa js_hash()
+ */
+JS_PROTO __attribute__((pure)) uint64_t
+js_hash_unordered(const char *data, uint64_t seed);
 
-JS_IMPL char *
-js_encode_array(char *data, uint32_t size)
-{
-	sprintf(data, "[");
-	//TODO::STACK
-	//stack push ARRAY(size);
-	return ++data;
-}
+/** js_canonicalize() flags */
+enum {
+	/** Sort map pairs by keys in the order of js_compare() */
+	JS_CANONICAL_SORT_KEYS = 1 << 0,
+};
 
-JS_IMPL ptrdiff_t
-js_check_array(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_ARRAY);
-	uint8_t c = js_load_u8(&cur);
-	if (js_likely(!(c & 0x40)))
-		return cur - end;
+struct js_arena;
 
-	assert(c >= 0xdc && c <= 0xdd); /* must be checked above by js_typeof */
-	uint32_t hsize = 2U << (c & 0x1); /* 0xdc->2, 0xdd->4 */
-	return hsize - (end - cur);
-}
+/**
+ * \brief Rewrite a JSONPack value with the smallest headers.
+ *
+ * Every integer, string, bin, ext, array and map is re-emitted with the
+ * header chosen by js_sizeof_uint(), js_sizeof_int(), js_sizeof_strl(),
+ * js_sizeof_binl(), js_sizeof_array() and js_sizeof_map(); non-negative
+ * JS_INT values become JS_UINT. Floats and doubles are copied as is.
+ * With JS_CANONICAL_SORT_KEYS map pairs are also sorted by keys (pairs
+ * with equal keys keep their order), so documents which are equal up to
+ * encoding and key order become byte-equal and can be compared with
+ * memcmp().
+ *
+ * The output is never larger than the input. To size a buffer exactly,
+ * call the function with \a dst == NULL first.
+ * \param data - the pointer to a buffer, JSONPack must be valid
+ * \param dst - an output buffer or NULL to only calculate the size
+ * \param flags - JS_CANONICAL_* flags
+ * \param arena - an arena for temporary memory used to sort keys, may be
+ * NULL without JS_CANONICAL_SORT_KEYS. The memory is given back before
+ * the function returns, so the arena doesn't grow over repeated calls
+ * once its chunk fits the most deeply nested maps; allocations made by
+ * the caller are kept.
+ * \return the size of the canonical value
+ * \retval SIZE_MAX on memory allocation error
+ * \post *data = *data + js_sizeof_TYPE() where TYPE is js_typeof(**data)
+ */
+JS_PROTO size_t
+js_canonicalize(const char **data, char *dst, unsigned flags,
+		struct js_arena *arena);
+
+/** js_patch() operations */
+enum js_patch_op {
+	/**
+	 * Replace the value at the path. If the path points to a missing
+	 * key of a map, the pair is added.
+	 */
+	JS_PATCH_SET = 0,
+	/**
+	 * Insert the value before the array element at the path ("-" is
+	 * the end of an array) or add a key which must not exist to a map.
+	 */
+	JS_PATCH_INSERT,
+	/** Remove the array element or the map pair at the path */
+	JS_PATCH_DELETE,
+};
 
-JS_PROTO uint32_t
-js_decode_array_slowpath(uint8_t c, const char **data);
+/**
+ * \brief Apply one update to a JSONPack document and write the result.
+ *
+ * \a path is a JSON pointer (RFC 6901), e.g. "/users/0/name": each
+ * segment is a map key (string, "~1" stands for '/' and "~0" for '~') or
+ * an array index. "" is the whole document.
+ *
+ * Nothing is decoded or re-encoded except the header of the container
+ * which holds the target, and only if its element count changes (headers
+ * store counts, not byte sizes, so the headers of outer containers stay
+ * valid). Everything else is copied verbatim in at most three memcpy()
+ * calls, with the spans found by js_next().
+ *
+ * \param data - a document, JSONPack must be valid
+ * \param dst - an output buffer, must not overlap \a data, or NULL to
+ * only calculate the size
+ * \param op - an operation
+ * \param path - a zero-terminated JSON pointer
+ * \param value - a JSONPack value for JS_PATCH_SET and JS_PATCH_INSERT,
+ * ignored (and may be NULL) for JS_PATCH_DELETE
+ * \return the size of the patched document
+ * \retval SIZE_MAX if the path does not exist (the parent of the target
+ * must exist), is malformed or does not fit \a op
+ */
+JS_PROTO size_t
+js_patch(const char *data, char *dst, enum js_patch_op op, const char *path,
+	 const char *value);
 
-JS_IMPL uint32_t
-js_decode_array_slowpath(uint8_t c, const char **data)
-{
-	uint32_t size;
-	switch (c & 0x1) {
-	case 0xdc & 0x1:
-		size = js_load_u16(data);
-		return size;
-	case 0xdd & 0x1:
-		size = js_load_u32(data);
-		return size;
-	default:
-		js_unreachable();
-	}
-}
+/**
+ * \brief Produce a merge patch (RFC 7396) which turns document \a a into
+ * document \a b.
+ *
+ * If both documents are maps, they are walked together: keys missing in
+ * \a b map to nil, new keys and changed values are copied from \a b
+ * verbatim, maps present on both sides are diffed recursively and equal
+ * values (byte-equal spans found by js_next()) are left out. Otherwise
+ * the patch is \a b itself. Unchanged documents give an empty map.
+ *
+ * As in RFC 7396, nil means removal in a patch, so a nil value in \a b
+ * can't be transferred. Keys are looked up starting from the position
+ * of the previous match, which is O(1) when both maps share key order;
+ * a missing key costs a scan of the other map.
+ * \param a - the old document, JSONPack must be valid
+ * \param b - the new document, JSONPack must be valid
+ * \param dst - an output buffer or NULL to only calculate the size
+ * \return the size of the patch
+ * \sa js_merge_apply()
+ */
+JS_PROTO size_t
+js_diff(const char *a, const char *b, char *dst);
 
-JS_IMPL JS_ALWAYSINLINE uint32_t
-js_decode_array(const char **data)
-{
-	uint8_t c = js_load_u8(data);
+/**
+ * \brief Apply merge patch \a patch (RFC 7396) to document \a target.
+ *
+ * Pairs of \a target which the patch does not touch are copied verbatim.
+ * Keys are looked up as in js_diff(), so a target key missing from the
+ * patch costs a scan of the patch: keep patches small.
+ * \param target - a document, JSONPack must be valid
+ * \param patch - a patch, JSONPack must be valid
+ * \param dst - an output buffer or NULL to only calculate the size
+ * \return the size of the patched document
+ * \sa js_diff()
+ */
+JS_PROTO size_t
+js_merge_apply(const char *target, const char *patch, char *dst);
 
-	if (js_likely(!(c & 0x40)))
-		return (c & 0xf);
+/**
+ * \brief Find the value at JSON pointer \a path (see js_patch()) without
+ * copying or decoding it.
+ *
+ * The span [*begin, *end) is a complete JSONPack value which can be
+ * forwarded as is, e.g. with js_splice().
+ * \param data - a document, JSONPack must be valid
+ * \param path - a zero-terminated JSON pointer, "" is the whole document
+ * \param[out] begin - the beginning of the value
+ * \param[out] end - the end of the value
+ * \retval 0 on success
+ * \retval -1 if the path does not exist or is malformed
+ */
+JS_PROTO int
+js_slice(const char *data, const char *path, const char **begin,
+	 const char **end);
 
-	return js_decode_array_slowpath(c, data);
-}
+#if !defined(_WIN32)
+/**
+ * \brief Build a container around borrowed values for writev().
+ *
+ * A header of an array of \a count values (JS_ARRAY) or of a map of
+ * \a count / 2 pairs (JS_MAP, \a spans alternate keys and values) is
+ * written to \a header, then \a iov is filled with the header followed by
+ * \a spans. Values are not copied or re-encoded.
+ *
+ * Example usage:
+ * \code
+ * struct iovec spans[2], iov[3];
+ * char header[5], key[16];
+ * const char *begin, *end;
+ * js_slice(doc, "/payload", &begin, &end);
+ * char *key_end = js_pack_str(key, "payload", 7);
+ * spans[0] = (struct iovec) { key, key_end - key };
+ * spans[1] = (struct iovec) { (void *) begin, end - begin };
+ * int iovcnt = js_splice(JS_MAP, spans, 2, header, iov);
+ * writev(fd, iov, iovcnt);
+ * \endcode
+ * \param type - JS_ARRAY or JS_MAP
+ * \param spans - complete JSONPack values
+ * \param count - the number of \a spans
+ * \param header - a buffer for the header, at least 5 bytes
+ * \param[out] iov - \a count + 1 entries
+ * \return the number of filled \a iov entries
+ * \retval -1 if \a type is not a container, \a count is odd for a map
+ * or \a count + 1 does not fit int
+ */
+JS_PROTO int
+js_splice(enum js_type type, const struct iovec *spans, uint32_t count,
+	  char *header, struct iovec *iov);
+#endif /* !defined(_WIN32) */
+
+/** Actions returned by js_sax_handler callbacks */
+enum js_sax_action {
+	/** Continue parsing */
+	JS_SAX_OK = 0,
+	/**
+	 * Skip the container which has just been started, or the value of
+	 * the key which has just been reported. The skipped data is still
+	 * validated, but no callbacks are called for it.
+	 */
+	JS_SAX_SKIP,
+	/** Stop parsing, js_sax_parse() returns JS_SAX_STOP */
+	JS_SAX_STOP,
+	/** Stop parsing, js_sax_parse() returns -1 */
+	JS_SAX_ERROR,
+};
 
-JS_IMPL uint32_t
-js_sizeof_map(uint32_t size)
-{
-	if (size <= 15) {
-		return 1;
-	} else if (size <= UINT16_MAX) {
-		return 1 + sizeof(uint16_t);
-	} else {
-		return 1 + sizeof(uint32_t);
-	}
-}
+/**
+ * \brief Callbacks of js_sax_parse(). Any callback may be NULL, which is
+ * the same as returning JS_SAX_OK. Every callback returns
+ * enum js_sax_action.
+ */
+struct js_sax_handler {
+	/** An array of \a size elements is started */
+	int (*start_array)(void *ctx, uint32_t size);
+	/** The current array is finished */
+	int (*end_array)(void *ctx);
+	/** A map of \a size pairs is started */
+	int (*start_map)(void *ctx, uint32_t size);
+	/**
+	 * A map key. String keys are passed as \a str of \a len bytes.
+	 * Other keys are passed as NULL and reported as values right after
+	 * this callback, unless it returns JS_SAX_SKIP, which skips the
+	 * whole pair.
+	 */
+	int (*key)(void *ctx, const char *str, uint32_t len);
+	/** The current map is finished */
+	int (*end_map)(void *ctx);
+	/**
+	 * A scalar value (not an array or a map) at \a data, which can be
+	 * decoded with js_typeof() and js_decode_*().
+	 */
+	int (*value)(void *ctx, const char *data);
+};
 
-JS_IMPL char *
-js_encode_map(char *data, uint32_t size)
-{
-	sprintf(data, "{");
-	//TODO::STACK
-	//stack push ARRAY(size);
-	return ++data;
-}
+/** Maximal nesting of containers in js_sax_parse() */
+#define JS_SAX_MAX_DEPTH 128
 
-JS_IMPL ptrdiff_t
-js_check_map(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_MAP);
-	uint8_t c = js_load_u8(&cur);
-	if (js_likely((c & ~0xfU) == 0x80))
-		return cur - end;
+/**
+ * \brief Validate JSONPack in \a data and report its structure to
+ * \a handler in one pass.
+ *
+ * Values are validated with the js_parser_hint dispatch of js_check(),
+ * and a callback is only called once the value it reports has been
+ * bounds checked. Subtrees skipped with JS_SAX_SKIP go through the
+ * js_check() loop without callbacks. Containers are tracked on a fixed
+ * stack of JS_SAX_MAX_DEPTH levels, no recursion or allocation is
+ * involved.
+ *
+ * No js_check_opts() limits are applied: strings are not checked to be
+ * UTF-8, lengths and counts are only bounded by the buffer, and skipped
+ * subtrees may nest deeper than JS_SAX_MAX_DEPTH. For untrusted input,
+ * call js_check_opts() first or enforce limits in the callbacks, which
+ * see every size before the data is walked.
+ *
+ * Example usage:
+ * \code
+ * static int
+ * on_key(void *ctx, const char *str, uint32_t len)
+ * {
+ *     // Only "id" fields are interesting
+ *     return len == 2 && memcmp(str, "id", 2) == 0 ?
+ *            JS_SAX_OK : JS_SAX_SKIP;
+ * }
+ *
+ * struct js_sax_handler handler = { .key = on_key, .value = on_value };
+ * if (js_sax_parse(&data, end, &handler, &ids) != 0)
+ *     return -1;
+ * \endcode
+ *
+ * \param data - the pointer to a buffer
+ * \param end - the end of a buffer
+ * \param handler - callbacks
+ * \param ctx - an argument of callbacks
+ * \retval 0 the whole value has been parsed
+ * \retval JS_SAX_STOP a callback has returned JS_SAX_STOP
+ * \retval -1 invalid JSONPack, nesting is deeper than JS_SAX_MAX_DEPTH
+ * or a callback has returned JS_SAX_ERROR
+ * \post *data = *data + js_sizeof_TYPE() where TYPE is js_typeof(**data)
+ * when 0 is returned; *data points after the last reported value or
+ * header when JS_SAX_STOP is returned
+ */
+JS_PROTO int
+js_sax_parse(const char **data, const char *end,
+	     const struct js_sax_handler *handler, void *ctx);
 
-	assert(c >= 0xde && c <= 0xdf); /* must be checked above by js_typeof */
-	uint32_t hsize = 2U << (c & 0x1); /* 0xde->2, 0xdf->4 */
-	return hsize - (end - cur);
-}
+/** Maximal nesting of containers in js_reader */
+#define JS_READER_MAX_DEPTH 64
 
-JS_IMPL uint32_t
-js_decode_map(const char **data)
-{
-	uint8_t c = js_load_u8(data);
-	switch (c) {
-	case 0xde:
-		return js_load_u16(data);
-	case 0xdf:
-		return js_load_u32(data);
-	default:
-		if (js_unlikely(c < 0x80 || c > 0x8f))
-			js_unreachable();
-		return c & 0xf;
-	}
-}
+/**
+ * \brief Pull parser of one JSONPack value, an alternative to
+ * js_sax_parse() which leaves the control flow to the caller.
+ *
+ * The reader keeps the number of values left in every open container
+ * on a fixed stack, so documents of any size are streamed without
+ * recursion or allocation, and the caller can stop at any token.
+ *
+ * Example usage:
+ * \code
+ * struct js_reader reader;
+ * struct js_token token;
+ * int rc;
+ * js_reader_init(&reader, data, end);
+ * while ((rc = js_reader_next_token(&reader, &token)) > 0) {
+ *     if (token.is_key && token.depth == 1 && token.len == 2 &&
+ *         memcmp(token.str, "id", 2) == 0)
+ *         break; // the next token is the value of top-level "id"
+ * }
+ * \endcode
+ */
+struct js_reader {
+	/** the next token */
+	const char *pos;
+	/** the end of the buffer */
+	const char *end;
+	/** the number of open containers */
+	uint32_t depth;
+	/** true when the root value has been started */
+	bool started;
+	/**
+	 * values left in every open container, keys and values of maps
+	 * are counted separately
+	 */
+	uint64_t left[JS_READER_MAX_DEPTH];
+	/** true for open maps */
+	bool is_map[JS_READER_MAX_DEPTH];
+};
 
-JS_IMPL uint32_t
-js_sizeof_uint(uint64_t num)
-{
-	if (num <= 0x7f) {
-		return 1;
-	} else if (num <= UINT8_MAX) {
-		return 1 + sizeof(uint8_t);
-	} else if (num <= UINT16_MAX) {
-		return 1 + sizeof(uint16_t);
-	} else if (num <= UINT32_MAX) {
-		return 1 + sizeof(uint32_t);
-	} else {
-		return 1 + sizeof(uint64_t);
-	}
-}
+/** A token returned by js_reader_next_token() */
+struct js_token {
+	/** the type of the value */
+	enum js_type type;
+	/** the number of containers around the value, 0 for the root */
+	uint32_t depth;
+	/** true if the value is a map key */
+	bool is_key;
+	/** the encoded value */
+	const char *data;
+	/** JS_UINT */
+	uint64_t u;
+	/** JS_INT */
+	int64_t i;
+	/** JS_FLOAT and JS_DOUBLE */
+	double d;
+	/** JS_BOOL */
+	bool b;
+	/** JS_STR, JS_BIN and JS_EXT payload */
+	const char *str;
+	/**
+	 * JS_STR, JS_BIN and JS_EXT payload length, JS_ARRAY elements,
+	 * JS_MAP pairs
+	 */
+	uint32_t len;
+	/** JS_EXT type */
+	int8_t ext_type;
+};
 
-JS_IMPL uint32_t
-js_sizeof_int(int64_t num)
-{
-	assert(num < 0);
-	if (num >= -0x20) {
-		return 1;
-	} else if (num >= INT8_MIN && num <= INT8_MAX) {
-		return 1 + sizeof(int8_t);
-	} else if (num >= INT16_MIN && num <= UINT16_MAX) {
-		return 1 + sizeof(int16_t);
-	} else if (num >= INT32_MIN && num <= UINT32_MAX) {
-		return 1 + sizeof(int32_t);
-	} else {
-		return 1 + sizeof(int64_t);
-	}
-}
+/**
+ * \brief Start reading a JSONPack value from \a data.
+ * \param[out] reader - a reader
+ * \param data - a buffer
+ * \param end - the end of a buffer
+ */
+JS_PROTO void
+js_reader_init(struct js_reader *reader, const char *data, const char *end);
 
-JS_IMPL ptrdiff_t
-js_check_uint(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_UINT);
-	uint8_t c = js_load_u8(&cur);
-	return js_parser_hint[c] - (end - cur);
-}
+/**
+ * \brief Read the next token of \a reader.
+ *
+ * Every token is bounds checked before it is returned. Containers are
+ * returned as tokens of JS_ARRAY or JS_MAP type, followed by tokens of
+ * their elements at depth + 1. The end of a container is not reported:
+ * it can be noticed by the depth of the next token.
+ *
+ * \param reader - a reader
+ * \param[out] token - the token
+ * \retval 1 a token is returned
+ * \retval 0 the value is finished, reader->pos points after it
+ * \retval -1 invalid JSONPack or nesting deeper than JS_READER_MAX_DEPTH
+ */
+JS_PROTO int
+js_reader_next_token(struct js_reader *reader, struct js_token *token);
 
-JS_IMPL ptrdiff_t
-js_check_int(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_INT);
-	uint8_t c = js_load_u8(&cur);
-	return js_parser_hint[c] - (end - cur);
-}
+/**
+ * \brief Skip the values left in the innermost open container of
+ * \a reader, i.e. the whole container right after its token. The
+ * skipped values are validated by js_check().
+ * \param reader - a reader
+ * \retval 0 on success
+ * \retval -1 invalid JSONPack
+ */
+JS_PROTO int
+js_reader_skip(struct js_reader *reader);
 
-JS_IMPL char *
-js_encode_uint(char *data, uint64_t num)
-{
-	sprintf(data,"%llu", num);
-	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	return data + strlen(data);;
-}
+/**
+ * \brief Equivalent to js_check_opts() but validates elements of a
+ * top-level array in \a nthreads threads.
+ *
+ * A sequential js_check() pass over a top-level array validates the
+ * structure and finds element boundaries at chunk granularity. It only
+ * reads headers. Then js_check_opts() runs over the chunks concurrently:
+ * it applies the limits and validates string payloads as UTF-8. The
+ * boundary pass costs as much as a structural check, so threads only
+ * pay off with opts->check_utf8: without it, as well as for values other
+ * than arrays and for small arrays, js_check_opts() runs in the calling
+ * thread. Either way the result is identical to js_check_opts().
+ *
+ * \param data - the pointer to a buffer
+ * \param end - the end of a buffer
+ * \param opts - limits, see js_check_opts(), NULL means no limits except
+ * JS_CHECK_MAX_DEPTH
+ * \param nthreads - the number of threads, including the calling one
+ * \retval 0 when JSONPack in \a data is valid and within the limits
+ * \retval != 0 otherwise
+ * \post *data = *data + js_sizeof_TYPE() where TYPE is js_typeof(**data)
+ * \post *data is not defined if JSONPack is not valid
+ * \sa js_check_opts()
+ */
+int
+js_check_parallel(const char **data, const char *end,
+		  const struct js_check_opts *opts, int nthreads);
 
-JS_IMPL char *
-js_encode_int(char *data, int64_t num)
-{
-	sprintf(data,"%lli", num);
-	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	return data + strlen(data);;
-}
+/**
+ * \brief Build a structural index of JSON text: positions of characters
+ * { } [ ] : , outside of strings and of opening quotes of strings, in
+ * ascending order.
+ *
+ * A backslash escapes the next character, as in JSON strings (outside of
+ * strings a backslash is not valid JSON anyway). Other syntax is not
+ * validated.
+ * \param text - JSON text
+ * \param len - the length of \a text
+ * \param[out] index - positions, must have room for \a len entries
+ * \return the number of positions stored to \a index
+ * \retval -1 if \a text ends inside a string
+ */
+JS_PROTO ptrdiff_t
+js_json_index(const char *text, size_t len, uint64_t *index);
 
-JS_IMPL uint64_t
-js_decode_uint(const char **data)
-{
-	uint8_t c = js_load_u8(data);
-	switch (c) {
-	case 0xcc:
-		return js_load_u8(data);
-	case 0xcd:
-		return js_load_u16(data);
-	case 0xce:
-		return js_load_u32(data);
-	case 0xcf:
-		return js_load_u64(data);
-	default:
-		if (js_unlikely(c > 0x7f))
-			js_unreachable();
-		return c;
-	}
-}
+/**
+ * \brief Equivalent to js_json_index(), but scans blocks of \a text in
+ * \a nthreads threads.
+ *
+ * Whether a block starts inside a string depends on all text before it,
+ * so each block is first scanned speculatively: the parity of its quotes
+ * and the number of index entries for both possible starting states are
+ * counted. A prefix pass over blocks then reconciles the in-string carry
+ * and output offsets, and blocks are scanned again to write their entries
+ * straight to the final positions in \a index. No memory besides
+ * \a index is used.
+ * \sa js_json_index()
+ */
+ptrdiff_t
+js_json_index_parallel(const char *text, size_t len, uint64_t *index,
+		       int nthreads);
 
-JS_IMPL int
-js_compare_uint(const char *data_a, const char *data_b)
-{
-	uint8_t ca = js_load_u8(&data_a);
-	uint8_t cb = js_load_u8(&data_b);
+#if !defined(_WIN32)
 
-	int r = ca - cb;
-	if (r != 0)
-		return r;
+/**
+ * \brief Reader of concatenated JSONPack documents from a memory-mapped
+ * file, e.g. a log.
+ *
+ * Every document is validated by js_check() before it is returned. The
+ * kernel is asked to read JS_MMAP_READAHEAD bytes ahead of the cursor
+ * (MADV_WILLNEED) and pages behind the cursor are dropped from the
+ * process (MADV_DONTNEED), so resident memory stays bounded regardless
+ * of the file size. Documents returned earlier remain readable: their
+ * pages are faulted in again from the page cache on access.
+ *
+ * Example usage:
+ * \code
+ * struct js_mmap_reader reader;
+ * if (js_mmap_reader_open(&reader, "events.log") != 0)
+ *     return -1;
+ * const char *doc, *doc_end;
+ * int rc;
+ * while ((rc = js_mmap_reader_next(&reader, &doc, &doc_end)) > 0)
+ *     handle(doc, doc_end);
+ * js_mmap_reader_close(&reader);
+ * \endcode
+ */
+struct js_mmap_reader {
+	/** the mapped file */
+	const char *data;
+	/** the size of the file */
+	size_t size;
+	/** the offset of the next document */
+	size_t pos;
+	/** the end of the range advised with MADV_WILLNEED */
+	size_t advised;
+	/** the end of the range released with MADV_DONTNEED */
+	size_t released;
+};
 
-	if (ca <= 0x7f)
-		return 0;
+/** The size of the window read ahead of js_mmap_reader cursor */
+#define JS_MMAP_READAHEAD (4 << 20)
 
-	uint64_t a, b;
-	switch (ca & 0x3) {
-	case 0xcc & 0x3:
-		a = js_load_u8(&data_a);
-		b = js_load_u8(&data_b);
-		break;
-	case 0xcd & 0x3:
-		a = js_load_u16(&data_a);
-		b = js_load_u16(&data_b);
-		break;
-	case 0xce & 0x3:
-		a = js_load_u32(&data_a);
-		b = js_load_u32(&data_b);
-		break;
-	case 0xcf & 0x3:
-		a = js_load_u64(&data_a);
-		b = js_load_u64(&data_b);
-		return a < b ? -1 : a > b;
-		break;
-	default:
-		js_unreachable();
-	}
+/**
+ * \brief Map file \a path for reading.
+ * \param[out] reader - a reader
+ * \param path - a file path
+ * \retval 0 on success
+ * \retval -1 on error, errno is set
+ */
+int
+js_mmap_reader_open(struct js_mmap_reader *reader, const char *path);
 
-	int64_t v = (a - b);
-	return (v > 0) - (v < 0);
-}
+/**
+ * \brief Return the next document of \a reader.
+ * \param reader - a reader
+ * \param[out] doc - the beginning of the document
+ * \param[out] doc_end - the end of the document
+ * \retval 1 a document is returned
+ * \retval 0 end of file
+ * \retval -1 the rest of the file is not valid JSONPack, e.g. truncated
+ */
+int
+js_mmap_reader_next(struct js_mmap_reader *reader, const char **doc,
+		    const char **doc_end);
 
-JS_IMPL int64_t
-js_decode_int(const char **data)
-{
-	uint8_t c = js_load_u8(data);
-	switch (c) {
-	case 0xd0:
-		return (int8_t) js_load_u8(data);
-	case 0xd1:
-		return (int16_t) js_load_u16(data);
-	case 0xd2:
-		return (int32_t) js_load_u32(data);
-	case 0xd3:
-		return (int64_t) js_load_u64(data);
-	default:
-		if (js_unlikely(c < 0xe0))
-			js_unreachable();
-		return (int8_t) (c);
-	}
-}
+/**
+ * \brief Unmap the file of \a reader.
+ * \param reader - a reader
+ */
+void
+js_mmap_reader_close(struct js_mmap_reader *reader);
 
-JS_IMPL uint32_t
-js_sizeof_float(float num)
-{
-	(void) num;
-	return 1 + sizeof(float);
-}
+#endif /* !defined(_WIN32) */
 
-JS_IMPL uint32_t
-js_sizeof_double(double num)
-{
-	(void) num;
-	return 1 + sizeof(double);
-}
+/**
+ * \brief Sparse index of record boundaries in concatenated JSONPack
+ * documents, e.g. a log.
+ *
+ * The index keeps the offset of every \a stride-th record, so seeking to
+ * record N costs one lookup plus at most \a stride - 1 js_next() calls.
+ * The index is built incrementally: js_record_index_update() continues
+ * the scan where the previous call stopped, so appending records to the
+ * log only requires scanning the appended part. The index can be stored
+ * next to the log with js_record_index_save().
+ *
+ * Example usage:
+ * \code
+ * struct js_record_index index;
+ * js_record_index_create(&index, NULL, 1024);
+ * if (js_record_index_update(&index, data, size) < 0)
+ *     return -1; // out of memory
+ * // A corrupted or truncated tail is not indexed: n >= index.count
+ * const char *record = js_record_index_seek(&index, data, n);
+ * js_record_index_destroy(&index);
+ * \endcode
+ */
+struct js_record_index {
+	/** the allocator of \a offsets */
+	const struct js_allocator *allocator;
+	/** offsets[i] is the offset of record i * stride */
+	uint64_t *offsets;
+	/** the number of allocated \a offsets */
+	uint64_t capacity;
+	/** the number of records indexed */
+	uint64_t count;
+	/** the offset where the scan has stopped */
+	uint64_t scanned;
+	/** the number of records between consecutive offsets */
+	uint32_t stride;
+};
 
-JS_IMPL ptrdiff_t
-js_check_float(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_FLOAT);
-	return 1 + sizeof(float) - (end - cur);
-}
+/** The default stride of js_record_index */
+#define JS_RECORD_INDEX_STRIDE 1024
 
-JS_IMPL ptrdiff_t
-js_check_double(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_DOUBLE);
-	return 1 + sizeof(double) - (end - cur);
-}
+/**
+ * \brief Initialize an empty index.
+ * \param[out] index - an index
+ * \param allocator - an allocator or NULL for js_allocator_malloc
+ * \param stride - the number of records between indexed offsets or 0
+ * for JS_RECORD_INDEX_STRIDE
+ */
+void
+js_record_index_create(struct js_record_index *index,
+		       const struct js_allocator *allocator, uint32_t stride);
 
-JS_IMPL char *
-js_encode_float(char *data, float num)
-{
-	sprintf(data,"%f", num);//TODO:CHECK_IT
-	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	return data + strlen(data);
-}
+/**
+ * \brief Free memory used by \a index.
+ * \param index - an index
+ */
+void
+js_record_index_destroy(struct js_record_index *index);
 
-JS_IMPL char *
-js_encode_double(char *data, double num)
-{
-	sprintf(data,"%f", num); //TODO:CHECK_IT
-	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	return data + strlen(data);
-}
+/**
+ * \brief Index records of the log in [data, data + size) starting from
+ * index->scanned.
+ * \param index - an index
+ * \param data - the beginning of the log
+ * \param size - the size of the log, it must not be less than the size
+ * previously indexed
+ * \return the number of new records
+ * \retval -1 on memory allocation error or if \a size is less than
+ * index->scanned
+ * \note The scan stops at the first record which fails js_check(). A
+ * truncated record at the end of the log, e.g. the one being appended,
+ * is indexed by the next update once it is complete.
+ */
+int64_t
+js_record_index_update(struct js_record_index *index, const char *data,
+		       size_t size);
 
-JS_IMPL float
-js_decode_float(const char **data)
-{
-	uint8_t c = js_load_u8(data);
-	assert(c == 0xca);
-	(void) c;
-	return js_load_float(data);
-}
+/**
+ * \brief Find the record \a n of the log.
+ * \param index - an index
+ * \param data - the beginning of the log
+ * \param n - the record number
+ * \return the beginning of the record, which is valid JSONPack
+ * \retval NULL if n >= index->count or the log does not match the index
+ */
+const char *
+js_record_index_seek(const struct js_record_index *index, const char *data,
+		     uint64_t n);
 
-JS_IMPL double
-js_decode_double(const char **data)
-{
-	uint8_t c = js_load_u8(data);
-	assert(c == 0xcb);
-	(void) c;
-	return js_load_double(data);
-}
+/**
+ * \brief Find the number of the record containing byte \a offset.
+ * \param index - an index
+ * \param data - the beginning of the log
+ * \param offset - an offset in the log
+ * \return the record number
+ * \retval UINT64_MAX if offset >= index->scanned or the log does not
+ * match the index
+ */
+uint64_t
+js_record_index_find(const struct js_record_index *index, const char *data,
+		     uint64_t offset);
 
-JS_IMPL uint32_t
-js_sizeof_strl(uint32_t len)
-{
-	if (len <= 31) {
-		return 1;
-	} else if (len <= UINT8_MAX) {
-		return 1 + sizeof(uint8_t);
-	} else if (len <= UINT16_MAX) {
-		return 1 + sizeof(uint16_t);
-	} else {
-		return 1 + sizeof(uint32_t);
-	}
-}
+/**
+ * \brief Write \a index to a sidecar \a file.
+ * \param index - an index
+ * \param file - a file
+ * \retval 0 on success
+ * \retval -1 on I/O error
+ */
+int
+js_record_index_save(const struct js_record_index *index, FILE *file);
 
-JS_IMPL uint32_t
-js_sizeof_str(uint32_t len)
-{
-	return js_sizeof_strl(len) + len;
-}
+/**
+ * \brief Read an index written by js_record_index_save().
+ *
+ * Offsets must start at 0, increase and stay within the indexed part,
+ * which must fit in the log of \a size bytes. Offsets are not checked to
+ * fall on record boundaries: js_record_index_seek() and
+ * js_record_index_find() walk records with js_check() up to the end of
+ * the indexed part, so an index which does not match a rewritten log
+ * gives wrong records or errors, but no reads beyond the log.
+ *
+ * \param index - an index initialized by js_record_index_create(),
+ * its stride is replaced with the stored one
+ * \param file - a file
+ * \param size - the size of the log
+ * \retval 0 on success
+ * \retval -1 on I/O error, bad format, offsets which don't fit the log
+ * or memory allocation error
+ */
+int
+js_record_index_load(struct js_record_index *index, FILE *file, size_t size);
 
-JS_IMPL uint32_t
-js_sizeof_binl(uint32_t len)
-{
-	if (len <= UINT8_MAX) {
-		return 1 + sizeof(uint8_t);
-	} else if (len <= UINT16_MAX) {
-		return 1 + sizeof(uint16_t);
-	} else {
-		return 1 + sizeof(uint32_t);
-	}
-}
+/**
+ * \brief Backing allocator of js_arena.
+ */
+struct js_allocator {
+	/** Allocate \a size bytes, return NULL on failure */
+	void *(*alloc)(void *ctx, size_t size);
+	/** Free \a ptr of \a size bytes returned by alloc() */
+	void (*free)(void *ctx, void *ptr, size_t size);
+	/** An opaque argument of alloc() and free() */
+	void *ctx;
+};
 
-JS_IMPL uint32_t
-js_sizeof_bin(uint32_t len)
-{
-	return js_sizeof_binl(len) + len;
-}
+/** malloc()/free() based allocator, used when no allocator is given */
+extern const struct js_allocator js_allocator_malloc;
 
-JS_IMPL char *
-js_encode_strl(char *data, uint32_t len)
-{
-	if (len <= 31) {
-		return js_store_u8(data, 0xa0 | (uint8_t) len);
-	} else if (len <= UINT8_MAX) {
-		data = js_store_u8(data, 0xd9);
-		return js_store_u8(data, len);
-	} else if (len <= UINT16_MAX) {
-		data = js_store_u8(data, 0xda);
-		return js_store_u16(data, len);
-	} else {
-		data = js_store_u8(data, 0xdb);
-		return js_store_u32(data, len);
-	}
-}
+/** \cond false */
+struct js_arena_chunk {
+	struct js_arena_chunk *next;
+	size_t size;
+};
+/** \endcond */
 
-JS_IMPL char *
-js_encode_str(char *data, const char *str, uint32_t len)
-{
-	sprintf(data,"\"%s\"", str);
-	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	assert(strlen(data) == len + 2); //TODO:fix len
-	return data + len + 2;
-}
+/**
+ * \brief Bump allocator for memory needed by jsonpuck functions.
+ *
+ * Memory is carved from chunks obtained from a backing allocator. Chunks
+ * grow geometrically, and js_arena_reset() keeps the largest one, so after
+ * a few requests an arena which is reset per request serves all
+ * allocations without calling the backing allocator at all.
+ *
+ * Example usage:
+ * \code
+ * struct js_arena arena;
+ * js_arena_create(&arena, NULL, 4096);
+ * for (;;) {
+ *     // handle a request, e.g.:
+ *     uint32_t *offsets = js_arena_alloc(&arena, n * sizeof(*offsets));
+ *     ...
+ *     js_arena_reset(&arena);
+ * }
+ * js_arena_destroy(&arena);
+ * \endcode
+ */
+struct js_arena {
+	/** the backing allocator */
+	const struct js_allocator *allocator;
+	/** the current chunk, followed by older ones */
+	struct js_arena_chunk *chunk;
+	/** free space of the current chunk */
+	char *pos;
+	char *end;
+	/** the size of the next chunk */
+	size_t chunk_size;
+	/** incremented by js_arena_reset(), see js_cursor */
+	uint64_t generation;
+};
 
-JS_IMPL char *
-js_encode_binl(char *data, uint32_t len)
-{
-	if (len <= UINT8_MAX) {
-		data = js_store_u8(data, 0xc4);
-		return js_store_u8(data, len);
-	} else if (len <= UINT16_MAX) {
-		data = js_store_u8(data, 0xc5);
-		return js_store_u16(data, len);
-	} else {
-		data = js_store_u8(data, 0xc6);
-		return js_store_u32(data, len);
-	}
-}
+/** Alignment of memory returned by js_arena_alloc() */
+#define JS_ARENA_ALIGN 16
 
-JS_IMPL char *
-js_encode_bin(char *data, const char *str, uint32_t len)
-{
-	data = js_encode_binl(data, len);
-	memcpy(data, str, len);
-	return data + len;
-}
+/**
+ * \brief Initialize \a arena.
+ * No memory is allocated until the first js_arena_alloc().
+ * \param arena - an arena
+ * \param allocator - a backing allocator or NULL for js_allocator_malloc
+ * \param chunk_size - the size of the first chunk
+ */
+JS_PROTO void
+js_arena_create(struct js_arena *arena, const struct js_allocator *allocator,
+		size_t chunk_size);
 
-JS_IMPL ptrdiff_t
-js_check_strl(const char *cur, const char *end)
-{
-	assert(cur < end);
-	assert(js_typeof(*cur) == JS_STR);
+/**
+ * \brief Return all chunks of \a arena to the backing allocator.
+ * \param arena - an arena
+ */
+JS_PROTO void
+js_arena_destroy(struct js_arena *arena);
 
-	uint8_t c = js_load_u8(&cur);
-	if (js_likely(c & ~0x1f) == 0xa0)
-		return cur - end;
+/**
+ * \brief Free all memory allocated from \a arena at once.
+ * The largest chunk is kept for future allocations, others are returned to
+ * the backing allocator.
+ * \param arena - an arena
+ */
+JS_PROTO void
+js_arena_reset(struct js_arena *arena);
 
-	assert(c >= 0xd9 && c <= 0xdb); /* must be checked above by js_typeof */
-	uint32_t hsize = 1U << (c & 0x3) >> 1; /* 0xd9->1, 0xda->2, 0xdb->4 */
-	return hsize - (end - cur);
-}
+/**
+ * \brief Allocate \a size bytes aligned to JS_ARENA_ALIGN from \a arena.
+ * A request of 0 bytes returns a valid pointer which must not be
+ * dereferenced and may be equal to the result of the next call.
+ * \param arena - an arena
+ * \param size - a number of bytes
+ * \return allocated memory or NULL if the backing allocator failed or
+ * \a size is too large to be rounded up to JS_ARENA_ALIGN
+ */
+JS_PROTO void *
+js_arena_alloc(struct js_arena *arena, size_t size);
 
-JS_IMPL ptrdiff_t
-js_check_binl(const char *cur, const char *end)
-{
-	uint8_t c = js_load_u8(&cur);
-	assert(cur < end);
-	assert(js_typeof(c) == JS_BIN);
+/**
+ * \brief Lazy cursor over JSONPack data.
+ *
+ * A cursor points to an encoded value. Children of a container are
+ * materialized on the first access and memoized in an arena, so repeated
+ * access to the same container takes O(1) while untouched subtrees cost
+ * nothing. Cursors of children stay valid until the arena is reset. A
+ * root cursor survives js_arena_reset(): its children are materialized
+ * again on the next access. A cursor must always be used with the same
+ * arena.
+ *
+ * JSONPack must be valid, e.g. checked by js_check() in advance.
+ *
+ * Example usage:
+ * \code
+ * struct js_cursor root;
+ * js_cursor_create(&root, data);
+ * struct js_cursor *users = js_cursor_find(&root, "users", 5, &arena);
+ * struct js_cursor *user = users ? js_cursor_child(users, 0, &arena) : NULL;
+ * for (; user != NULL; user = js_cursor_next_sibling(user)) {
+ *     struct js_cursor *name = js_cursor_find(user, "name", 4, &arena);
+ *     ...
+ * }
+ * \endcode
+ */
+struct js_cursor {
+	/** the encoded value */
+	const char *data;
+	/** the container of the value or NULL for the root */
+	struct js_cursor *parent;
+	/** the position of the value in parent->children */
+	uint32_t index;
+	/**
+	 * Children of a container: elements of an array, or interleaved
+	 * keys and values of a map. NULL until the first access.
+	 */
+	struct js_cursor *children;
+	/** js_arena generation of \a children */
+	uint64_t generation;
+};
 
-	assert(c >= 0xc4 && c <= 0xc6); /* must be checked above by js_typeof */
-	uint32_t hsize = 1U << (c & 0x3); /* 0xc4->1, 0xc5->2, 0xc6->4 */
-	return hsize - (end - cur);
-}
+/**
+ * \brief Initialize \a cursor with the root value \a data.
+ * \param cursor - a cursor
+ * \param data - JSONPack data
+ */
+JS_PROTO void
+js_cursor_create(struct js_cursor *cursor, const char *data);
 
-JS_IMPL uint32_t
-js_decode_strl(const char **data)
-{
-	uint8_t c = js_load_u8(data);
-	switch (c) {
-	case 0xd9:
-		return js_load_u8(data);
-	case 0xda:
-		return js_load_u16(data);
-	case 0xdb:
-		return js_load_u32(data);
-	default:
-		if (js_unlikely(c < 0xa0 || c > 0xbf))
-			js_unreachable();
-		return c & 0x1f;
-	}
-}
+/**
+ * \brief Return the type of the value under \a cursor.
+ * \param cursor - a cursor
+ * \return JSONPack type
+ */
+JS_PROTO enum js_type
+js_cursor_type(const struct js_cursor *cursor);
 
-JS_IMPL const char *
-js_decode_str(const char **data, uint32_t *len)
-{
-	assert(len != NULL);
+/**
+ * \brief Return the number of elements of an array or key/value pairs of
+ * a map under \a cursor, 0 for other types.
+ * \param cursor - a cursor
+ * \return the number of elements or pairs
+ */
+JS_PROTO uint32_t
+js_cursor_size(const struct js_cursor *cursor);
 
-	*len = js_decode_strl(data);
-	const char *str = *data;
-	*data += *len;
-	return str;
+/**
+ * \brief Return the \a i-th element of an array or the value of the
+ * \a i-th pair of a map under \a cursor.
+ * \param cursor - a cursor
+ * \param i - the position
+ * \param arena - memory for children of \a cursor
+ * \retval NULL if there is no such child or the arena is out of memory
+ */
+JS_PROTO struct js_cursor *
+js_cursor_child(struct js_cursor *cursor, uint32_t i, struct js_arena *arena);
+
+/**
+ * \brief Return the key of the \a i-th pair of a map under \a cursor.
+ * \sa js_cursor_child()
+ */
+JS_PROTO struct js_cursor *
+js_cursor_key(struct js_cursor *cursor, uint32_t i, struct js_arena *arena);
+
+/**
+ * \brief Find the value of a string \a key in a map under \a cursor.
+ * Pairs are scanned in order, the first match is returned.
+ * \param cursor - a cursor
+ * \param key - a key
+ * \param len - the length of \a key
+ * \param arena - memory for children of \a cursor
+ * \retval NULL if there is no such key or the arena is out of memory
+ */
+JS_PROTO struct js_cursor *
+js_cursor_find(struct js_cursor *cursor, const char *key, uint32_t len,
+	       struct js_arena *arena);
+
+/**
+ * \brief Return the next element of the parent array, or the next value
+ * (key) of the parent map if \a cursor is a value (key).
+ * \param cursor - a cursor returned by js_cursor_child(), js_cursor_key()
+ * or js_cursor_find()
+ * \retval NULL if \a cursor is the last one or the root
+ */
+JS_PROTO struct js_cursor *
+js_cursor_next_sibling(const struct js_cursor *cursor);
+
+/**
+ * \brief A string which points into a JSONPack buffer (not zero-terminated).
+ */
+struct js_str {
+	/** string data */
+	const char *str;
+	/** string length */
+	uint32_t len;
+};
+
+/**
+ * \brief Define a C struct \a name and its decoder and encoder from a
+ * schema \a schema.
+ *
+ * A schema is a macro which takes a macro \a FIELD and calls it for every
+ * field as FIELD(type, field), where type is one of uint (uint64_t), int
+ * (int64_t), double, bool and str (struct js_str).
+ *
+ * The generated struct contains the fields and a bitfield of presence
+ * flags js_has.<field>. The generated functions are:
+ *
+ * int name##_decode(const char **data, struct name *obj) - decode a map
+ * to \a obj. Keys are matched by length, first byte and a fixed-size
+ * memcmp() instead of a string compare per field, values are stored
+ * straight to the struct, unknown keys are skipped with js_next(), nil
+ * values leave fields unset. Returns 0 on success and -1 if data is not
+ * a map or a field has an incompatible type (*data is not defined then).
+ * Absent fields are zero. Integers are accepted for double fields,
+ * non-negative ones for int fields and vice versa. JSONPack must be
+ * validated by js_check() in advance.
+ *
+ * char *name##_encode(char *data, const struct name *obj) - encode the
+ * fields of \a obj which are set in js_has to JSON, like js_encode_map(),
+ * so decoding and encoding again keeps absent fields absent. Set the
+ * js_has flags of fields filled by hand. It is your responsibility to
+ * ensure that \a data has enough space.
+ *
+ * Example usage:
+ * \code
+ * #define person_schema(FIELD) \
+ *	FIELD(uint, id) \
+ *	FIELD(str, name) \
+ *	FIELD(double, score)
+ * JS_SCHEMA_DEFINE(person, person_schema)
+ *
+ * struct person p;
+ * if (person_decode(&data, &p) != 0)
+ *     return -1;
+ * if (p.js_has.name)
+ *     printf("%.*s\n", (int) p.name.len, p.name.str);
+ * \endcode
+ *
+ * JS_SCHEMA_STRUCT() and JS_SCHEMA_FUNCTIONS() define the struct and the
+ * functions separately, e.g. to share the struct in a header.
+ */
+#define JS_SCHEMA_DEFINE(name, schema) \
+	JS_SCHEMA_STRUCT(name, schema) \
+	JS_SCHEMA_FUNCTIONS(name, schema)
+
+/** \brief Define struct \a name of schema \a schema. */
+#define JS_SCHEMA_STRUCT(name, schema) \
+struct name { \
+	schema(JS_SCHEMA_FIELD_DECLARE) \
+	struct { \
+		schema(JS_SCHEMA_FIELD_HAS) \
+	} js_has; \
+};
+
+/** \brief Define decoder and encoder of struct \a name. */
+#define JS_SCHEMA_FUNCTIONS(name, schema) \
+static inline int \
+name##_decode(const char **data, struct name *obj) \
+{ \
+	memset(obj, 0, sizeof(*obj)); \
+	if (js_typeof(**data) != JS_MAP) \
+		return -1; \
+	for (uint32_t i = js_decode_map(data); i > 0; i--) { \
+		if (js_typeof(**data) != JS_STR) { \
+			js_next(data); \
+			js_next(data); \
+			continue; \
+		} \
+		uint32_t len; \
+		const char *key = js_decode_str(data, &len); \
+		schema(JS_SCHEMA_FIELD_DECODE) \
+		js_next(data); \
+	} \
+	return 0; \
+} \
+\
+static inline char * \
+name##_encode(char *data, const struct name *obj) \
+{ \
+	bool first = true; \
+	*data++ = '{'; \
+	schema(JS_SCHEMA_FIELD_ENCODE) \
+	(void) first; \
+	*data++ = '}'; \
+	return data; \
 }
 
-JS_IMPL uint32_t
-js_decode_binl(const char **data)
-{
-	uint8_t c = js_load_u8(data);
+/** \cond false */
+typedef uint64_t js_schema_uint;
+typedef int64_t js_schema_int;
+typedef double js_schema_double;
+typedef bool js_schema_bool;
+typedef struct js_str js_schema_str;
+
+#define JS_SCHEMA_FIELD_DECLARE(type, field) js_schema_##type field;
+
+#define JS_SCHEMA_FIELD_HAS(type, field) unsigned field : 1;
+
+#define JS_SCHEMA_FIELD_DECODE(type, field) \
+	if (len == sizeof(#field) - 1 && key[0] == #field[0] && \
+	    memcmp(key, #field, sizeof(#field) - 1) == 0) { \
+		if (js_typeof(**data) == JS_NIL) { \
+			js_next(data); \
+			continue; \
+		} \
+		if (js_schema_decode_##type(data, &obj->field) != 0) \
+			return -1; \
+		obj->js_has.field = 1; \
+		continue; \
+	}
 
-	switch (c) {
-	case 0xc4:
-		return js_load_u8(data);
-	case 0xc5:
-		return js_load_u16(data);
-	case 0xc6:
-		return js_load_u32(data);
-	default:
-		js_unreachable();
+#define JS_SCHEMA_FIELD_ENCODE(type, field) \
+	if (obj->js_has.field) { \
+		if (!first) { \
+			memcpy(data, ", ", 2); \
+			data += 2; \
+		} \
+		first = false; \
+		memcpy(data, "\"" #field "\": ", sizeof(#field) + 3); \
+		data += sizeof(#field) + 3; \
+		data = js_schema_encode_##type(data, obj->field); \
 	}
-}
 
-JS_IMPL const char *
-js_decode_bin(const char **data, uint32_t *len)
-{
-	assert(len != NULL);
+JS_PROTO int
+js_schema_decode_uint(const char **data, uint64_t *val);
 
-	*len = js_decode_binl(data);
-	const char *str = *data;
-	*data += *len;
-	return str;
-}
+JS_PROTO int
+js_schema_decode_int(const char **data, int64_t *val);
 
-JS_IMPL uint32_t
-js_decode_strbinl(const char **data)
-{
-	uint8_t c = js_load_u8(data);
+JS_PROTO int
+js_schema_decode_double(const char **data, double *val);
 
-	switch (c) {
-	case 0xd9:
-		return js_load_u8(data);
-	case 0xda:
-		return js_load_u16(data);
-	case 0xdb:
-		return js_load_u32(data);
-	case 0xc4:
-		return js_load_u8(data);
-	case 0xc5:
-		return js_load_u16(data);
-	case 0xc6:
-		return js_load_u32(data);
-	default:
-		if (js_unlikely(c < 0xa0 || c > 0xbf))
-			js_unreachable();
-		return c & 0x1f;
-	}
-}
+JS_PROTO int
+js_schema_decode_bool(const char **data, bool *val);
 
-JS_IMPL const char *
-js_decode_strbin(const char **data, uint32_t *len)
-{
-	assert(len != NULL);
+JS_PROTO int
+js_schema_decode_str(const char **data, struct js_str *val);
 
-	*len = js_decode_strbinl(data);
-	const char *str = *data;
-	*data += *len;
-	return str;
+JS_PROTO char *
+js_schema_encode_uint(char *data, uint64_t val);
+
+JS_PROTO char *
+js_schema_encode_int(char *data, int64_t val);
+
+JS_PROTO char *
+js_schema_encode_double(char *data, double val);
+
+JS_PROTO char *
+js_schema_encode_bool(char *data, bool val);
+
+JS_PROTO char *
+js_schema_encode_str(char *data, struct js_str val);
+/** \endcond */
+
+/**
+ * \brief Types of js_column values.
+ */
+enum js_column_type {
+	/** uint64_t, from JS_UINT */
+	JS_COLUMN_UINT = 0,
+	/** int64_t, from JS_UINT (up to INT64_MAX) and JS_INT */
+	JS_COLUMN_INT,
+	/** double, from JS_FLOAT, JS_DOUBLE, JS_UINT and JS_INT */
+	JS_COLUMN_DOUBLE,
+	/** struct js_str pointing into the decoded buffer, from JS_STR */
+	JS_COLUMN_STR
+};
+
+/**
+ * \brief A column of values of one map key, see js_decode_columns().
+ */
+struct js_column {
+	/** the key, set by the caller */
+	const char *key;
+	/** the key length, set by the caller */
+	uint32_t key_len;
+	/** the type of values, set by the caller */
+	enum js_column_type type;
+	/**
+	 * values by row, zero if the value is missing; NULL, as well as
+	 * \a validity, if there are no rows
+	 */
+	union {
+		uint64_t *u64;
+		int64_t *i64;
+		double *f64;
+		struct js_str *str;
+	} values;
+	/**
+	 * Validity bitmap: bit (i % 8) of validity[i / 8] is set if row i
+	 * has a value of a compatible type.
+	 */
+	uint8_t *validity;
+	/** the number of rows without a valid value */
+	uint32_t null_count;
+};
+
+/**
+ * \brief Decode an array of maps to columns (struct-of-arrays).
+ *
+ * The array is walked once: values of requested keys are stored to
+ * contiguous typed buffers allocated from \a arena, other values are
+ * skipped with js_next(). A value is missing in a column if a row is not
+ * a map, has no such key, or the value has an incompatible type (nil
+ * included). Keys usually come in the same order in every row, so each
+ * key is first compared with the column which followed the previous
+ * match.
+ *
+ * JSONPack must be valid, e.g. checked by js_check() in advance.
+ *
+ * Example usage:
+ * \code
+ * struct js_column columns[] = {
+ *     { .key = "ts", .key_len = 2, .type = JS_COLUMN_UINT },
+ *     { .key = "val", .key_len = 3, .type = JS_COLUMN_DOUBLE },
+ * };
+ * uint32_t rows;
+ * if (js_decode_columns(&data, columns, 2, &arena, &rows) != 0)
+ *     return -1;
+ * double sum = 0;
+ * for (uint32_t i = 0; i < rows; i++)
+ *     sum += columns[1].values.f64[i];
+ * \endcode
+ *
+ * \param data - the pointer to a buffer
+ * \param columns - columns, keys and types are set by the caller
+ * \param column_count - the number of columns
+ * \param arena - an arena for column buffers
+ * \param[out] row_count - the number of rows
+ * \retval 0 on success
+ * \retval -1 if \a data is not an array or memory allocation failed
+ * \post *data = *data + js_sizeof_TYPE() on success
+ */
+JS_PROTO int
+js_decode_columns(const char **data, struct js_column *columns,
+		  uint32_t column_count, struct js_arena *arena,
+		  uint32_t *row_count);
+
+/**
+ * \brief Decode \a n unsigned integers at \a data to \a out.
+ *
+ * Meant for arrays of numbers, e.g. time series: call js_decode_array()
+ * first, then decode its elements in bulk. Runs of positive fixints are
+ * widened with SIMD (see js_isa()).
+ * \param data - the pointer to a buffer
+ * \param[out] out - values
+ * \param n - the number of values
+ * \return the number of decoded values, less than \a n if a value is
+ * not JS_UINT. *data points to that value then.
+ * \post *data points after the last decoded value
+ */
+JS_PROTO uint32_t
+js_decode_array_u64(const char **data, uint64_t *out, uint32_t n);
+
+/**
+ * \brief Decode \a n integers (JS_UINT up to INT64_MAX or JS_INT) at
+ * \a data to \a out. Runs of fixints are widened with SIMD.
+ * \sa js_decode_array_u64()
+ */
+JS_PROTO uint32_t
+js_decode_array_i64(const char **data, int64_t *out, uint32_t n);
+
+/**
+ * \brief Decode \a n numbers (JS_DOUBLE, JS_FLOAT, JS_UINT or JS_INT)
+ * at \a data to \a out. Runs of doubles are copied in a tight loop
+ * without dispatching on the type of each value.
+ * \sa js_decode_array_u64()
+ */
+JS_PROTO uint32_t
+js_decode_array_f64(const char **data, double *out, uint32_t n);
+
+/**
+ * \brief Return an upper bound of the size of js_encode_array_u64()
+ * output for \a n values.
+ */
+JS_PROTO __attribute__((const)) size_t
+js_sizeof_array_u64(uint32_t n);
+
+/**
+ * \brief Return an upper bound of the size of js_encode_array_i64()
+ * output for \a n values.
+ */
+JS_PROTO __attribute__((const)) size_t
+js_sizeof_array_i64(uint32_t n);
+
+/**
+ * \brief Return an upper bound of the size of js_encode_array_f64()
+ * output for \a n values.
+ */
+JS_PROTO __attribute__((const)) size_t
+js_sizeof_array_f64(uint32_t n);
+
+/**
+ * \brief Encode \a n unsigned integers as a JSON array, e.g. [1, 2, 3].
+ *
+ * Brackets, separators and numbers are written in one loop, integers are
+ * formatted two digits at a time without sprintf(). It is your
+ * responsibility to ensure that \a data has js_sizeof_array_u64(n)
+ * bytes, no bounds are checked per element.
+ * \param data - a buffer
+ * \param values - values
+ * \param n - the number of values
+ * \return the end of the encoded array in \a data
+ */
+JS_PROTO char *
+js_encode_array_u64(char *data, const uint64_t *values, uint32_t n);
+
+/**
+ * \brief Encode \a n integers as a JSON array.
+ * \sa js_encode_array_u64(), js_sizeof_array_i64()
+ */
+JS_PROTO char *
+js_encode_array_i64(char *data, const int64_t *values, uint32_t n);
+
+/**
+ * \brief Encode \a n doubles as a JSON array.
+ *
+ * Integral values below 1e15 in magnitude and values which are short
+ * decimals (up to 6 fractional digits, e.g. 12.25) are formatted with
+ * integer arithmetic, others are printed with "%.17g". Every value is
+ * read back exactly (unlike js_encode_double(), which prints "%f"). NaN
+ * and infinities have no JSON representation and are encoded as null.
+ * \sa js_encode_array_u64(), js_sizeof_array_f64()
+ */
+JS_PROTO char *
+js_encode_array_f64(char *data, const double *values, uint32_t n);
+
+/**
+ * \brief Hot-path counters of js_next() and js_check().
+ *
+ * Counters are collected per thread and only if the library and all its
+ * users are compiled with JS_STATS defined (-DJSONPUCK_STATS=ON in CMake).
+ * Otherwise the instrumentation compiles to nothing and all counters are
+ * always zero.
+ */
+struct js_stats {
+	/** js_next() calls */
+	uint64_t next;
+	/** values (including nested ones) skipped by js_next() */
+	uint64_t next_values;
+	/** js_next() calls which fell into js_next_slowpath() */
+	uint64_t next_slowpath;
+	/** JS_HINT_* cases hit by js_next_slowpath(), by JS_HINT - hint */
+	uint64_t next_hint[10];
+	/** js_check() calls */
+	uint64_t check;
+	/** values (including nested ones) validated by js_check() */
+	uint64_t check_values;
+	/** bytes validated by js_check() */
+	uint64_t check_bytes;
+	/** payload bytes of str/bin values with JS_HINT_STR_* headers */
+	uint64_t check_str_bytes;
+	/** JS_HINT_* cases hit by js_check(), by JS_HINT - hint */
+	uint64_t check_hint[10];
+};
+
+/**
+ * \brief Copy hot-path counters of the calling thread to \a stats.
+ * \param[out] stats - counters
+ */
+void
+js_stats_snapshot(struct js_stats *stats);
+
+/**
+ * \brief Reset hot-path counters of the calling thread.
+ */
+void
+js_stats_reset(void);
+
+/**
+ * \brief Instruction sets of SIMD kernels.
+ */
+enum js_isa {
+	JS_ISA_SCALAR = 0,
+	JS_ISA_SSE42,
+	JS_ISA_AVX2,
+	JS_ISA_AVX512,
+	JS_ISA_MAX
+};
+
+/**
+ * \brief Return the instruction set of the kernels currently in use.
+ *
+ * Kernels are selected on first use according to cpuid: the best
+ * instruction set which is supported both by the running CPU and by the
+ * build is chosen. The choice can be capped by JSONPUCK_ISA environment
+ * variable ("scalar", "sse4.2", "avx2" or "avx512"), e.g. to benchmark each
+ * implementation. Any other value of JSONPUCK_ISA is ignored, i.e. the
+ * instruction set is auto-detected as if the variable was not set.
+ * \return instruction set
+ */
+enum js_isa
+js_isa(void);
+
+/**
+ * \brief Switch all kernels to \a isa implementation.
+ * \param isa - instruction set
+ * \retval 0 on success
+ * \retval -1 if \a isa is not supported by the CPU or by the build
+ */
+int
+js_isa_set(enum js_isa isa);
+
+/**
+ * \brief Return a name of instruction set \a isa, e.g. "avx2".
+ * \param isa - instruction set
+ * \return a zero-terminated string
+ */
+const char *
+js_isa_name(enum js_isa isa);
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ Implementation
+ */
+
+/** \cond false */
+extern const enum js_type js_type_hint[];
+extern const int8_t js_parser_hint[];
+extern const char *js_char2escape[];
+
+/**
+ * Table of hot kernels. Every kernel has scalar, SSE4.2, AVX2 and AVX-512
+ * implementations; the best one for the running CPU is picked on first use
+ * (see js_isa_set()).
+ */
+struct js_kernels {
+	/**
+	 * Find the first byte in [s, end) which must be escaped in a JSON
+	 * string (see js_char2escape). Returns \a end if there is none.
+	 */
+	const char *(*escape_scan)(const char *s, const char *end);
+	/**
+	 * Decode up to \a n positive fixints (0x00..0x7f) at \a s to
+	 * \a out. Returns the number of leading fixints decoded. At least
+	 * \a n bytes must be readable at \a s.
+	 */
+	size_t (*fixint_run_u64)(const char *s, size_t n, uint64_t *out);
+	/**
+	 * Same as fixint_run_u64 but negative fixints (0xe0..0xff) are
+	 * decoded as well.
+	 */
+	size_t (*fixint_run_i64)(const char *s, size_t n, int64_t *out);
+	/** Check that [s, end) is valid UTF-8. */
+	bool (*utf8_valid)(const char *s, const char *end);
+};
+
+extern struct js_kernels js_kernels;
+
+#if defined(JS_STATS)
+extern __thread struct js_stats js_stats_tls;
+#define JS_STAT_INC(name) (js_stats_tls.name++)
+#define JS_STAT_ADD(name, n) (js_stats_tls.name += (n))
+#else
+#define JS_STAT_INC(name) ((void) 0)
+#define JS_STAT_ADD(name, n) ((void) 0)
+#endif
+
+JS_IMPL JS_ALWAYSINLINE enum js_type
+js_typeof(const char c)
+{
+	return js_type_hint[(uint8_t) c];
 }
 
 JS_IMPL uint32_t
-js_sizeof_nil()
+js_sizeof_array(uint32_t size)
 {
-	return 1;
+	if (size <= 15) {
+		return 1;
+	} else if (size <= UINT16_MAX) {
+		return 1 + sizeof(uint16_t);
+	} else {
+		return 1 + sizeof(uint32_t);
+	}
 }
 
 JS_IMPL char *
-js_encode_nil(char *data)
+js_encode_array(char *data, uint32_t size)
 {
-	sprintf(data, "null");
+	sprintf(data, "[");
 	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	return data + 4;
+	//stack push ARRAY(size);
+	return ++data;
 }
 
 JS_IMPL ptrdiff_t
-js_check_nil(const char *cur, const char *end)
+js_check_array(const char *cur, const char *end)
 {
 	assert(cur < end);
-	assert(js_typeof(*cur) == JS_NIL);
-	return 1 - (end - cur);
+	assert(js_typeof(*cur) == JS_ARRAY);
+	uint8_t c = js_load_u8(&cur);
+	if (js_likely(!(c & 0x40)))
+		return cur - end;
+
+	assert(c >= 0xdc && c <= 0xdd); /* must be checked above by js_typeof */
+	uint32_t hsize = 2U << (c & 0x1); /* 0xdc->2, 0xdd->4 */
+	return hsize - (end - cur);
 }
 
-JS_IMPL void
-js_decode_nil(const char **data)
+JS_PROTO uint32_t
+js_decode_array_slowpath(uint8_t c, const char **data);
+
+JS_IMPL uint32_t
+js_decode_array_slowpath(uint8_t c, const char **data)
+{
+	uint32_t size;
+	switch (c & 0x1) {
+	case 0xdc & 0x1:
+		size = js_load_u16(data);
+		return size;
+	case 0xdd & 0x1:
+		size = js_load_u32(data);
+		return size;
+	default:
+		js_unreachable();
+	}
+}
+
+JS_IMPL JS_ALWAYSINLINE uint32_t
+js_decode_array(const char **data)
 {
 	uint8_t c = js_load_u8(data);
-	assert(c == 0xc0);
-	(void) c;
+
+	if (js_likely(!(c & 0x40)))
+		return (c & 0xf);
+
+	return js_decode_array_slowpath(c, data);
 }
 
 JS_IMPL uint32_t
-js_sizeof_bool(bool val)
+js_sizeof_map(uint32_t size)
 {
-	(void) val;
-	return 1;
+	if (size <= 15) {
+		return 1;
+	} else if (size <= UINT16_MAX) {
+		return 1 + sizeof(uint16_t);
+	} else {
+		return 1 + sizeof(uint32_t);
+	}
 }
 
 JS_IMPL char *
-js_encode_bool(char *data, bool val)
+js_encode_map(char *data, uint32_t size)
 {
-	sprintf(data,"%s", (val) ? "true" : "false");
+	sprintf(data, "{");
 	//TODO::STACK
-	//stack key or value or end: sprintf(...);
-	return data + ((val) ? 4 : 5);
+	//stack push ARRAY(size);
+	return ++data;
 }
 
 JS_IMPL ptrdiff_t
-js_check_bool(const char *cur, const char *end)
+js_check_map(const char *cur, const char *end)
 {
 	assert(cur < end);
-	assert(js_typeof(*cur) == JS_BOOL);
-	return 1 - (end - cur);
+	assert(js_typeof(*cur) == JS_MAP);
+	uint8_t c = js_load_u8(&cur);
+	if (js_likely((c & ~0xfU) == 0x80))
+		return cur - end;
+
+	assert(c >= 0xde && c <= 0xdf); /* must be checked above by js_typeof */
+	uint32_t hsize = 2U << (c & 0x1); /* 0xde->2, 0xdf->4 */
+	return hsize - (end - cur);
 }
 
-JS_IMPL bool
-js_decode_bool(const char **data)
+JS_IMPL uint32_t
+js_decode_map(const char **data)
 {
 	uint8_t c = js_load_u8(data);
 	switch (c) {
-	case 0xc3:
-		return true;
-	case 0xc2:
-		return false;
+	case 0xde:
+		return js_load_u16(data);
+	case 0xdf:
+		return js_load_u32(data);
 	default:
-		js_unreachable();
+		if (js_unlikely(c < 0x80 || c > 0x8f))
+			js_unreachable();
+		return c & 0xf;
 	}
 }
 
-/** See js_parser_hint */
-enum {
-	JS_HINT = -32,
-	JS_HINT_STR_8 = JS_HINT,
-	JS_HINT_STR_16 = JS_HINT - 1,
-	JS_HINT_STR_32 = JS_HINT - 2,
-	JS_HINT_ARRAY_16 = JS_HINT - 3,
-	JS_HINT_ARRAY_32 = JS_HINT - 4,
-	JS_HINT_MAP_16 = JS_HINT - 5,
-	JS_HINT_MAP_32 = JS_HINT - 6,
-	JS_HINT_EXT_8 = JS_HINT - 7,
-	JS_HINT_EXT_16 = JS_HINT - 8,
-	JS_HINT_EXT_32 = JS_HINT - 9
-};
-
-JS_PROTO void
-js_next_slowpath(const char **data, int k);
-
-JS_IMPL void
-js_next_slowpath(const char **data, int k)
+JS_IMPL uint32_t
+js_sizeof_uint(uint64_t num)
 {
-	for (; k > 0; k--) {
-		uint8_t c = js_load_u8(data);
-		int l = js_parser_hint[c];
-		if (js_likely(l >= 0)) {
-			*data += l;
-			continue;
-		} else if (js_likely(l > JS_HINT)) {
-			k -= l;
-			continue;
-		}
-
-		uint32_t len;
-		switch (l) {
-		case JS_HINT_STR_8:
-			/* JS_STR (8) */
-			len = js_load_u8(data);
-			*data += len;
-			break;
-		case JS_HINT_STR_16:
-			/* JS_STR (16) */
-			len = js_load_u16(data);
-			*data += len;
-			break;
-		case JS_HINT_STR_32:
-			/* JS_STR (32) */
-			len = js_load_u32(data);
-			*data += len;
-			break;
-		case JS_HINT_ARRAY_16:
-			/* JS_ARRAY (16) */
-			k += js_load_u16(data);
-			break;
-		case JS_HINT_ARRAY_32:
-			/* JS_ARRAY (32) */
-			k += js_load_u32(data);
-			break;
-		case JS_HINT_MAP_16:
-			/* JS_MAP (16) */
-			k += 2 * js_load_u16(data);
-			break;
-		case JS_HINT_MAP_32:
-			/* JS_MAP (32) */
-			k += 2 * js_load_u32(data);
-			break;
-		case JS_HINT_EXT_8:
-			/* JS_EXT (8) */
-			len = js_load_u8(data);
-			js_load_u8(data);
-			*data += len;
-			break;
-		case JS_HINT_EXT_16:
-			/* JS_EXT (16) */
-			len = js_load_u16(data);
-			js_load_u8(data);
-			*data += len;
-			break;
-		case JS_HINT_EXT_32:
-			/* JS_EXT (32) */
-			len = js_load_u32(data);
-			js_load_u8(data);
-			*data += len;
-			break;
-		default:
-			js_unreachable();
-		}
+	if (num <= 0x7f) {
+		return 1;
+	} else if (num <= UINT8_MAX) {
+		return 1 + sizeof(uint8_t);
+	} else if (num <= UINT16_MAX) {
+		return 1 + sizeof(uint16_t);
+	} else if (num <= UINT32_MAX) {
+		return 1 + sizeof(uint32_t);
+	} else {
+		return 1 + sizeof(uint64_t);
 	}
 }
 
-JS_IMPL void
-js_next(const char **data)
+JS_IMPL uint32_t
+js_sizeof_int(int64_t num)
 {
-	int k = 1;
-	for (; k > 0; k--) {
-		uint8_t c = js_load_u8(data);
-		int l = js_parser_hint[c];
-		if (js_likely(l >= 0)) {
-			*data += l;
-			continue;
-		} else if (js_likely(c == 0xd9)){
-			/* JS_STR (8) */
-			uint8_t len = js_load_u8(data);
-			*data += len;
-			continue;
-		} else if (l > JS_HINT) {
-			k -= l;
-			continue;
-		} else {
-			*data -= sizeof(uint8_t);
-			return js_next_slowpath(data, k);
-		}
+	assert(num < 0);
+	if (num >= -0x20) {
+		return 1;
+	} else if (num >= INT8_MIN && num <= INT8_MAX) {
+		return 1 + sizeof(int8_t);
+	} else if (num >= INT16_MIN && num <= UINT16_MAX) {
+		return 1 + sizeof(int16_t);
+	} else if (num >= INT32_MIN && num <= UINT32_MAX) {
+		return 1 + sizeof(int32_t);
+	} else {
+		return 1 + sizeof(int64_t);
 	}
 }
 
-JS_IMPL int
-js_check(const char **data, const char *end)
+JS_IMPL ptrdiff_t
+js_check_uint(const char *cur, const char *end)
 {
-	int k;
-	for (k = 1; k > 0; k--) {
-		if (js_unlikely(*data >= end))
-			return 1;
-
-		uint8_t c = js_load_u8(data);
-		int l = js_parser_hint[c];
-		if (js_likely(l >= 0)) {
-			*data += l;
-			continue;
-		} else if (js_likely(l > JS_HINT)) {
-			k -= l;
-			continue;
-		}
-
-		uint32_t len;
-		switch (l) {
-		case JS_HINT_STR_8:
-			/* JS_STR (8) */
-			if (js_unlikely(*data + sizeof(uint8_t) > end))
-				return 1;
-			len = js_load_u8(data);
-			*data += len;
-			break;
-		case JS_HINT_STR_16:
-			/* JS_STR (16) */
-			if (js_unlikely(*data + sizeof(uint16_t) > end))
-				return 1;
-			len = js_load_u16(data);
-			*data += len;
-			break;
-		case JS_HINT_STR_32:
-			/* JS_STR (32) */
-			if (js_unlikely(*data + sizeof(uint32_t) > end))
-				return 1;
-			len = js_load_u32(data);
-			*data += len;
-			break;
-		case JS_HINT_ARRAY_16:
-			/* JS_ARRAY (16) */
-			if (js_unlikely(*data + sizeof(uint16_t) > end))
-				return 1;
-			k += js_load_u16(data);
-			break;
-		case JS_HINT_ARRAY_32:
-			/* JS_ARRAY (32) */
-			if (js_unlikely(*data + sizeof(uint32_t) > end))
-				return 1;
-			k += js_load_u32(data);
-			break;
-		case JS_HINT_MAP_16:
-			/* JS_MAP (16) */
-			if (js_unlikely(*data + sizeof(uint16_t) > end))
-				return false;
-			k += 2 * js_load_u16(data);
-			break;
-		case JS_HINT_MAP_32:
-			/* JS_MAP (32) */
-			if (js_unlikely(*data + sizeof(uint32_t) > end))
-				return 1;
-			k += 2 * js_load_u32(data);
-			break;
-		case JS_HINT_EXT_8:
-			/* JS_EXT (8) */
-			if (js_unlikely(*data + sizeof(uint8_t) + 1 > end))
-				return 1;
-			len = js_load_u8(data);
-			js_load_u8(data);
-			*data += len;
-			break;
-		case JS_HINT_EXT_16:
-			/* JS_EXT (16) */
-			if (js_unlikely(*data + sizeof(uint16_t) + 1 > end))
-				return 1;
-			len = js_load_u16(data);
-			js_load_u8(data);
-			*data += len;
-			break;
-		case JS_HINT_EXT_32:
-			/* JS_EXT (32) */
-			if (js_unlikely(*data + sizeof(uint32_t) + 1 > end))
-				return 1;
-		        len = js_load_u32(data);
-			js_load_u8(data);
-			*data += len;
-			break;
-		default:
-			js_unreachable();
-		}
-	}
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_UINT);
+	uint8_t c = js_load_u8(&cur);
+	return js_parser_hint[c] - (end - cur);
+}
 
-	if (js_unlikely(*data > end))
-		return 1;
+JS_IMPL ptrdiff_t
+js_check_int(const char *cur, const char *end)
+{
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_INT);
+	uint8_t c = js_load_u8(&cur);
+	return js_parser_hint[c] - (end - cur);
+}
 
-	return 0;
+JS_IMPL char *
+js_encode_uint(char *data, uint64_t num)
+{
+	sprintf(data,"%llu", num);
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data + strlen(data);;
 }
 
-JS_IMPL size_t
-js_vformat(char *data, size_t data_size, const char *format, va_list vl)
+JS_IMPL char *
+js_encode_int(char *data, int64_t num)
 {
-	size_t result = 0;
-	const char *f = NULL;
+	sprintf(data,"%lli", num);
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data + strlen(data);;
+}
 
-	for (f = format; *f; f++) {
-		if (f[0] == '[') {
-			uint32_t size = 0;
-			int level = 1;
+JS_IMPL uint64_t
+js_decode_uint(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	switch (c) {
+	case 0xcc:
+		return js_load_u8(data);
+	case 0xcd:
+		return js_load_u16(data);
+	case 0xce:
+		return js_load_u32(data);
+	case 0xcf:
+		return js_load_u64(data);
+	default:
+		if (js_unlikely(c > 0x7f))
+			js_unreachable();
+		return c;
+	}
+}
+
+JS_IMPL int
+js_compare_uint(const char *data_a, const char *data_b)
+{
+	uint8_t ca = js_load_u8(&data_a);
+	uint8_t cb = js_load_u8(&data_b);
+
+	int r = ca - cb;
+	if (r != 0)
+		return r;
+
+	if (ca <= 0x7f)
+		return 0;
+
+	uint64_t a, b;
+	switch (ca & 0x3) {
+	case 0xcc & 0x3:
+		a = js_load_u8(&data_a);
+		b = js_load_u8(&data_b);
+		break;
+	case 0xcd & 0x3:
+		a = js_load_u16(&data_a);
+		b = js_load_u16(&data_b);
+		break;
+	case 0xce & 0x3:
+		a = js_load_u32(&data_a);
+		b = js_load_u32(&data_b);
+		break;
+	case 0xcf & 0x3:
+		a = js_load_u64(&data_a);
+		b = js_load_u64(&data_b);
+		return a < b ? -1 : a > b;
+		break;
+	default:
+		js_unreachable();
+	}
+
+	int64_t v = (a - b);
+	return (v > 0) - (v < 0);
+}
+
+JS_IMPL int64_t
+js_decode_int(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	switch (c) {
+	case 0xd0:
+		return (int8_t) js_load_u8(data);
+	case 0xd1:
+		return (int16_t) js_load_u16(data);
+	case 0xd2:
+		return (int32_t) js_load_u32(data);
+	case 0xd3:
+		return (int64_t) js_load_u64(data);
+	default:
+		if (js_unlikely(c < 0xe0))
+			js_unreachable();
+		return (int8_t) (c);
+	}
+}
+
+JS_IMPL uint32_t
+js_sizeof_float(float num)
+{
+	(void) num;
+	return 1 + sizeof(float);
+}
+
+JS_IMPL uint32_t
+js_sizeof_double(double num)
+{
+	(void) num;
+	return 1 + sizeof(double);
+}
+
+JS_IMPL ptrdiff_t
+js_check_float(const char *cur, const char *end)
+{
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_FLOAT);
+	return 1 + sizeof(float) - (end - cur);
+}
+
+JS_IMPL ptrdiff_t
+js_check_double(const char *cur, const char *end)
+{
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_DOUBLE);
+	return 1 + sizeof(double) - (end - cur);
+}
+
+JS_IMPL char *
+js_encode_float(char *data, float num)
+{
+	sprintf(data,"%f", num);//TODO:CHECK_IT
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data + strlen(data);
+}
+
+JS_IMPL char *
+js_encode_double(char *data, double num)
+{
+	sprintf(data,"%f", num); //TODO:CHECK_IT
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data + strlen(data);
+}
+
+JS_IMPL float
+js_decode_float(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	assert(c == 0xca);
+	(void) c;
+	return js_load_float(data);
+}
+
+JS_IMPL double
+js_decode_double(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	assert(c == 0xcb);
+	(void) c;
+	return js_load_double(data);
+}
+
+JS_IMPL uint32_t
+js_sizeof_strl(uint32_t len)
+{
+	if (len <= 31) {
+		return 1;
+	} else if (len <= UINT8_MAX) {
+		return 1 + sizeof(uint8_t);
+	} else if (len <= UINT16_MAX) {
+		return 1 + sizeof(uint16_t);
+	} else {
+		return 1 + sizeof(uint32_t);
+	}
+}
+
+JS_IMPL uint32_t
+js_sizeof_str(uint32_t len)
+{
+	return js_sizeof_strl(len) + len;
+}
+
+JS_IMPL uint32_t
+js_sizeof_binl(uint32_t len)
+{
+	if (len <= UINT8_MAX) {
+		return 1 + sizeof(uint8_t);
+	} else if (len <= UINT16_MAX) {
+		return 1 + sizeof(uint16_t);
+	} else {
+		return 1 + sizeof(uint32_t);
+	}
+}
+
+JS_IMPL uint32_t
+js_sizeof_bin(uint32_t len)
+{
+	return js_sizeof_binl(len) + len;
+}
+
+JS_IMPL char *
+js_encode_strl(char *data, uint32_t len)
+{
+	if (len <= 31) {
+		return js_store_u8(data, 0xa0 | (uint8_t) len);
+	} else if (len <= UINT8_MAX) {
+		data = js_store_u8(data, 0xd9);
+		return js_store_u8(data, len);
+	} else if (len <= UINT16_MAX) {
+		data = js_store_u8(data, 0xda);
+		return js_store_u16(data, len);
+	} else {
+		data = js_store_u8(data, 0xdb);
+		return js_store_u32(data, len);
+	}
+}
+
+JS_IMPL char *
+js_encode_str(char *data, const char *str, uint32_t len)
+{
+	const char *end = str + len;
+	*data++ = '"';
+	while (str < end) {
+		const char *p = js_kernels.escape_scan(str, end);
+		memcpy(data, str, p - str);
+		data += p - str;
+		if (p == end)
+			break;
+		const char *esc = js_char2escape[(uint8_t) *p];
+		size_t esc_len = esc[1] == 'u' ? 6 : 2; /* \uXXXX or \X */
+		memcpy(data, esc, esc_len);
+		data += esc_len;
+		str = p + 1;
+	}
+	*data++ = '"';
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data;
+}
+
+JS_IMPL bool
+js_utf8_valid(const char *str, uint32_t len)
+{
+	/* Short ASCII strings, e.g. keys, are not worth a kernel call */
+	if (len < 16) {
+		uint32_t i;
+		for (i = 0; i < len; i++) {
+			if ((uint8_t) str[i] >= 0x80)
+				return js_kernels.utf8_valid(str, str + len);
+		}
+		return true;
+	}
+	return js_kernels.utf8_valid(str, str + len);
+}
+
+JS_IMPL char *
+js_encode_str_utf8(char *data, const char *str, uint32_t len)
+{
+	const char *end = str + len;
+	*data++ = '"';
+	while (str < end) {
+		const char *p = js_kernels.escape_scan(str, end);
+		if (js_unlikely(!js_utf8_valid(str, p - str)))
+			return NULL;
+		memcpy(data, str, p - str);
+		data += p - str;
+		if (p == end)
+			break;
+		const char *esc = js_char2escape[(uint8_t) *p];
+		size_t esc_len = esc[1] == 'u' ? 6 : 2; /* \uXXXX or \X */
+		memcpy(data, esc, esc_len);
+		data += esc_len;
+		str = p + 1;
+	}
+	*data++ = '"';
+	return data;
+}
+
+JS_IMPL char *
+js_encode_binl(char *data, uint32_t len)
+{
+	if (len <= UINT8_MAX) {
+		data = js_store_u8(data, 0xc4);
+		return js_store_u8(data, len);
+	} else if (len <= UINT16_MAX) {
+		data = js_store_u8(data, 0xc5);
+		return js_store_u16(data, len);
+	} else {
+		data = js_store_u8(data, 0xc6);
+		return js_store_u32(data, len);
+	}
+}
+
+JS_IMPL char *
+js_encode_bin(char *data, const char *str, uint32_t len)
+{
+	data = js_encode_binl(data, len);
+	memcpy(data, str, len);
+	return data + len;
+}
+
+JS_IMPL ptrdiff_t
+js_check_strl(const char *cur, const char *end)
+{
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_STR);
+
+	uint8_t c = js_load_u8(&cur);
+	if (js_likely(c & ~0x1f) == 0xa0)
+		return cur - end;
+
+	assert(c >= 0xd9 && c <= 0xdb); /* must be checked above by js_typeof */
+	uint32_t hsize = 1U << (c & 0x3) >> 1; /* 0xd9->1, 0xda->2, 0xdb->4 */
+	return hsize - (end - cur);
+}
+
+JS_IMPL ptrdiff_t
+js_check_binl(const char *cur, const char *end)
+{
+	uint8_t c = js_load_u8(&cur);
+	assert(cur < end);
+	assert(js_typeof(c) == JS_BIN);
+
+	assert(c >= 0xc4 && c <= 0xc6); /* must be checked above by js_typeof */
+	uint32_t hsize = 1U << (c & 0x3); /* 0xc4->1, 0xc5->2, 0xc6->4 */
+	return hsize - (end - cur);
+}
+
+JS_IMPL uint32_t
+js_decode_strl(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	switch (c) {
+	case 0xd9:
+		return js_load_u8(data);
+	case 0xda:
+		return js_load_u16(data);
+	case 0xdb:
+		return js_load_u32(data);
+	default:
+		if (js_unlikely(c < 0xa0 || c > 0xbf))
+			js_unreachable();
+		return c & 0x1f;
+	}
+}
+
+JS_IMPL const char *
+js_decode_str(const char **data, uint32_t *len)
+{
+	assert(len != NULL);
+
+	*len = js_decode_strl(data);
+	const char *str = *data;
+	*data += *len;
+	return str;
+}
+
+JS_IMPL uint32_t
+js_decode_binl(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+
+	switch (c) {
+	case 0xc4:
+		return js_load_u8(data);
+	case 0xc5:
+		return js_load_u16(data);
+	case 0xc6:
+		return js_load_u32(data);
+	default:
+		js_unreachable();
+	}
+}
+
+JS_IMPL const char *
+js_decode_bin(const char **data, uint32_t *len)
+{
+	assert(len != NULL);
+
+	*len = js_decode_binl(data);
+	const char *str = *data;
+	*data += *len;
+	return str;
+}
+
+JS_IMPL uint32_t
+js_decode_strbinl(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+
+	switch (c) {
+	case 0xd9:
+		return js_load_u8(data);
+	case 0xda:
+		return js_load_u16(data);
+	case 0xdb:
+		return js_load_u32(data);
+	case 0xc4:
+		return js_load_u8(data);
+	case 0xc5:
+		return js_load_u16(data);
+	case 0xc6:
+		return js_load_u32(data);
+	default:
+		if (js_unlikely(c < 0xa0 || c > 0xbf))
+			js_unreachable();
+		return c & 0x1f;
+	}
+}
+
+JS_IMPL const char *
+js_decode_strbin(const char **data, uint32_t *len)
+{
+	assert(len != NULL);
+
+	*len = js_decode_strbinl(data);
+	const char *str = *data;
+	*data += *len;
+	return str;
+}
+
+JS_IMPL uint32_t
+js_sizeof_nil()
+{
+	return 1;
+}
+
+JS_IMPL char *
+js_encode_nil(char *data)
+{
+	sprintf(data, "null");
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data + 4;
+}
+
+JS_IMPL ptrdiff_t
+js_check_nil(const char *cur, const char *end)
+{
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_NIL);
+	return 1 - (end - cur);
+}
+
+JS_IMPL void
+js_decode_nil(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	assert(c == 0xc0);
+	(void) c;
+}
+
+JS_IMPL uint32_t
+js_sizeof_bool(bool val)
+{
+	(void) val;
+	return 1;
+}
+
+JS_IMPL char *
+js_encode_bool(char *data, bool val)
+{
+	sprintf(data,"%s", (val) ? "true" : "false");
+	//TODO::STACK
+	//stack key or value or end: sprintf(...);
+	return data + ((val) ? 4 : 5);
+}
+
+JS_IMPL ptrdiff_t
+js_check_bool(const char *cur, const char *end)
+{
+	assert(cur < end);
+	assert(js_typeof(*cur) == JS_BOOL);
+	return 1 - (end - cur);
+}
+
+JS_IMPL bool
+js_decode_bool(const char **data)
+{
+	uint8_t c = js_load_u8(data);
+	switch (c) {
+	case 0xc3:
+		return true;
+	case 0xc2:
+		return false;
+	default:
+		js_unreachable();
+	}
+}
+
+JS_IMPL char *
+js_pack_array(char *data, uint32_t size)
+{
+	if (size <= 15) {
+		return js_store_u8(data, 0x90 | size);
+	} else if (size <= UINT16_MAX) {
+		data = js_store_u8(data, 0xdc);
+		return js_store_u16(data, size);
+	} else {
+		data = js_store_u8(data, 0xdd);
+		return js_store_u32(data, size);
+	}
+}
+
+JS_IMPL char *
+js_pack_map(char *data, uint32_t size)
+{
+	if (size <= 15) {
+		return js_store_u8(data, 0x80 | size);
+	} else if (size <= UINT16_MAX) {
+		data = js_store_u8(data, 0xde);
+		return js_store_u16(data, size);
+	} else {
+		data = js_store_u8(data, 0xdf);
+		return js_store_u32(data, size);
+	}
+}
+
+JS_IMPL char *
+js_pack_uint(char *data, uint64_t num)
+{
+	if (num <= 0x7f) {
+		return js_store_u8(data, num);
+	} else if (num <= UINT8_MAX) {
+		data = js_store_u8(data, 0xcc);
+		return js_store_u8(data, num);
+	} else if (num <= UINT16_MAX) {
+		data = js_store_u8(data, 0xcd);
+		return js_store_u16(data, num);
+	} else if (num <= UINT32_MAX) {
+		data = js_store_u8(data, 0xce);
+		return js_store_u32(data, num);
+	} else {
+		data = js_store_u8(data, 0xcf);
+		return js_store_u64(data, num);
+	}
+}
+
+JS_IMPL char *
+js_pack_int(char *data, int64_t num)
+{
+	assert(num < 0);
+	if (num >= -0x20) {
+		return js_store_u8(data, 0xe0 | (uint8_t) num);
+	} else if (num >= INT8_MIN) {
+		data = js_store_u8(data, 0xd0);
+		return js_store_u8(data, (uint8_t) num);
+	} else if (num >= INT16_MIN) {
+		data = js_store_u8(data, 0xd1);
+		return js_store_u16(data, (uint16_t) num);
+	} else if (num >= INT32_MIN) {
+		data = js_store_u8(data, 0xd2);
+		return js_store_u32(data, (uint32_t) num);
+	} else {
+		data = js_store_u8(data, 0xd3);
+		return js_store_u64(data, (uint64_t) num);
+	}
+}
+
+JS_IMPL char *
+js_pack_str(char *data, const char *str, uint32_t len)
+{
+	data = js_encode_strl(data, len);
+	memcpy(data, str, len);
+	return data + len;
+}
+
+JS_IMPL char *
+js_pack_nil(char *data)
+{
+	return js_store_u8(data, 0xc0);
+}
+
+JS_IMPL char *
+js_pack_bool(char *data, bool val)
+{
+	return js_store_u8(data, val ? 0xc3 : 0xc2);
+}
+
+JS_IMPL char *
+js_pack_double(char *data, double num)
+{
+	data = js_store_u8(data, 0xcb);
+	return js_store_double(data, num);
+}
+
+/** See js_parser_hint */
+enum {
+	JS_HINT = -32,
+	JS_HINT_STR_8 = JS_HINT,
+	JS_HINT_STR_16 = JS_HINT - 1,
+	JS_HINT_STR_32 = JS_HINT - 2,
+	JS_HINT_ARRAY_16 = JS_HINT - 3,
+	JS_HINT_ARRAY_32 = JS_HINT - 4,
+	JS_HINT_MAP_16 = JS_HINT - 5,
+	JS_HINT_MAP_32 = JS_HINT - 6,
+	JS_HINT_EXT_8 = JS_HINT - 7,
+	JS_HINT_EXT_16 = JS_HINT - 8,
+	JS_HINT_EXT_32 = JS_HINT - 9
+};
+
+JS_PROTO void
+js_next_slowpath(const char **data, int k);
+
+JS_IMPL void
+js_next_slowpath(const char **data, int k)
+{
+	JS_STAT_INC(next_slowpath);
+	for (; k > 0; k--) {
+		JS_STAT_INC(next_values);
+		uint8_t c = js_load_u8(data);
+		int l = js_parser_hint[c];
+		if (js_likely(l >= 0)) {
+			*data += l;
+			continue;
+		} else if (js_likely(l > JS_HINT)) {
+			k -= l;
+			continue;
+		}
+
+		uint32_t len;
+		JS_STAT_INC(next_hint[JS_HINT - l]);
+		switch (l) {
+		case JS_HINT_STR_8:
+			/* JS_STR (8) */
+			len = js_load_u8(data);
+			*data += len;
+			break;
+		case JS_HINT_STR_16:
+			/* JS_STR (16) */
+			len = js_load_u16(data);
+			*data += len;
+			break;
+		case JS_HINT_STR_32:
+			/* JS_STR (32) */
+			len = js_load_u32(data);
+			*data += len;
+			break;
+		case JS_HINT_ARRAY_16:
+			/* JS_ARRAY (16) */
+			k += js_load_u16(data);
+			break;
+		case JS_HINT_ARRAY_32:
+			/* JS_ARRAY (32) */
+			k += js_load_u32(data);
+			break;
+		case JS_HINT_MAP_16:
+			/* JS_MAP (16) */
+			k += 2 * js_load_u16(data);
+			break;
+		case JS_HINT_MAP_32:
+			/* JS_MAP (32) */
+			k += 2 * js_load_u32(data);
+			break;
+		case JS_HINT_EXT_8:
+			/* JS_EXT (8) */
+			len = js_load_u8(data);
+			js_load_u8(data);
+			*data += len;
+			break;
+		case JS_HINT_EXT_16:
+			/* JS_EXT (16) */
+			len = js_load_u16(data);
+			js_load_u8(data);
+			*data += len;
+			break;
+		case JS_HINT_EXT_32:
+			/* JS_EXT (32) */
+			len = js_load_u32(data);
+			js_load_u8(data);
+			*data += len;
+			break;
+		default:
+			js_unreachable();
+		}
+	}
+}
+
+JS_IMPL void
+js_next(const char **data)
+{
+	int k = 1;
+	JS_STAT_INC(next);
+	for (; k > 0; k--) {
+		JS_STAT_INC(next_values);
+		uint8_t c = js_load_u8(data);
+		int l = js_parser_hint[c];
+		if (js_likely(l >= 0)) {
+			*data += l;
+			continue;
+		} else if (js_likely(c == 0xd9)){
+			/* JS_STR (8) */
+			JS_STAT_INC(next_hint[JS_HINT - JS_HINT_STR_8]);
+			uint8_t len = js_load_u8(data);
+			*data += len;
+			continue;
+		} else if (l > JS_HINT) {
+			k -= l;
+			continue;
+		} else {
+			*data -= sizeof(uint8_t);
+			/* the value is counted again by js_next_slowpath() */
+			JS_STAT_ADD(next_values, -1);
+			return js_next_slowpath(data, k);
+		}
+	}
+}
+
+JS_IMPL int
+js_check(const char **data, const char *end)
+{
+	/* wide enough for 2 * UINT32_MAX pending map values */
+	int64_t k;
+	JS_STAT_INC(check);
+#if defined(JS_STATS)
+	const char *start = *data;
+#endif
+	for (k = 1; k > 0; k--) {
+		if (js_unlikely(*data >= end))
+			return 1;
+
+		JS_STAT_INC(check_values);
+		uint8_t c = js_load_u8(data);
+		int l = js_parser_hint[c];
+		if (js_likely(l >= 0)) {
+			*data += l;
+			continue;
+		} else if (js_likely(l > JS_HINT)) {
+			k -= l;
+			continue;
+		}
+
+		uint32_t len;
+		JS_STAT_INC(check_hint[JS_HINT - l]);
+		switch (l) {
+		case JS_HINT_STR_8:
+			/* JS_STR (8) */
+			if (js_unlikely(*data + sizeof(uint8_t) > end))
+				return 1;
+			len = js_load_u8(data);
+			JS_STAT_ADD(check_str_bytes, len);
+			*data += len;
+			break;
+		case JS_HINT_STR_16:
+			/* JS_STR (16) */
+			if (js_unlikely(*data + sizeof(uint16_t) > end))
+				return 1;
+			len = js_load_u16(data);
+			JS_STAT_ADD(check_str_bytes, len);
+			*data += len;
+			break;
+		case JS_HINT_STR_32:
+			/* JS_STR (32) */
+			if (js_unlikely(*data + sizeof(uint32_t) > end))
+				return 1;
+			len = js_load_u32(data);
+			JS_STAT_ADD(check_str_bytes, len);
+			*data += len;
+			break;
+		case JS_HINT_ARRAY_16:
+			/* JS_ARRAY (16) */
+			if (js_unlikely(*data + sizeof(uint16_t) > end))
+				return 1;
+			k += js_load_u16(data);
+			break;
+		case JS_HINT_ARRAY_32:
+			/* JS_ARRAY (32) */
+			if (js_unlikely(*data + sizeof(uint32_t) > end))
+				return 1;
+			k += js_load_u32(data);
+			break;
+		case JS_HINT_MAP_16:
+			/* JS_MAP (16) */
+			if (js_unlikely(*data + sizeof(uint16_t) > end))
+				return 1;
+			k += 2 * js_load_u16(data);
+			break;
+		case JS_HINT_MAP_32:
+			/* JS_MAP (32) */
+			if (js_unlikely(*data + sizeof(uint32_t) > end))
+				return 1;
+			k += 2 * (int64_t) js_load_u32(data);
+			break;
+		case JS_HINT_EXT_8:
+			/* JS_EXT (8) */
+			if (js_unlikely(*data + sizeof(uint8_t) + 1 > end))
+				return 1;
+			len = js_load_u8(data);
+			js_load_u8(data);
+			*data += len;
+			break;
+		case JS_HINT_EXT_16:
+			/* JS_EXT (16) */
+			if (js_unlikely(*data + sizeof(uint16_t) + 1 > end))
+				return 1;
+			len = js_load_u16(data);
+			js_load_u8(data);
+			*data += len;
+			break;
+		case JS_HINT_EXT_32:
+			/* JS_EXT (32) */
+			if (js_unlikely(*data + sizeof(uint32_t) + 1 > end))
+				return 1;
+		        len = js_load_u32(data);
+			js_load_u8(data);
+			*data += len;
+			break;
+		default:
+			js_unreachable();
+		}
+	}
+
+	if (js_unlikely(*data > end))
+		return 1;
+
+	JS_STAT_ADD(check_bytes, *data - start);
+	return 0;
+}
+
+/**
+ * js_check_opts() of a value nested in \a base containers. \a elements
+ * is the number of values counted so far against opts->max_elements,
+ * it is updated on success.
+ */
+JS_PROTO int
+js_check_opts_internal(const char **data, const char *end,
+		       const struct js_check_opts *opts, uint32_t base,
+		       uint64_t *elements);
+
+JS_IMPL int
+js_check_opts(const char **data, const char *end,
+	      const struct js_check_opts *opts)
+{
+	uint64_t elements = 0;
+	return js_check_opts_internal(data, end, opts, 0, &elements);
+}
+
+JS_IMPL int
+js_check_opts_internal(const char **data, const char *end,
+		       const struct js_check_opts *opts, uint32_t base,
+		       uint64_t *elements)
+{
+	uint32_t max_depth = JS_CHECK_MAX_DEPTH;
+	uint64_t max_elements = UINT64_MAX;
+	uint32_t max_str_len = UINT32_MAX;
+	if (opts != NULL) {
+		if (opts->max_depth != 0 && opts->max_depth < max_depth)
+			max_depth = opts->max_depth;
+		if (opts->max_elements != 0)
+			max_elements = opts->max_elements;
+		if (opts->max_str_len != 0)
+			max_str_len = opts->max_str_len;
+	}
+	max_depth = max_depth > base ? max_depth - base : 0;
+
+	/* values left on every level, level 0 holds the root value */
+	uint64_t left[JS_CHECK_MAX_DEPTH + 1];
+	uint32_t depth = 0;
+	/* values left on all levels */
+	uint64_t pending = 1;
+	uint64_t count = *elements;
+	left[0] = 1;
+	while (pending > 0) {
+		while (left[depth] == 0)
+			depth--;
+		left[depth]--;
+		pending--;
+		if (js_unlikely(*data >= end || ++count > max_elements))
+			return 1;
+
+		uint8_t c = js_load_u8(data);
+		int l = js_parser_hint[c];
+		uint64_t len = 0;
+		uint64_t n;
+		bool is_str = false;
+		if (js_likely(l >= 0)) {
+			/* fixstr */
+			is_str = (c & 0xe0) == 0xa0;
+			if (js_unlikely(is_str && (uint32_t) l > max_str_len))
+				return 1;
+			/* empty fixarray and fixmap still count for depth */
+			if (js_unlikely((c & 0xe0) == 0x80 && l == 0)) {
+				n = 0;
+				goto container;
+			}
+			len = l;
+			goto payload;
+		} else if (js_likely(l > JS_HINT)) {
+			n = -l;
+			goto container;
+		}
+
+		switch (l) {
+		case JS_HINT_STR_8:
+			/* JS_STR (8), JS_BIN (8) */
+			is_str = c >= 0xd9;
+			if (js_unlikely(*data + sizeof(uint8_t) > end))
+				return 1;
+			len = js_load_u8(data);
+			break;
+		case JS_HINT_STR_16:
+			/* JS_STR (16), JS_BIN (16) */
+			is_str = c >= 0xd9;
+			if (js_unlikely(*data + sizeof(uint16_t) > end))
+				return 1;
+			len = js_load_u16(data);
+			break;
+		case JS_HINT_STR_32:
+			/* JS_STR (32), JS_BIN (32) */
+			is_str = c >= 0xd9;
+			if (js_unlikely(*data + sizeof(uint32_t) > end))
+				return 1;
+			len = js_load_u32(data);
+			break;
+		case JS_HINT_ARRAY_16:
+			if (js_unlikely(*data + sizeof(uint16_t) > end))
+				return 1;
+			n = js_load_u16(data);
+			goto container;
+		case JS_HINT_ARRAY_32:
+			if (js_unlikely(*data + sizeof(uint32_t) > end))
+				return 1;
+			n = js_load_u32(data);
+			goto container;
+		case JS_HINT_MAP_16:
+			if (js_unlikely(*data + sizeof(uint16_t) > end))
+				return 1;
+			n = 2 * (uint64_t) js_load_u16(data);
+			goto container;
+		case JS_HINT_MAP_32:
+			if (js_unlikely(*data + sizeof(uint32_t) > end))
+				return 1;
+			n = 2 * (uint64_t) js_load_u32(data);
+			goto container;
+		case JS_HINT_EXT_8:
+			if (js_unlikely(*data + sizeof(uint8_t) + 1 > end))
+				return 1;
+			len = js_load_u8(data) + 1;
+			goto payload;
+		case JS_HINT_EXT_16:
+			if (js_unlikely(*data + sizeof(uint16_t) + 1 > end))
+				return 1;
+			len = js_load_u16(data) + 1;
+			goto payload;
+		case JS_HINT_EXT_32:
+			if (js_unlikely(*data + sizeof(uint32_t) + 1 > end))
+				return 1;
+			len = js_load_u32(data) + (uint64_t) 1;
+			goto payload;
+		default:
+			js_unreachable();
+		}
+		/* JS_STR and JS_BIN */
+		if (js_unlikely(len > max_str_len))
+			return 1;
+payload:
+		if (js_unlikely(len > (uint64_t) (end - *data)))
+			return 1;
+		if (is_str && opts != NULL && opts->check_utf8 &&
+		    !js_utf8_valid(*data, len))
+			return 1;
+		*data += len;
+		continue;
+container:
+		if (js_unlikely(depth == max_depth))
+			return 1;
+		if (n == 0)
+			continue;
+		pending += n;
+		if (js_unlikely(pending > (uint64_t) (end - *data)))
+			return 1;
+		left[++depth] = n;
+	}
+	*elements = count;
+	return 0;
+}
+
+/**
+ * Decode an ext header at \a data, return the payload and store its
+ * \a type and \a len.
+ */
+JS_PROTO const char *
+js_decode_ext_internal(const char **data, int8_t *type, uint32_t *len);
+
+JS_IMPL const char *
+js_decode_ext_internal(const char **data, int8_t *type, uint32_t *len)
+{
+	uint8_t c = js_load_u8(data);
+	switch (c) {
+	case 0xd4:
+	case 0xd5:
+	case 0xd6:
+	case 0xd7:
+	case 0xd8:
+		/* fixext 1, 2, 4, 8, 16 */
+		*len = 1u << (c - 0xd4);
+		break;
+	case 0xc7:
+		*len = js_load_u8(data);
+		break;
+	case 0xc8:
+		*len = js_load_u16(data);
+		break;
+	case 0xc9:
+		*len = js_load_u32(data);
+		break;
+	default:
+		js_unreachable();
+	}
+	*type = (int8_t) js_load_u8(data);
+	const char *payload = *data;
+	*data += *len;
+	return payload;
+}
+
+/** Ranks of types in the order of js_compare() */
+enum js_rank {
+	JS_RANK_NIL = 0,
+	JS_RANK_BOOL,
+	JS_RANK_NUMBER,
+	JS_RANK_STR,
+	JS_RANK_BIN,
+	JS_RANK_ARRAY,
+	JS_RANK_MAP,
+	JS_RANK_EXT
+};
+
+JS_PROTO __attribute__((const)) enum js_rank
+js_rank(enum js_type type);
+
+JS_IMPL enum js_rank
+js_rank(enum js_type type)
+{
+	switch (type) {
+	case JS_NIL:
+		return JS_RANK_NIL;
+	case JS_BOOL:
+		return JS_RANK_BOOL;
+	case JS_UINT:
+	case JS_INT:
+	case JS_FLOAT:
+	case JS_DOUBLE:
+		return JS_RANK_NUMBER;
+	case JS_STR:
+		return JS_RANK_STR;
+	case JS_BIN:
+		return JS_RANK_BIN;
+	case JS_ARRAY:
+		return JS_RANK_ARRAY;
+	case JS_MAP:
+		return JS_RANK_MAP;
+	case JS_EXT:
+		return JS_RANK_EXT;
+	default:
+		js_unreachable();
+	}
+}
+
+/** A decoded number of any JSONPack numeric type */
+struct js_number {
+	enum js_type type;
+	/** JS_UINT */
+	uint64_t u;
+	/** JS_INT */
+	int64_t i;
+	/** JS_DOUBLE */
+	double d;
+};
+
+/**
+ * Decode a number. Non-negative JS_INT values are stored as JS_UINT and
+ * floats as JS_DOUBLE, so each value has one representation per type.
+ */
+JS_PROTO void
+js_decode_number(const char **data, struct js_number *num);
+
+JS_IMPL void
+js_decode_number(const char **data, struct js_number *num)
+{
+	switch (js_typeof(**data)) {
+	case JS_UINT:
+		num->type = JS_UINT;
+		num->u = js_decode_uint(data);
+		break;
+	case JS_INT:
+		num->i = js_decode_int(data);
+		if (num->i >= 0) {
+			/* Non-negative integers compare and hash as JS_UINT */
+			num->type = JS_UINT;
+			num->u = (uint64_t) num->i;
+		} else {
+			num->type = JS_INT;
+		}
+		break;
+	case JS_FLOAT:
+		num->type = JS_DOUBLE;
+		num->d = js_decode_float(data);
+		break;
+	case JS_DOUBLE:
+		num->type = JS_DOUBLE;
+		num->d = js_decode_double(data);
+		break;
+	default:
+		js_unreachable();
+	}
+}
+
+/** Compare an integer with a double exactly, NaN is the greatest */
+JS_PROTO __attribute__((const)) int
+js_compare_u64_f64(uint64_t a, double b);
+
+JS_IMPL int
+js_compare_u64_f64(uint64_t a, double b)
+{
+	if (b != b || b >= 18446744073709551616.0)
+		return -1;
+	if (b < 0)
+		return 1;
+	/* Truncation of a double is exact, so is the fraction */
+	uint64_t t = (uint64_t) b;
+	if (a != t)
+		return a < t ? -1 : 1;
+	return b - (double) t > 0 ? -1 : 0;
+}
+
+JS_PROTO __attribute__((const)) int
+js_compare_i64_f64(int64_t a, double b);
+
+JS_IMPL int
+js_compare_i64_f64(int64_t a, double b)
+{
+	if (a >= 0)
+		return js_compare_u64_f64((uint64_t) a, b);
+	if (b != b || b >= 0)
+		return -1;
+	if (b < -9223372036854775808.0)
+		return 1;
+	int64_t t = (int64_t) b;
+	if (a != t)
+		return a < t ? -1 : 1;
+	return b - (double) t < 0 ? 1 : 0;
+}
+
+JS_PROTO __attribute__((pure)) int
+js_compare_number(const struct js_number *a, const struct js_number *b);
+
+JS_IMPL int
+js_compare_number(const struct js_number *a, const struct js_number *b)
+{
+	switch (a->type) {
+	case JS_UINT:
+		if (b->type == JS_UINT)
+			return a->u < b->u ? -1 : a->u > b->u;
+		if (b->type == JS_INT)
+			return 1;
+		return js_compare_u64_f64(a->u, b->d);
+	case JS_INT:
+		if (b->type == JS_INT)
+			return a->i < b->i ? -1 : a->i > b->i;
+		if (b->type == JS_UINT)
+			return -1;
+		return js_compare_i64_f64(a->i, b->d);
+	case JS_DOUBLE:
+		if (b->type == JS_UINT)
+			return -js_compare_u64_f64(b->u, a->d);
+		if (b->type == JS_INT)
+			return -js_compare_i64_f64(b->i, a->d);
+		if (a->d != a->d || b->d != b->d)
+			return (a->d != a->d) - (b->d != b->d);
+		return a->d < b->d ? -1 : a->d > b->d;
+	default:
+		js_unreachable();
+	}
+}
+
+JS_PROTO __attribute__((pure)) int
+js_compare_bytes(const char *a, uint32_t len_a, const char *b,
+		 uint32_t len_b);
+
+JS_IMPL int
+js_compare_bytes(const char *a, uint32_t len_a, const char *b, uint32_t len_b)
+{
+	int r = memcmp(a, b, len_a < len_b ? len_a : len_b);
+	if (r != 0)
+		return r;
+	return len_a < len_b ? -1 : len_a > len_b;
+}
+
+/**
+ * Compare values at \a a and \a b and advance both pointers past them
+ * if they are equal. The pointers are not defined otherwise.
+ */
+JS_PROTO int
+js_compare_internal(const char **a, const char **b);
+
+JS_IMPL int
+js_compare_internal(const char **a, const char **b)
+{
+	enum js_type type_a = js_typeof(**a);
+	enum js_type type_b = js_typeof(**b);
+	enum js_rank rank = js_rank(type_a);
+	int r = (int) rank - (int) js_rank(type_b);
+	if (r != 0)
+		return r;
+	switch (rank) {
+	case JS_RANK_NIL:
+		js_decode_nil(a);
+		js_decode_nil(b);
+		return 0;
+	case JS_RANK_BOOL:
+		return (int) js_decode_bool(a) - (int) js_decode_bool(b);
+	case JS_RANK_NUMBER: {
+		if (type_a == JS_UINT && type_b == JS_UINT) {
+			uint64_t ua = js_decode_uint(a);
+			uint64_t ub = js_decode_uint(b);
+			return ua < ub ? -1 : ua > ub;
+		}
+		struct js_number na, nb;
+		js_decode_number(a, &na);
+		js_decode_number(b, &nb);
+		return js_compare_number(&na, &nb);
+	}
+	case JS_RANK_STR:
+	case JS_RANK_BIN: {
+		uint32_t len_a, len_b;
+		const char *sa = rank == JS_RANK_STR ? js_decode_str(a, &len_a) :
+			js_decode_bin(a, &len_a);
+		const char *sb = rank == JS_RANK_STR ? js_decode_str(b, &len_b) :
+			js_decode_bin(b, &len_b);
+		return js_compare_bytes(sa, len_a, sb, len_b);
+	}
+	case JS_RANK_ARRAY:
+	case JS_RANK_MAP: {
+		uint32_t size_a, size_b, count;
+		if (rank == JS_RANK_ARRAY) {
+			size_a = js_decode_array(a);
+			size_b = js_decode_array(b);
+		} else {
+			size_a = js_decode_map(a);
+			size_b = js_decode_map(b);
+		}
+		count = size_a < size_b ? size_a : size_b;
+		if (rank == JS_RANK_MAP)
+			count *= 2;
+		for (uint32_t i = 0; i < count; i++) {
+			r = js_compare_internal(a, b);
+			if (r != 0)
+				return r;
+		}
+		if (size_a != size_b)
+			return size_a < size_b ? -1 : 1;
+		return 0;
+	}
+	case JS_RANK_EXT: {
+		int8_t ext_a, ext_b;
+		uint32_t len_a, len_b;
+		const char *sa = js_decode_ext_internal(a, &ext_a, &len_a);
+		const char *sb = js_decode_ext_internal(b, &ext_b, &len_b);
+		if (ext_a != ext_b)
+			return ext_a < ext_b ? -1 : 1;
+		return js_compare_bytes(sa, len_a, sb, len_b);
+	}
+	default:
+		js_unreachable();
+	}
+}
+
+JS_IMPL int
+js_compare(const char *data_a, const char *data_b)
+{
+	return js_compare_internal(&data_a, &data_b);
+}
+
+#define JS_HASH_P0 0xa0761d6478bd642fULL
+#define JS_HASH_P1 0xe7037ed1a0b428dbULL
+#define JS_HASH_P2 0x8ebc6af09c88c6e3ULL
+
+/** Canonical tags of values in js_hash() */
+enum js_hash_tag {
+	JS_HASH_NIL = 1,
+	JS_HASH_FALSE,
+	JS_HASH_TRUE,
+	/** a non-negative integer or an integral double */
+	JS_HASH_UINT,
+	/** a negative integer or an integral double */
+	JS_HASH_INT,
+	/** a double which is not integral */
+	JS_HASH_DOUBLE,
+	JS_HASH_NAN,
+	JS_HASH_STR,
+	JS_HASH_BIN,
+	JS_HASH_ARRAY,
+	JS_HASH_MAP,
+	JS_HASH_EXT
+};
+
+/** Multiply \a a by \a b and fold the 128-bit product */
+JS_PROTO __attribute__((const)) uint64_t
+js_hash_mix(uint64_t a, uint64_t b);
+
+JS_IMPL uint64_t
+js_hash_mix(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t) a * b;
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32;
+	uint64_t la = (uint32_t) a, lb = (uint32_t) b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	return lo ^ hi;
+#endif
+}
+
+JS_PROTO __attribute__((const)) uint64_t
+js_hash_word(uint64_t h, uint64_t word);
+
+JS_IMPL uint64_t
+js_hash_word(uint64_t h, uint64_t word)
+{
+	return js_hash_mix(h ^ JS_HASH_P0, word ^ JS_HASH_P1);
+}
+
+JS_PROTO __attribute__((pure)) uint64_t
+js_hash_bytes(uint64_t h, const char *s, uint32_t len);
+
+JS_IMPL uint64_t
+js_hash_bytes(uint64_t h, const char *s, uint32_t len)
+{
+	h = js_hash_word(h, len);
+	const char *end = s + len;
+	for (; end - s >= 16; s += 16) {
+		uint64_t a, b;
+		memcpy(&a, s, 8);
+		memcpy(&b, s + 8, 8);
+		h = js_hash_mix(a ^ JS_HASH_P1, b ^ h);
+	}
+	if (s < end) {
+		uint64_t tail[2] = {0, 0};
+		memcpy(tail, s, end - s);
+		h = js_hash_mix(tail[0] ^ JS_HASH_P1, tail[1] ^ h);
+	}
+	return h;
+}
+
+/** Hash a number so that numbers equal by value hash the same */
+JS_PROTO uint64_t
+js_hash_number(uint64_t h, const char **data);
+
+JS_IMPL uint64_t
+js_hash_number(uint64_t h, const char **data)
+{
+	struct js_number num;
+	js_decode_number(data, &num);
+	if (num.type == JS_DOUBLE) {
+		double d = num.d;
+		if (d != d)
+			return js_hash_word(h, JS_HASH_NAN);
+		if (d >= 0 && d < 18446744073709551616.0 &&
+		    d == (double) (uint64_t) d) {
+			num.type = JS_UINT;
+			num.u = (uint64_t) d;
+		} else if (d < 0 && d >= -9223372036854775808.0 &&
+			   d == (double) (int64_t) d) {
+			num.type = JS_INT;
+			num.i = (int64_t) d;
+		} else {
+			uint64_t bits;
+			memcpy(&bits, &d, sizeof(bits));
+			h = js_hash_word(h, JS_HASH_DOUBLE);
+			return js_hash_word(h, bits);
+		}
+	}
+	if (num.type == JS_UINT) {
+		h = js_hash_word(h, JS_HASH_UINT);
+		return js_hash_word(h, num.u);
+	}
+	h = js_hash_word(h, JS_HASH_INT);
+	return js_hash_word(h, (uint64_t) num.i);
+}
+
+/**
+ * Hash the value at \a data into \a h and advance \a data past it.
+ * \a seed starts the hash of every map pair when \a unordered is set.
+ */
+JS_PROTO uint64_t
+js_hash_internal(const char **data, uint64_t h, uint64_t seed,
+		 bool unordered);
+
+JS_IMPL uint64_t
+js_hash_internal(const char **data, uint64_t h, uint64_t seed,
+		 bool unordered)
+{
+	uint32_t len;
+	const char *s;
+	switch (js_typeof(**data)) {
+	case JS_NIL:
+		js_decode_nil(data);
+		return js_hash_word(h, JS_HASH_NIL);
+	case JS_BOOL:
+		return js_hash_word(h, js_decode_bool(data) ?
+				    JS_HASH_TRUE : JS_HASH_FALSE);
+	case JS_UINT:
+	case JS_INT:
+	case JS_FLOAT:
+	case JS_DOUBLE:
+		return js_hash_number(h, data);
+	case JS_STR:
+		s = js_decode_str(data, &len);
+		return js_hash_bytes(js_hash_word(h, JS_HASH_STR), s, len);
+	case JS_BIN:
+		s = js_decode_bin(data, &len);
+		return js_hash_bytes(js_hash_word(h, JS_HASH_BIN), s, len);
+	case JS_EXT: {
+		int8_t type;
+		s = js_decode_ext_internal(data, &type, &len);
+		h = js_hash_word(h, JS_HASH_EXT);
+		h = js_hash_word(h, (uint8_t) type);
+		return js_hash_bytes(h, s, len);
+	}
+	case JS_ARRAY:
+		len = js_decode_array(data);
+		h = js_hash_word(js_hash_word(h, JS_HASH_ARRAY), len);
+		for (uint32_t i = 0; i < len; i++)
+			h = js_hash_internal(data, h, seed, unordered);
+		return h;
+	case JS_MAP: {
+		len = js_decode_map(data);
+		h = js_hash_word(js_hash_word(h, JS_HASH_MAP), len);
+		if (!unordered) {
+			for (uint32_t i = 0; i < 2 * len; i++)
+				h = js_hash_internal(data, h, seed, unordered);
+			return h;
+		}
+		/* Pairs are hashed independently, the sum commutes */
+		uint64_t sum = 0;
+		for (uint32_t i = 0; i < len; i++) {
+			uint64_t ph = js_hash_internal(data, seed ^ JS_HASH_P2,
+						       seed, true);
+			ph = js_hash_internal(data, ph, seed, true);
+			sum += js_hash_mix(ph, JS_HASH_P0);
+		}
+		return js_hash_word(h, sum);
+	}
+	default:
+		js_unreachable();
+	}
+}
+
+JS_IMPL uint64_t
+js_hash(const char *data, uint64_t seed)
+{
+	uint64_t h = js_hash_internal(&data, seed ^ JS_HASH_P0, seed,
+					      false);
+	return js_hash_mix(h ^ JS_HASH_P2, h ^ JS_HASH_P1);
+}
+
+JS_IMPL uint64_t
+js_hash_unordered(const char *data, uint64_t seed)
+{
+	uint64_t h = js_hash_internal(&data, seed ^ JS_HASH_P0, seed,
+					      true);
+	return js_hash_mix(h ^ JS_HASH_P2, h ^ JS_HASH_P1);
+}
+
+/** A map pair to be sorted by js_canonicalize() */
+struct js_canonical_pair {
+	const char *key;
+	uint32_t index;
+};
+
+JS_PROTO int
+js_canonical_pair_cmp(const void *a, const void *b);
+
+JS_IMPL int
+js_canonical_pair_cmp(const void *a, const void *b)
+{
+	const struct js_canonical_pair *pa =
+		(const struct js_canonical_pair *) a;
+	const struct js_canonical_pair *pb =
+		(const struct js_canonical_pair *) b;
+	int r = js_compare(pa->key, pb->key);
+	if (r != 0)
+		return r;
+	return pa->index < pb->index ? -1 : pa->index > pb->index;
+}
+
+JS_PROTO size_t
+js_canonicalize_internal(const char **data, char *dst, unsigned flags,
+			 struct js_arena *arena);
+
+JS_IMPL size_t
+js_canonicalize_internal(const char **data, char *dst, unsigned flags,
+			 struct js_arena *arena)
+{
+	const char *begin = *data;
+	uint32_t len;
+	const char *s;
+	switch (js_typeof(**data)) {
+	case JS_UINT: {
+		uint64_t num = js_decode_uint(data);
+		if (dst != NULL)
+			js_pack_uint(dst, num);
+		return js_sizeof_uint(num);
+	}
+	case JS_INT: {
+		int64_t num = js_decode_int(data);
+		if (num >= 0) {
+			if (dst != NULL)
+				js_pack_uint(dst, (uint64_t) num);
+			return js_sizeof_uint((uint64_t) num);
+		}
+		if (dst != NULL)
+			js_pack_int(dst, num);
+		return js_sizeof_int(num);
+	}
+	case JS_STR:
+		s = js_decode_str(data, &len);
+		if (dst != NULL)
+			memcpy(js_encode_strl(dst, len), s, len);
+		return js_sizeof_str(len);
+	case JS_BIN:
+		s = js_decode_bin(data, &len);
+		if (dst != NULL)
+			memcpy(js_encode_binl(dst, len), s, len);
+		return js_sizeof_bin(len);
+	case JS_EXT: {
+		int8_t type;
+		s = js_decode_ext_internal(data, &type, &len);
+		size_t size;
+		uint8_t hdr[6];
+		if (len == 1 || len == 2 || len == 4 || len == 8 ||
+		    len == 16) {
+			hdr[0] = 0xd4 + __builtin_ctz(len);
+			size = 1;
+		} else if (len <= UINT8_MAX) {
+			hdr[0] = 0xc7;
+			js_store_u8((char *) hdr + 1, len);
+			size = 2;
+		} else if (len <= UINT16_MAX) {
+			hdr[0] = 0xc8;
+			js_store_u16((char *) hdr + 1, len);
+			size = 3;
+		} else {
+			hdr[0] = 0xc9;
+			js_store_u32((char *) hdr + 1, len);
+			size = 5;
+		}
+		hdr[size++] = (uint8_t) type;
+		if (dst != NULL) {
+			memcpy(dst, hdr, size);
+			memcpy(dst + size, s, len);
+		}
+		return size + len;
+	}
+	case JS_ARRAY: {
+		uint32_t size = js_decode_array(data);
+		size_t total = js_sizeof_array(size);
+		if (dst != NULL)
+			js_pack_array(dst, size);
+		for (uint32_t i = 0; i < size; i++) {
+			size_t n = js_canonicalize_internal(
+				data, dst != NULL ? dst + total : NULL,
+				flags, arena);
+			if (n == SIZE_MAX)
+				return SIZE_MAX;
+			total += n;
+		}
+		return total;
+	}
+	case JS_MAP: {
+		uint32_t size = js_decode_map(data);
+		size_t total = js_sizeof_map(size);
+		if (dst != NULL)
+			js_pack_map(dst, size);
+		if ((flags & JS_CANONICAL_SORT_KEYS) == 0 || size < 2) {
+			for (uint32_t i = 0; i < 2 * size; i++) {
+				size_t n = js_canonicalize_internal(
+					data, dst != NULL ? dst + total : NULL,
+					flags, arena);
+				if (n == SIZE_MAX)
+					return SIZE_MAX;
+				total += n;
+			}
+			return total;
+		}
+		struct js_canonical_pair *pairs =
+			(struct js_canonical_pair *) js_arena_alloc(arena,
+				size * sizeof(*pairs));
+		if (pairs == NULL)
+			return SIZE_MAX;
+		struct js_arena_chunk *chunk = arena->chunk;
+		for (uint32_t i = 0; i < size; i++) {
+			pairs[i].key = *data;
+			pairs[i].index = i;
+			js_next(data);
+			js_next(data);
+		}
+		qsort(pairs, size, sizeof(*pairs), js_canonical_pair_cmp);
+		for (uint32_t i = 0; i < size && total != SIZE_MAX; i++) {
+			const char *pair = pairs[i].key;
+			for (int k = 0; k < 2; k++) {
+				size_t n = js_canonicalize_internal(
+					&pair, dst != NULL ? dst + total : NULL,
+					flags, arena);
+				if (n == SIZE_MAX) {
+					total = SIZE_MAX;
+					break;
+				}
+				total += n;
+			}
+		}
+		/*
+		 * Give pairs back, so the arena holds at most one array per
+		 * nesting level. Nested maps have rewound their own arrays,
+		 * unless one of them had to start a new chunk.
+		 */
+		if (arena->chunk == chunk)
+			arena->pos = (char *) pairs;
+		return total;
+	}
+	default:
+		/* nil, bool, float and double have a single encoding */
+		js_next(data);
+		if (dst != NULL)
+			memcpy(dst, begin, *data - begin);
+		return *data - begin;
+	}
+}
+
+JS_IMPL size_t
+js_canonicalize(const char **data, char *dst, unsigned flags,
+		struct js_arena *arena)
+{
+	return js_canonicalize_internal(data, dst, flags, arena);
+}
+
+/**
+ * Return the length of JSON pointer token \a token of \a len bytes with
+ * escapes decoded, or -1 if an escape is malformed. If \a dst is not
+ * NULL, store the decoded token to it.
+ */
+JS_PROTO ptrdiff_t
+js_pointer_unescape(const char *token, size_t len, char *dst);
+
+JS_IMPL ptrdiff_t
+js_pointer_unescape(const char *token, size_t len, char *dst)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++, n++) {
+		char c = token[i];
+		if (c == '~') {
+			if (i + 1 >= len ||
+			    (token[i + 1] != '0' && token[i + 1] != '1'))
+				return -1;
+			c = token[++i] == '0' ? '~' : '/';
+		}
+		if (dst != NULL)
+			dst[n] = c;
+	}
+	return n;
+}
+
+/** Return true if a string equals JSON pointer token \a token */
+JS_PROTO bool
+js_pointer_token_eq(const char *token, size_t len, const char *str,
+		    uint32_t str_len);
+
+JS_IMPL bool
+js_pointer_token_eq(const char *token, size_t len, const char *str,
+		    uint32_t str_len)
+{
+	/* Fast path: no escapes */
+	if (memchr(token, '~', len) == NULL)
+		return len == str_len && memcmp(token, str, len) == 0;
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++, n++) {
+		char c = token[i];
+		if (c == '~')
+			c = token[++i] == '0' ? '~' : '/';
+		if (n >= str_len || str[n] != c)
+			return false;
+	}
+	return n == str_len;
+}
+
+/**
+ * Parse an array index token. Return the index, \a size for "-" or
+ * UINT32_MAX if the token is not an index.
+ */
+JS_PROTO uint32_t
+js_pointer_index(const char *token, size_t len, uint32_t size);
+
+JS_IMPL uint32_t
+js_pointer_index(const char *token, size_t len, uint32_t size)
+{
+	if (len == 1 && token[0] == '-')
+		return size;
+	if (len == 0 || len > 10 || (len > 1 && token[0] == '0'))
+		return UINT32_MAX;
+	uint64_t index = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (token[i] < '0' || token[i] > '9')
+			return UINT32_MAX;
+		index = index * 10 + (token[i] - '0');
+	}
+	return index < UINT32_MAX ? (uint32_t) index : UINT32_MAX;
+}
+
+/**
+ * Result of following a JSON pointer: the target span and the header of
+ * its container.
+ */
+struct js_pointer_target {
+	/** the container header, NULL for the root */
+	const char *header;
+	/** the end of the container header */
+	const char *header_end;
+	/** the type and the number of elements of the container */
+	enum js_type type;
+	uint32_t size;
+	/**
+	 * The target: the array element, the map pair (key included) or an
+	 * empty span where a new element or pair would go.
+	 */
+	const char *begin;
+	const char *end;
+	/** true if the target exists */
+	bool found;
+	/** the last token of the path */
+	const char *token;
+	size_t token_len;
+};
+
+/**
+ * Follow \a path in \a data. All tokens but the last must exist.
+ * Return 0 on success, -1 if the path can't be followed.
+ */
+JS_PROTO int
+js_pointer_follow(const char *data, const char *path,
+		  struct js_pointer_target *target);
+
+JS_IMPL int
+js_pointer_follow(const char *data, const char *path,
+		  struct js_pointer_target *target)
+{
+	memset(target, 0, sizeof(*target));
+	target->begin = data;
+	target->end = data;
+	js_next(&target->end);
+	target->found = true;
+	if (*path == '\0')
+		return 0;
+	if (*path != '/')
+		return -1;
+	const char *pos = data;
+	while (*path == '/') {
+		if (!target->found)
+			return -1;
+		const char *token = path + 1;
+		const char *token_end = strchr(token, '/');
+		if (token_end == NULL)
+			token_end = token + strlen(token);
+		size_t len = token_end - token;
+		path = token_end;
+		target->token = token;
+		target->token_len = len;
+		target->header = pos;
+		target->type = js_typeof(*pos);
+		if (target->type == JS_ARRAY) {
+			target->size = js_decode_array(&pos);
+			target->header_end = pos;
+			uint32_t index = js_pointer_index(token, len,
+							  target->size);
+			if (index == UINT32_MAX || index > target->size)
+				return -1;
+			for (uint32_t i = 0; i < index; i++)
+				js_next(&pos);
+			target->begin = pos;
+			target->found = index < target->size;
+			if (target->found)
+				js_next(&pos);
+			target->end = pos;
+			pos = target->begin;
+		} else if (target->type == JS_MAP) {
+			if (js_pointer_unescape(token, len, NULL) < 0)
+				return -1;
+			target->size = js_decode_map(&pos);
+			target->header_end = pos;
+			target->found = false;
+			for (uint32_t i = 0; i < target->size; i++) {
+				const char *key = pos;
+				bool match = false;
+				if (js_typeof(*pos) == JS_STR) {
+					uint32_t key_len;
+					const char *str = js_decode_str(&pos,
+									&key_len);
+					match = js_pointer_token_eq(token, len,
+								    str,
+								    key_len);
+				} else {
+					js_next(&pos);
+				}
+				const char *value = pos;
+				js_next(&pos);
+				if (match) {
+					target->begin = key;
+					target->end = pos;
+					target->found = true;
+					pos = value;
+					break;
+				}
+			}
+			if (!target->found) {
+				/* New pairs are appended */
+				target->begin = pos;
+				target->end = pos;
+			}
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+JS_IMPL size_t
+js_patch(const char *data, char *dst, enum js_patch_op op, const char *path,
+	 const char *value)
+{
+	struct js_pointer_target t;
+	if (js_pointer_follow(data, path, &t) != 0)
+		return SIZE_MAX;
+	const char *end = data;
+	js_next(&end);
+	/* value is ignored and may be NULL for JS_PATCH_DELETE */
+	size_t value_size = 0;
+	if (op != JS_PATCH_DELETE) {
+		const char *value_end = value;
+		js_next(&value_end);
+		value_size = value_end - value;
+	}
+
+	/* Bytes to put in place of [t.begin, t.end) */
+	uint32_t size = t.size;
+	size_t key_size = 0;
+	bool keep_key = false;
+	if (t.header == NULL) {
+		/* The root */
+		if (op != JS_PATCH_SET)
+			return SIZE_MAX;
+	} else if (t.type == JS_ARRAY) {
+		switch (op) {
+		case JS_PATCH_SET:
+			if (!t.found)
+				return SIZE_MAX;
+			break;
+		case JS_PATCH_INSERT:
+			t.end = t.begin;
+			size++;
+			break;
+		case JS_PATCH_DELETE:
+			if (!t.found)
+				return SIZE_MAX;
+			size--;
+			break;
+		}
+	} else {
+		switch (op) {
+		case JS_PATCH_SET:
+			if (t.found) {
+				keep_key = true;
+				break;
+			}
+			/* fallthrough */
+		case JS_PATCH_INSERT:
+			if (t.found)
+				return SIZE_MAX;
+			key_size = js_sizeof_str(js_pointer_unescape(
+				t.token, t.token_len, NULL));
+			size++;
+			break;
+		case JS_PATCH_DELETE:
+			if (!t.found)
+				return SIZE_MAX;
+			size--;
+			break;
+		}
+	}
+	if (keep_key) {
+		/* Replace the value only */
+		js_next(&t.begin);
+	}
+
+	bool resize = t.header != NULL && size != t.size;
+	size_t header_size = 0;
+	if (resize) {
+		header_size = t.type == JS_ARRAY ? js_sizeof_array(size) :
+			js_sizeof_map(size);
+	}
+	const char *prefix_end = resize ? t.header : t.begin;
+	size_t total = (prefix_end - data) + header_size +
+		(resize ? t.begin - t.header_end : 0) + key_size + value_size +
+		(end - t.end);
+	if (dst == NULL)
+		return total;
+
+	memcpy(dst, data, prefix_end - data);
+	dst += prefix_end - data;
+	if (resize) {
+		dst = t.type == JS_ARRAY ? js_pack_array(dst, size) :
+			js_pack_map(dst, size);
+		memcpy(dst, t.header_end, t.begin - t.header_end);
+		dst += t.begin - t.header_end;
+	}
+	if (key_size > 0) {
+		uint32_t len = js_pointer_unescape(t.token, t.token_len, NULL);
+		dst = js_encode_strl(dst, len);
+		js_pointer_unescape(t.token, t.token_len, dst);
+		dst += len;
+	}
+	if (value_size > 0) {
+		memcpy(dst, value, value_size);
+		dst += value_size;
+	}
+	memcpy(dst, t.end, end - t.end);
+	return total;
+}
+
+/** Return true if map keys \a a and \a b are equal */
+JS_PROTO bool
+js_key_eq(const char *a, const char *b);
+
+JS_IMPL bool
+js_key_eq(const char *a, const char *b)
+{
+	if (js_typeof(*a) == JS_STR && js_typeof(*b) == JS_STR) {
+		uint32_t len_a, len_b;
+		const char *sa = js_decode_str(&a, &len_a);
+		const char *sb = js_decode_str(&b, &len_b);
+		return len_a == len_b && memcmp(sa, sb, len_a) == 0;
+	}
+	const char *end_a = a, *end_b = b;
+	js_next(&end_a);
+	js_next(&end_b);
+	return end_a - a == end_b - b && memcmp(a, b, end_a - a) == 0;
+}
+
+/** A pair of a map to resume js_map_find_hint() from */
+struct js_map_hint {
+	/** the index of the pair */
+	uint32_t index;
+	/** the pair or NULL to start from the first one */
+	const char *pos;
+};
+
+/**
+ * Find the value of \a key in map \a map (a pointer to the map header)
+ * starting the search at the pair of \a hint. Update \a hint to the pair
+ * after the match. Return NULL if the key is missing.
+ */
+JS_PROTO const char *
+js_map_find_hint(const char *map, const char *key, struct js_map_hint *hint);
+
+JS_IMPL const char *
+js_map_find_hint(const char *map, const char *key, struct js_map_hint *hint)
+{
+	uint32_t size = js_decode_map(&map);
+	if (size == 0)
+		return NULL;
+	uint32_t i = hint->index;
+	const char *pos = hint->pos;
+	if (pos == NULL || i >= size) {
+		i = 0;
+		pos = map;
+	}
+	for (uint32_t k = 0; k < size; k++) {
+		if (i == size) {
+			i = 0;
+			pos = map;
+		}
+		bool match = js_key_eq(pos, key);
+		js_next(&pos);
+		if (match) {
+			const char *value = pos;
+			js_next(&pos);
+			hint->index = i + 1;
+			hint->pos = pos;
+			return value;
+		}
+		js_next(&pos);
+		i++;
+	}
+	return NULL;
+}
+
+/** Return true if values at \a a and \a b are byte-equal */
+JS_PROTO bool
+js_span_eq(const char *a, const char *b);
+
+JS_IMPL bool
+js_span_eq(const char *a, const char *b)
+{
+	const char *end_a = a, *end_b = b;
+	js_next(&end_a);
+	js_next(&end_b);
+	return end_a - a == end_b - b && memcmp(a, b, end_a - a) == 0;
+}
+
+/** Copy the value at \a data to \a dst if it is not NULL */
+JS_PROTO size_t
+js_copy_value(const char *data, char *dst);
+
+JS_IMPL size_t
+js_copy_value(const char *data, char *dst)
+{
+	const char *end = data;
+	js_next(&end);
+	if (dst != NULL)
+		memcpy(dst, data, end - data);
+	return end - data;
+}
+
+/**
+ * Finish a map of \a count pairs of \a size bytes. The pairs were written
+ * to \a dst + 1, after the smallest header, so the final size is known
+ * without a second pass; move them if the header turns out longer.
+ * \a dst may be NULL to only calculate the size. Return the size of the
+ * map.
+ */
+JS_PROTO size_t
+js_map_finish(char *dst, uint32_t count, size_t size);
+
+JS_IMPL size_t
+js_map_finish(char *dst, uint32_t count, size_t size)
+{
+	uint32_t header = js_sizeof_map(count);
+	if (dst != NULL) {
+		if (header > 1)
+			memmove(dst + header, dst + 1, size);
+		js_pack_map(dst, count);
+	}
+	return header + size;
+}
+
+/**
+ * Write pairs of the diff of maps \a a and \a b to \a dst (if not NULL)
+ * and count them to \a count. Return the size of the pairs.
+ */
+JS_PROTO size_t
+js_diff_pairs(const char *a, const char *b, char *dst, uint32_t *count);
+
+JS_IMPL size_t
+js_diff_pairs(const char *a, const char *b, char *dst, uint32_t *count)
+{
+	size_t total = 0;
+	*count = 0;
+	struct js_map_hint hint = { 0, NULL };
+	/* Removed keys */
+	const char *pos = a;
+	for (uint32_t i = js_decode_map(&pos); i > 0; i--) {
+		const char *key = pos;
+		js_next(&pos);
+		js_next(&pos);
+		if (js_map_find_hint(b, key, &hint) != NULL)
+			continue;
+		total += js_copy_value(key, dst != NULL ? dst + total : NULL);
+		if (dst != NULL)
+			js_pack_nil(dst + total);
+		total += js_sizeof_nil();
+		(*count)++;
+	}
+	/* Added and changed keys */
+	hint.index = 0;
+	hint.pos = NULL;
+	pos = b;
+	for (uint32_t i = js_decode_map(&pos); i > 0; i--) {
+		const char *key = pos;
+		js_next(&pos);
+		const char *value = pos;
+		js_next(&pos);
+		const char *old = js_map_find_hint(a, key, &hint);
+		if (old != NULL && js_span_eq(old, value))
+			continue;
+		size_t key_size = js_copy_value(key, NULL);
+		char *w = dst != NULL ? dst + total + key_size : NULL;
+		size_t value_size;
+		if (old != NULL && js_typeof(*old) == JS_MAP &&
+		    js_typeof(*value) == JS_MAP) {
+			uint32_t nested;
+			value_size = js_diff_pairs(old, value,
+						   w != NULL ? w + 1 : NULL,
+						   &nested);
+			/* Maps which differ only in encoding, nothing written */
+			if (nested == 0)
+				continue;
+			value_size = js_map_finish(w, nested, value_size);
+		} else {
+			value_size = js_copy_value(value, w);
+		}
+		if (dst != NULL)
+			js_copy_value(key, dst + total);
+		total += key_size + value_size;
+		(*count)++;
+	}
+	return total;
+}
+
+JS_IMPL size_t
+js_diff(const char *a, const char *b, char *dst)
+{
+	if (js_typeof(*a) != JS_MAP || js_typeof(*b) != JS_MAP)
+		return js_copy_value(b, dst);
+	uint32_t count;
+	size_t size = js_diff_pairs(a, b, dst != NULL ? dst + 1 : NULL, &count);
+	return js_map_finish(dst, count, size);
+}
+
+/**
+ * Apply \a patch to \a target, which may be NULL for an absent value.
+ */
+JS_PROTO size_t
+js_merge_apply_internal(const char *target, const char *patch, char *dst);
+
+/** Write pairs of merge(target, patch), both maps or NULL target */
+JS_PROTO size_t
+js_merge_pairs(const char *target, const char *patch, char *dst,
+	       uint32_t *count);
+
+JS_IMPL size_t
+js_merge_pairs(const char *target, const char *patch, char *dst,
+	       uint32_t *count)
+{
+	size_t total = 0;
+	*count = 0;
+	struct js_map_hint hint = { 0, NULL };
+	const char *pos;
+	if (target != NULL) {
+		pos = target;
+		for (uint32_t i = js_decode_map(&pos); i > 0; i--) {
+			const char *key = pos;
+			js_next(&pos);
+			const char *value = pos;
+			js_next(&pos);
+			const char *p = js_map_find_hint(patch, key, &hint);
+			if (p != NULL && js_typeof(*p) == JS_NIL)
+				continue;
+			size_t key_size = js_copy_value(key,
+				dst != NULL ? dst + total : NULL);
+			char *w = dst != NULL ? dst + total + key_size : NULL;
+			total += key_size + (p == NULL ?
+				js_copy_value(value, w) :
+				js_merge_apply_internal(value, p, w));
+			(*count)++;
+		}
+	}
+	hint.index = 0;
+	hint.pos = NULL;
+	pos = patch;
+	for (uint32_t i = js_decode_map(&pos); i > 0; i--) {
+		const char *key = pos;
+		js_next(&pos);
+		const char *value = pos;
+		js_next(&pos);
+		if (js_typeof(*value) == JS_NIL)
+			continue;
+		if (target != NULL &&
+		    js_map_find_hint(target, key, &hint) != NULL)
+			continue;
+		size_t key_size = js_copy_value(key,
+			dst != NULL ? dst + total : NULL);
+		char *w = dst != NULL ? dst + total + key_size : NULL;
+		total += key_size + js_merge_apply_internal(NULL, value, w);
+		(*count)++;
+	}
+	return total;
+}
+
+JS_IMPL size_t
+js_merge_apply_internal(const char *target, const char *patch, char *dst)
+{
+	if (js_typeof(*patch) != JS_MAP)
+		return js_copy_value(patch, dst);
+	if (target != NULL && js_typeof(*target) != JS_MAP)
+		target = NULL;
+	uint32_t count;
+	size_t size = js_merge_pairs(target, patch,
+				     dst != NULL ? dst + 1 : NULL, &count);
+	return js_map_finish(dst, count, size);
+}
+
+JS_IMPL size_t
+js_merge_apply(const char *target, const char *patch, char *dst)
+{
+	return js_merge_apply_internal(target, patch, dst);
+}
+
+JS_IMPL int
+js_slice(const char *data, const char *path, const char **begin,
+	 const char **end)
+{
+	struct js_pointer_target t;
+	if (js_pointer_follow(data, path, &t) != 0 || !t.found)
+		return -1;
+	*begin = t.begin;
+	*end = t.end;
+	if (t.type == JS_MAP && t.header != NULL) {
+		/* Skip the key of the pair */
+		js_next(begin);
+	}
+	return 0;
+}
+
+#if !defined(_WIN32)
+JS_IMPL int
+js_splice(enum js_type type, const struct iovec *spans, uint32_t count,
+	  char *header, struct iovec *iov)
+{
+	char *header_end;
+	if (count > INT_MAX - 1)
+		return -1;
+	if (type == JS_ARRAY)
+		header_end = js_pack_array(header, count);
+	else if (type == JS_MAP && count % 2 == 0)
+		header_end = js_pack_map(header, count / 2);
+	else
+		return -1;
+	iov[0].iov_base = header;
+	iov[0].iov_len = header_end - header;
+	memcpy(iov + 1, spans, count * sizeof(*spans));
+	return (int) count + 1;
+}
+#endif /* !defined(_WIN32) */
+
+/** A container on the stack of js_sax_parse() */
+struct js_sax_frame {
+	/** values left, keys and values are counted separately in maps */
+	uint64_t left;
+	bool is_map;
+};
+
+/**
+ * Decode a container header at \a data with bounds checks. Return the
+ * number of elements (pairs for maps) or -1 if the header is truncated.
+ */
+JS_PROTO int64_t
+js_check_container(const char **data, const char *end);
+
+JS_IMPL int64_t
+js_check_container(const char **data, const char *end)
+{
+	int l = js_parser_hint[(uint8_t) **data];
+	ptrdiff_t header = 1;
+	if (l == JS_HINT_ARRAY_16 || l == JS_HINT_MAP_16)
+		header += sizeof(uint16_t);
+	else if (l == JS_HINT_ARRAY_32 || l == JS_HINT_MAP_32)
+		header += sizeof(uint32_t);
+	if (js_unlikely(end - *data < header))
+		return -1;
+	if (js_typeof(**data) == JS_ARRAY)
+		return js_decode_array(data);
+	return js_decode_map(data);
+}
+
+/** Call \a cb if it is set, JS_SAX_OK otherwise */
+#define JS_SAX_CALL(cb, ...) ((cb) != NULL ? (cb)(__VA_ARGS__) : JS_SAX_OK)
+
+JS_IMPL int
+js_sax_parse(const char **data, const char *end,
+	     const struct js_sax_handler *handler, void *ctx)
+{
+	struct js_sax_frame stack[JS_SAX_MAX_DEPTH];
+	int depth = 0;
+	int action;
+	bool started = false;
+	for (;;) {
+		/* Close finished containers */
+		while (depth > 0 && stack[depth - 1].left == 0) {
+			depth--;
+			if (stack[depth].is_map)
+				action = JS_SAX_CALL(handler->end_map, ctx);
+			else
+				action = JS_SAX_CALL(handler->end_array, ctx);
+			if (action == JS_SAX_STOP || action == JS_SAX_ERROR)
+				goto stop;
+		}
+		if (depth == 0 && started)
+			return 0;
+		started = true;
+		if (js_unlikely(*data >= end))
+			return -1;
+
+		struct js_sax_frame *frame = depth > 0 ?
+			&stack[depth - 1] : NULL;
+		if (frame != NULL && frame->is_map && frame->left % 2 == 0) {
+			/* A key */
+			const char *key = *data;
+			if (js_check(data, end) != 0)
+				return -1;
+			uint32_t len = 0;
+			const char *str = NULL;
+			if (js_typeof(*key) == JS_STR)
+				str = js_decode_str(&key, &len);
+			action = JS_SAX_CALL(handler->key, ctx, str, len);
+			if (action == JS_SAX_STOP || action == JS_SAX_ERROR)
+				goto stop;
+			frame->left--;
+			if (action == JS_SAX_SKIP) {
+				frame->left--;
+				if (js_check(data, end) != 0)
+					return -1;
+				continue;
+			}
+			if (str != NULL)
+				continue;
+			/* Report a non-string key as a value */
+			*data = key;
+			frame->left++;
+		}
+		if (frame != NULL)
+			frame->left--;
+
+		enum js_type type = js_typeof(**data);
+		if (type == JS_ARRAY || type == JS_MAP) {
+			const char *header = *data;
+			int64_t size = js_check_container(data, end);
+			if (size < 0)
+				return -1;
+			if (type == JS_ARRAY)
+				action = JS_SAX_CALL(handler->start_array, ctx,
+						     (uint32_t) size);
+			else
+				action = JS_SAX_CALL(handler->start_map, ctx,
+						     (uint32_t) size);
+			if (action == JS_SAX_STOP || action == JS_SAX_ERROR)
+				goto stop;
+			if (action == JS_SAX_SKIP) {
+				*data = header;
+				if (js_check(data, end) != 0)
+					return -1;
+				continue;
+			}
+			if (js_unlikely(depth == JS_SAX_MAX_DEPTH))
+				return -1;
+			stack[depth].left = type == JS_MAP ? 2 * size : size;
+			stack[depth].is_map = type == JS_MAP;
+			depth++;
+			continue;
+		}
+		const char *value = *data;
+		if (js_check(data, end) != 0)
+			return -1;
+		action = JS_SAX_CALL(handler->value, ctx, value);
+		if (action == JS_SAX_STOP || action == JS_SAX_ERROR)
+			goto stop;
+	}
+stop:
+	return action == JS_SAX_STOP ? JS_SAX_STOP : -1;
+}
+
+#undef JS_SAX_CALL
+
+JS_IMPL void
+js_reader_init(struct js_reader *reader, const char *data, const char *end)
+{
+	reader->pos = data;
+	reader->end = end;
+	reader->depth = 0;
+	reader->started = false;
+}
+
+JS_IMPL int
+js_reader_next_token(struct js_reader *reader, struct js_token *token)
+{
+	/* Close finished containers */
+	while (reader->depth > 0 && reader->left[reader->depth - 1] == 0)
+		reader->depth--;
+	if (reader->depth == 0 && reader->started)
+		return 0;
+	reader->started = true;
+	if (js_unlikely(reader->pos >= reader->end))
+		return -1;
+
+	uint32_t depth = reader->depth;
+	token->depth = depth;
+	token->is_key = depth > 0 && reader->is_map[depth - 1] &&
+			reader->left[depth - 1] % 2 == 0;
+	token->data = reader->pos;
+	token->type = js_typeof(*reader->pos);
+	if (token->type == JS_ARRAY || token->type == JS_MAP) {
+		int64_t size = js_check_container(&reader->pos, reader->end);
+		if (size < 0)
+			return -1;
+		if (js_unlikely(depth == JS_READER_MAX_DEPTH))
+			return -1;
+		if (depth > 0)
+			reader->left[depth - 1]--;
+		token->len = (uint32_t) size;
+		bool is_map = token->type == JS_MAP;
+		reader->left[depth] = is_map ? 2 * (uint64_t) size :
+						(uint64_t) size;
+		reader->is_map[depth] = is_map;
+		reader->depth++;
+		return 1;
+	}
+
+	const char *data = reader->pos;
+	if (js_check(&reader->pos, reader->end) != 0)
+		return -1;
+	if (depth > 0)
+		reader->left[depth - 1]--;
+	token->len = 0;
+	switch (token->type) {
+	case JS_UINT:
+		token->u = js_decode_uint(&data);
+		break;
+	case JS_INT:
+		token->i = js_decode_int(&data);
+		break;
+	case JS_FLOAT:
+		token->d = js_decode_float(&data);
+		break;
+	case JS_DOUBLE:
+		token->d = js_decode_double(&data);
+		break;
+	case JS_BOOL:
+		token->b = js_decode_bool(&data);
+		break;
+	case JS_STR:
+		token->str = js_decode_str(&data, &token->len);
+		break;
+	case JS_BIN:
+		token->str = js_decode_bin(&data, &token->len);
+		break;
+	case JS_EXT:
+		token->str = js_decode_ext_internal(&data, &token->ext_type,
+						    &token->len);
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+
+JS_IMPL int
+js_reader_skip(struct js_reader *reader)
+{
+	if (reader->depth == 0)
+		return 0;
+	uint64_t *left = &reader->left[reader->depth - 1];
+	for (; *left > 0; --*left) {
+		if (js_check(&reader->pos, reader->end) != 0)
+			return -1;
+	}
+	reader->depth--;
+	return 0;
+}
+
+JS_IMPL size_t
+js_vformat(char *data, size_t data_size, const char *format, va_list vl)
+{
+	size_t result = 0;
+	const char *f = NULL;
+
+	for (f = format; *f; f++) {
+		if (f[0] == '[') {
+			uint32_t size = 0;
+			int level = 1;
+			const char *e = NULL;
+
+			for (e = f + 1; level && *e; e++) {
+				if (*e == '[' || *e == '{') {
+					if (level == 1)
+						size++;
+					level++;
+				} else if (*e == ']' || *e == '}') {
+					level--;
+					/* opened '[' must be closed by ']' */
+					assert(level || *e == ']');
+				} else if (*e == '%') {
+					if (e[1] == '%')
+						e++;
+					else if (level == 1)
+						size++;
+				} else if (*e == 'N' && e[1] == 'I'
+					   && e[2] == 'L' && level == 1) {
+					size++;
+				}
+			}
+			/* opened '[' must be closed */
+			assert(level == 0);
+			result += js_sizeof_array(size);
+			if (result <= data_size)
+				data = js_encode_array(data, size);
+		} else if (f[0] == '{') {
+			uint32_t count = 0;
+			int level = 1;
 			const char *e = NULL;
 
-			for (e = f + 1; level && *e; e++) {
-				if (*e == '[' || *e == '{') {
-					if (level == 1)
-						size++;
-					level++;
-				} else if (*e == ']' || *e == '}') {
-					level--;
-					/* opened '[' must be closed by ']' */
-					assert(level || *e == ']');
-				} else if (*e == '%') {
-					if (e[1] == '%')
-						e++;
-					else if (level == 1)
-						size++;
-				} else if (*e == 'N' && e[1] == 'I'
-					   && e[2] == 'L' && level == 1) {
-					size++;
-				}
-			}
-			/* opened '[' must be closed */
-			assert(level == 0);
-			result += js_sizeof_array(size);
-			if (result <= data_size)
-				data = js_encode_array(data, size);
-		} else if (f[0] == '{') {
-			uint32_t count = 0;
-			int level = 1;
-			const char *e = NULL;
+			for (e = f + 1; level && *e; e++) {
+				if (*e == '[' || *e == '{') {
+					if (level == 1)
+						count++;
+					level++;
+				} else if (*e == ']' || *e == '}') {
+					level--;
+					/* opened '{' must be closed by '}' */
+					assert(level || *e == '}');
+				} else if (*e == '%') {
+					if (e[1] == '%')
+						e++;
+					else if (level == 1)
+						count++;
+				} else if (*e == 'N' && e[1] == 'I'
+					   && e[2] == 'L' && level == 1) {
+					count++;
+				}
+			}
+			/* opened '{' must be closed */
+			assert(level == 0);
+			/* since map is a pair list, count must be even */
+			assert(count % 2 == 0);
+			uint32_t size = count / 2;
+			result += js_sizeof_map(size);
+			if (result <= data_size)
+				data = js_encode_map(data, size);
+		} else if (f[0] == '%') {
+			f++;
+			assert(f[0]);
+			int64_t int_value = 0;
+			int int_status = 0; /* 1 - signed, 2 - unsigned */
+
+			if (f[0] == 'd' || f[0] == 'i') {
+				int_value = va_arg(vl, int);
+				int_status = 1;
+			} else if (f[0] == 'u') {
+				int_value = va_arg(vl, unsigned int);
+				int_status = 2;
+			} else if (f[0] == 's') {
+				const char *str = va_arg(vl, const char *);
+				uint32_t len = (uint32_t)strlen(str);
+				result += js_sizeof_str(len);
+				if (result <= data_size)
+					data = js_encode_str(data, str, len);
+			} else if (f[0] == '.' && f[1] == '*' && f[2] == 's') {
+				uint32_t len = va_arg(vl, uint32_t);
+				const char *str = va_arg(vl, const char *);
+				result += js_sizeof_str(len);
+				if (result <= data_size)
+					data = js_encode_str(data, str, len);
+				f += 2;
+			} else if(f[0] == 'f') {
+				float v = (float)va_arg(vl, double);
+				result += js_sizeof_float(v);
+				if (result <= data_size)
+					data = js_encode_float(data, v);
+			} else if(f[0] == 'l' && f[1] == 'f') {
+				double v = va_arg(vl, double);
+				result += js_sizeof_double(v);
+				if (result <= data_size)
+					data = js_encode_double(data, v);
+				f++;
+			} else if(f[0] == 'b') {
+				bool v = (bool)va_arg(vl, int);
+				result += js_sizeof_bool(v);
+				if (result <= data_size)
+					data = js_encode_bool(data, v);
+			} else if (f[0] == 'l'
+				   && (f[1] == 'd' || f[1] == 'i')) {
+				int_value = va_arg(vl, long);
+				int_status = 1;
+				f++;
+			} else if (f[0] == 'l' && f[1] == 'u') {
+				int_value = va_arg(vl, unsigned long);
+				int_status = 2;
+				f++;
+			} else if (f[0] == 'l' && f[1] == 'l'
+				   && (f[2] == 'd' || f[2] == 'i')) {
+				int_value = va_arg(vl, long long);
+				int_status = 1;
+				f += 2;
+			} else if (f[0] == 'l' && f[1] == 'l' && f[2] == 'u') {
+				int_value = va_arg(vl, unsigned long long);
+				int_status = 2;
+				f += 2;
+			} else if (f[0] == 'h'
+				   && (f[1] == 'd' || f[1] == 'i')) {
+				int_value = va_arg(vl, int);
+				int_status = 1;
+				f++;
+			} else if (f[0] == 'h' && f[1] == 'u') {
+				int_value = va_arg(vl, unsigned int);
+				int_status = 2;
+				f++;
+			} else if (f[0] == 'h' && f[1] == 'h'
+				   && (f[2] == 'd' || f[2] == 'i')) {
+				int_value = va_arg(vl, int);
+				int_status = 1;
+				f += 2;
+			} else if (f[0] == 'h' && f[1] == 'h' && f[2] == 'u') {
+				int_value = va_arg(vl, unsigned int);
+				int_status = 2;
+				f += 2;
+			} else if (f[0] != '%') {
+				/* unexpected format specifier */
+				assert(false);
+			}
+
+			if (int_status == 1 && int_value < 0) {
+				result += js_sizeof_int(int_value);
+				if (result <= data_size)
+					data = js_encode_int(data, int_value);
+			} else if(int_status) {
+				result += js_sizeof_uint(int_value);
+				if (result <= data_size)
+					data = js_encode_uint(data, int_value);
+			}
+		} else if (f[0] == 'N' && f[1] == 'I' && f[2] == 'L') {
+			result += js_sizeof_nil();
+			if (result <= data_size)
+				data = js_encode_nil(data);
+			f += 2;
+		}
+	}
+	return result;
+}
+
+JS_IMPL size_t
+js_format(char *data, size_t data_size, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	size_t res = js_vformat(data, data_size, format, args);
+	va_end(args);
+	return res;
+}
+
+JS_PROTO int
+js_fprint_internal(FILE *file, const char **data);
+
+JS_IMPL int
+js_fprint_internal(FILE *file, const char **data)
+{
+#define _CHECK_RC(exp) do { if (js_unlikely((exp) < 0)) return -1; } while(0)
+	switch (js_typeof(**data)) {
+	case JS_NIL:
+		js_decode_nil(data);
+		_CHECK_RC(fputs("null", file));
+		break;
+	case JS_UINT:
+		_CHECK_RC(fprintf(file, "%llu", (unsigned long long)
+			      js_decode_uint(data)));
+		break;
+	case JS_INT:
+		_CHECK_RC(fprintf(file, "%lld", (long long)
+			      js_decode_int(data)));
+		break;
+	case JS_STR:
+	case JS_BIN:
+	{
+		uint32_t len = js_typeof(**data) == JS_STR ?
+			js_decode_strl(data) : js_decode_binl(data);
+		_CHECK_RC(fputc('"', file));
+		const char *s = *data, *e = *data + len;
+		while (s < e) {
+			const char *p = js_kernels.escape_scan(s, e);
+			size_t n = p - s;
+			if (js_unlikely(fwrite(s, 1, n, file) != n))
+				return -1;
+			if (p == e)
+				break;
+			/* Escape character */
+			_CHECK_RC(fputs(js_char2escape[(uint8_t) *p], file));
+			s = p + 1;
+		}
+		_CHECK_RC(fputc('"', file));
+		*data += len;
+		break;
+	}
+	case JS_ARRAY:
+	{
+		uint32_t size = js_decode_array(data);
+		_CHECK_RC(fputc('[', file));
+		uint32_t i;
+		for (i = 0; i < size; i++) {
+			if (i)
+				_CHECK_RC(fputs(", ", file));
+			_CHECK_RC(js_fprint_internal(file, data));
+		}
+		_CHECK_RC(fputc(']', file));
+		break;
+	}
+	case JS_MAP:
+	{
+		uint32_t size = js_decode_map(data);
+		_CHECK_RC(fputc('{', file));
+		uint32_t i;
+		for (i = 0; i < size; i++) {
+			if (i)
+				_CHECK_RC(fprintf(file, ", "));
+			_CHECK_RC(js_fprint_internal(file, data));
+			_CHECK_RC(fputs(": ", file));
+			_CHECK_RC(js_fprint_internal(file, data));
+		}
+		_CHECK_RC(fputc('}', file));
+		break;
+	}
+	case JS_BOOL:
+		_CHECK_RC(fputs(js_decode_bool(data) ? "true" : "false", file));
+		break;
+	case JS_FLOAT:
+		_CHECK_RC(fprintf(file, "%g", js_decode_float(data)));
+		break;
+	case JS_DOUBLE:
+		_CHECK_RC(fprintf(file, "%lg", js_decode_double(data)));
+		break;
+	case JS_EXT:
+		js_next(data);
+		_CHECK_RC(fputs("undefined", file));
+		break;
+	default:
+		js_unreachable();
+		return -1;
+	}
+	return 0;
+#undef _CHECK_RC
+}
+
+JS_IMPL int
+js_fprint(FILE *file, const char *data)
+{
+	if (!file)
+		file = stdout;
+	int res = js_fprint_internal(file, &data);
+	return res;
+}
+
+/** A bounded output buffer of js_snprint() */
+struct js_printer {
+	/** the write position */
+	char *pos;
+	/** the end of the buffer */
+	char *end;
+	/** the number of characters printed, including truncated ones */
+	size_t total;
+};
+
+JS_PROTO void
+js_printer_write(struct js_printer *printer, const char *s, size_t len);
+
+JS_IMPL void
+js_printer_write(struct js_printer *printer, const char *s, size_t len)
+{
+	size_t avail = printer->end - printer->pos;
+	size_t n = len < avail ? len : avail;
+	/* pos is NULL when js_snprint() only measures */
+	if (n > 0) {
+		memcpy(printer->pos, s, n);
+		printer->pos += n;
+	}
+	printer->total += len;
+}
+
+JS_PROTO void
+js_snprint_internal(struct js_printer *printer, const char **data);
+
+JS_IMPL void
+js_snprint_internal(struct js_printer *printer, const char **data)
+{
+#define _WRITE(s, len) js_printer_write(printer, (s), (len))
+#define _WRITE_LIT(s) js_printer_write(printer, (s), sizeof(s) - 1)
+#define _WRITE_FMT(fmt, val) do {						\
+	char _buf[32];								\
+	int _len = snprintf(_buf, sizeof(_buf), (fmt), (val));			\
+	_WRITE(_buf, _len);							\
+} while (0)
+	switch (js_typeof(**data)) {
+	case JS_NIL:
+		js_decode_nil(data);
+		_WRITE_LIT("null");
+		break;
+	case JS_UINT:
+		_WRITE_FMT("%llu", (unsigned long long) js_decode_uint(data));
+		break;
+	case JS_INT:
+		_WRITE_FMT("%lld", (long long) js_decode_int(data));
+		break;
+	case JS_STR:
+	case JS_BIN:
+	{
+		uint32_t len = js_typeof(**data) == JS_STR ?
+			js_decode_strl(data) : js_decode_binl(data);
+		_WRITE_LIT("\"");
+		const char *s = *data, *e = *data + len;
+		while (s < e) {
+			const char *p = js_kernels.escape_scan(s, e);
+			_WRITE(s, p - s);
+			if (p == e)
+				break;
+			/* Escape character */
+			const char *esc = js_char2escape[(uint8_t) *p];
+			_WRITE(esc, esc[1] == 'u' ? 6 : 2);
+			s = p + 1;
+		}
+		_WRITE_LIT("\"");
+		*data += len;
+		break;
+	}
+	case JS_ARRAY:
+	{
+		uint32_t size = js_decode_array(data);
+		_WRITE_LIT("[");
+		uint32_t i;
+		for (i = 0; i < size; i++) {
+			if (i)
+				_WRITE_LIT(", ");
+			js_snprint_internal(printer, data);
+		}
+		_WRITE_LIT("]");
+		break;
+	}
+	case JS_MAP:
+	{
+		uint32_t size = js_decode_map(data);
+		_WRITE_LIT("{");
+		uint32_t i;
+		for (i = 0; i < size; i++) {
+			if (i)
+				_WRITE_LIT(", ");
+			js_snprint_internal(printer, data);
+			_WRITE_LIT(": ");
+			js_snprint_internal(printer, data);
+		}
+		_WRITE_LIT("}");
+		break;
+	}
+	case JS_BOOL:
+		if (js_decode_bool(data))
+			_WRITE_LIT("true");
+		else
+			_WRITE_LIT("false");
+		break;
+	case JS_FLOAT:
+		_WRITE_FMT("%g", js_decode_float(data));
+		break;
+	case JS_DOUBLE:
+		_WRITE_FMT("%lg", js_decode_double(data));
+		break;
+	case JS_EXT:
+		js_next(data);
+		_WRITE_LIT("undefined");
+		break;
+	default:
+		js_unreachable();
+	}
+#undef _WRITE_FMT
+#undef _WRITE_LIT
+#undef _WRITE
+}
+
+JS_IMPL size_t
+js_snprint(char *buf, size_t size, const char *data)
+{
+	struct js_printer printer;
+	printer.pos = buf;
+	printer.end = size > 0 ? buf + size - 1 : buf;
+	printer.total = 0;
+	js_snprint_internal(&printer, &data);
+	if (size > 0)
+		*printer.pos = '\0';
+	return printer.total;
+}
 
-			for (e = f + 1; level && *e; e++) {
-				if (*e == '[' || *e == '{') {
-					if (level == 1)
-						count++;
-					level++;
-				} else if (*e == ']' || *e == '}') {
-					level--;
-					/* opened '{' must be closed by '}' */
-					assert(level || *e == '}');
-				} else if (*e == '%') {
-					if (e[1] == '%')
-						e++;
-					else if (level == 1)
-						count++;
-				} else if (*e == 'N' && e[1] == 'I'
-					   && e[2] == 'L' && level == 1) {
-					count++;
-				}
-			}
-			/* opened '{' must be closed */
-			assert(level == 0);
-			/* since map is a pair list, count must be even */
-			assert(count % 2 == 0);
-			uint32_t size = count / 2;
-			result += js_sizeof_map(size);
-			if (result <= data_size)
-				data = js_encode_map(data, size);
-		} else if (f[0] == '%') {
-			f++;
-			assert(f[0]);
-			int64_t int_value = 0;
-			int int_status = 0; /* 1 - signed, 2 - unsigned */
+JS_IMPL void
+js_arena_create(struct js_arena *arena, const struct js_allocator *allocator,
+		size_t chunk_size)
+{
+	arena->allocator = allocator != NULL ? allocator : &js_allocator_malloc;
+	arena->chunk = NULL;
+	arena->pos = NULL;
+	arena->end = NULL;
+	arena->chunk_size = chunk_size;
+	arena->generation = 0;
+}
 
-			if (f[0] == 'd' || f[0] == 'i') {
-				int_value = va_arg(vl, int);
-				int_status = 1;
-			} else if (f[0] == 'u') {
-				int_value = va_arg(vl, unsigned int);
-				int_status = 2;
-			} else if (f[0] == 's') {
-				const char *str = va_arg(vl, const char *);
-				uint32_t len = (uint32_t)strlen(str);
-				result += js_sizeof_str(len);
-				if (result <= data_size)
-					data = js_encode_str(data, str, len);
-			} else if (f[0] == '.' && f[1] == '*' && f[2] == 's') {
-				uint32_t len = va_arg(vl, uint32_t);
-				const char *str = va_arg(vl, const char *);
-				result += js_sizeof_str(len);
-				if (result <= data_size)
-					data = js_encode_str(data, str, len);
-				f += 2;
-			} else if(f[0] == 'f') {
-				float v = (float)va_arg(vl, double);
-				result += js_sizeof_float(v);
-				if (result <= data_size)
-					data = js_encode_float(data, v);
-			} else if(f[0] == 'l' && f[1] == 'f') {
-				double v = va_arg(vl, double);
-				result += js_sizeof_double(v);
-				if (result <= data_size)
-					data = js_encode_double(data, v);
-				f++;
-			} else if(f[0] == 'b') {
-				bool v = (bool)va_arg(vl, int);
-				result += js_sizeof_bool(v);
-				if (result <= data_size)
-					data = js_encode_bool(data, v);
-			} else if (f[0] == 'l'
-				   && (f[1] == 'd' || f[1] == 'i')) {
-				int_value = va_arg(vl, long);
-				int_status = 1;
-				f++;
-			} else if (f[0] == 'l' && f[1] == 'u') {
-				int_value = va_arg(vl, unsigned long);
-				int_status = 2;
-				f++;
-			} else if (f[0] == 'l' && f[1] == 'l'
-				   && (f[2] == 'd' || f[2] == 'i')) {
-				int_value = va_arg(vl, long long);
-				int_status = 1;
-				f += 2;
-			} else if (f[0] == 'l' && f[1] == 'l' && f[2] == 'u') {
-				int_value = va_arg(vl, unsigned long long);
-				int_status = 2;
-				f += 2;
-			} else if (f[0] == 'h'
-				   && (f[1] == 'd' || f[1] == 'i')) {
-				int_value = va_arg(vl, int);
-				int_status = 1;
-				f++;
-			} else if (f[0] == 'h' && f[1] == 'u') {
-				int_value = va_arg(vl, unsigned int);
-				int_status = 2;
-				f++;
-			} else if (f[0] == 'h' && f[1] == 'h'
-				   && (f[2] == 'd' || f[2] == 'i')) {
-				int_value = va_arg(vl, int);
-				int_status = 1;
-				f += 2;
-			} else if (f[0] == 'h' && f[1] == 'h' && f[2] == 'u') {
-				int_value = va_arg(vl, unsigned int);
-				int_status = 2;
-				f += 2;
-			} else if (f[0] != '%') {
-				/* unexpected format specifier */
-				assert(false);
-			}
+JS_IMPL void
+js_arena_destroy(struct js_arena *arena)
+{
+	struct js_arena_chunk *chunk = arena->chunk;
+	while (chunk != NULL) {
+		struct js_arena_chunk *next = chunk->next;
+		arena->allocator->free(arena->allocator->ctx, chunk,
+				       chunk->size);
+		chunk = next;
+	}
+	arena->chunk = NULL;
+	arena->pos = NULL;
+	arena->end = NULL;
+	arena->generation++;
+}
 
-			if (int_status == 1 && int_value < 0) {
-				result += js_sizeof_int(int_value);
-				if (result <= data_size)
-					data = js_encode_int(data, int_value);
-			} else if(int_status) {
-				result += js_sizeof_uint(int_value);
-				if (result <= data_size)
-					data = js_encode_uint(data, int_value);
-			}
-		} else if (f[0] == 'N' && f[1] == 'I' && f[2] == 'L') {
-			result += js_sizeof_nil();
-			if (result <= data_size)
-				data = js_encode_nil(data);
-			f += 2;
+JS_IMPL void
+js_arena_reset(struct js_arena *arena)
+{
+	struct js_arena_chunk *chunk = arena->chunk;
+	arena->generation++;
+	if (chunk == NULL)
+		return;
+	/* The current chunk is the newest and therefore the largest one */
+	struct js_arena_chunk *old = chunk->next;
+	chunk->next = NULL;
+	while (old != NULL) {
+		struct js_arena_chunk *next = old->next;
+		arena->allocator->free(arena->allocator->ctx, old, old->size);
+		old = next;
+	}
+	arena->pos = (char *) chunk + JS_ARENA_ALIGN;
+	arena->end = (char *) chunk + chunk->size;
+}
+
+JS_PROTO void *
+js_arena_alloc_slowpath(struct js_arena *arena, size_t size);
+
+JS_IMPL void *
+js_arena_alloc_slowpath(struct js_arena *arena, size_t size)
+{
+	/* The chunk header takes the first JS_ARENA_ALIGN bytes */
+	size_t chunk_size = arena->chunk_size;
+	if (chunk_size < size + JS_ARENA_ALIGN)
+		chunk_size = size + JS_ARENA_ALIGN;
+	struct js_arena_chunk *chunk = (struct js_arena_chunk *)
+		arena->allocator->alloc(arena->allocator->ctx, chunk_size);
+	if (js_unlikely(chunk == NULL))
+		return NULL;
+	chunk->size = chunk_size;
+	chunk->next = arena->chunk;
+	arena->chunk = chunk;
+	arena->chunk_size = chunk_size * 2;
+	arena->pos = (char *) chunk + JS_ARENA_ALIGN + size;
+	arena->end = (char *) chunk + chunk_size;
+	return (char *) chunk + JS_ARENA_ALIGN;
+}
+
+JS_IMPL JS_ALWAYSINLINE void *
+js_arena_alloc(struct js_arena *arena, size_t size)
+{
+	/* The slow path adds the chunk header to the rounded size */
+	if (js_unlikely(size > SIZE_MAX - 2 * JS_ARENA_ALIGN))
+		return NULL;
+	size = (size + JS_ARENA_ALIGN - 1) & ~(size_t) (JS_ARENA_ALIGN - 1);
+	if (js_likely((size_t) (arena->end - arena->pos) >= size)) {
+		void *ptr = arena->pos;
+		arena->pos += size;
+		/* pos is NULL for 0 bytes from an arena without chunks */
+		if (js_likely(ptr != NULL))
+			return ptr;
+	}
+	return js_arena_alloc_slowpath(arena, size);
+}
+
+JS_IMPL void
+js_cursor_create(struct js_cursor *cursor, const char *data)
+{
+	cursor->data = data;
+	cursor->parent = NULL;
+	cursor->index = 0;
+	cursor->children = NULL;
+	cursor->generation = 0;
+}
+
+JS_IMPL enum js_type
+js_cursor_type(const struct js_cursor *cursor)
+{
+	return js_typeof(*cursor->data);
+}
+
+JS_IMPL uint32_t
+js_cursor_size(const struct js_cursor *cursor)
+{
+	const char *data = cursor->data;
+	switch (js_typeof(*data)) {
+	case JS_ARRAY:
+		return js_decode_array(&data);
+	case JS_MAP:
+		return js_decode_map(&data);
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Return the number of children slots of \a cursor: elements of an array
+ * or keys and values of a map, 0 for other types.
+ */
+JS_PROTO uint64_t
+js_cursor_slots(const struct js_cursor *cursor);
+
+JS_IMPL uint64_t
+js_cursor_slots(const struct js_cursor *cursor)
+{
+	uint64_t size = js_cursor_size(cursor);
+	return js_typeof(*cursor->data) == JS_MAP ? 2 * size : size;
+}
+
+/**
+ * Materialize children of \a cursor, walking the container once.
+ */
+JS_PROTO struct js_cursor *
+js_cursor_children(struct js_cursor *cursor, struct js_arena *arena);
+
+JS_IMPL struct js_cursor *
+js_cursor_children(struct js_cursor *cursor, struct js_arena *arena)
+{
+	/* Children of a root cursor are lost on js_arena_reset() */
+	if (js_likely(cursor->children != NULL &&
+		      cursor->generation == arena->generation))
+		return cursor->children;
+	uint64_t slots = js_cursor_slots(cursor);
+	if (slots == 0)
+		return NULL;
+	struct js_cursor *children = (struct js_cursor *)
+		js_arena_alloc(arena, slots * sizeof(struct js_cursor));
+	if (js_unlikely(children == NULL))
+		return NULL;
+	const char *data = cursor->data;
+	if (js_typeof(*data) == JS_MAP)
+		js_decode_map(&data);
+	else
+		js_decode_array(&data);
+	uint64_t i;
+	for (i = 0; i < slots; i++) {
+		children[i].data = data;
+		children[i].parent = cursor;
+		children[i].index = (uint32_t) i;
+		children[i].children = NULL;
+		children[i].generation = arena->generation;
+		js_next(&data);
+	}
+	cursor->children = children;
+	cursor->generation = arena->generation;
+	return children;
+}
+
+JS_IMPL struct js_cursor *
+js_cursor_child(struct js_cursor *cursor, uint32_t i, struct js_arena *arena)
+{
+	if (i >= js_cursor_size(cursor))
+		return NULL;
+	struct js_cursor *children = js_cursor_children(cursor, arena);
+	if (js_unlikely(children == NULL))
+		return NULL;
+	if (js_typeof(*cursor->data) == JS_MAP)
+		return &children[2 * (uint64_t) i + 1];
+	return &children[i];
+}
+
+JS_IMPL struct js_cursor *
+js_cursor_key(struct js_cursor *cursor, uint32_t i, struct js_arena *arena)
+{
+	if (js_typeof(*cursor->data) != JS_MAP ||
+	    i >= js_cursor_size(cursor))
+		return NULL;
+	struct js_cursor *children = js_cursor_children(cursor, arena);
+	if (js_unlikely(children == NULL))
+		return NULL;
+	return &children[2 * (uint64_t) i];
+}
+
+JS_IMPL struct js_cursor *
+js_cursor_find(struct js_cursor *cursor, const char *key, uint32_t len,
+	       struct js_arena *arena)
+{
+	if (js_typeof(*cursor->data) != JS_MAP)
+		return NULL;
+	uint64_t slots = js_cursor_slots(cursor);
+	struct js_cursor *children = js_cursor_children(cursor, arena);
+	if (js_unlikely(children == NULL))
+		return NULL;
+	uint64_t i;
+	for (i = 0; i < slots; i += 2) {
+		const char *k = children[i].data;
+		if (js_typeof(*k) != JS_STR)
+			continue;
+		uint32_t k_len;
+		k = js_decode_str(&k, &k_len);
+		if (k_len == len && memcmp(k, key, len) == 0)
+			return &children[i + 1];
+	}
+	return NULL;
+}
+
+JS_IMPL struct js_cursor *
+js_cursor_next_sibling(const struct js_cursor *cursor)
+{
+	struct js_cursor *parent = cursor->parent;
+	if (parent == NULL)
+		return NULL;
+	uint64_t next = cursor->index + 1;
+	if (js_typeof(*parent->data) == JS_MAP)
+		next++;
+	if (next >= js_cursor_slots(parent))
+		return NULL;
+	return &parent->children[next];
+}
+
+/**
+ * Return true if text[pos] is escaped, i.e. preceded by an odd number of
+ * backslashes.
+ */
+JS_PROTO bool
+js_json_escaped(const char *text, size_t pos);
+
+JS_IMPL bool
+js_json_escaped(const char *text, size_t pos)
+{
+	size_t i = pos;
+	while (i > 0 && text[i - 1] == '\\')
+		i--;
+	return (pos - i) % 2 == 1;
+}
+
+/**
+ * Scan text[begin, end) starting in string state \a *in_string.
+ * If \a index is not NULL, store positions of structural characters and
+ * opening quotes to it. Otherwise, count them for both possible starting
+ * states, provided that the scan is started with *in_string == false:
+ * counts[0] if the block actually starts outside of a string and
+ * counts[1] if it starts inside. Return the number of stored positions.
+ */
+JS_PROTO size_t
+js_json_index_block(const char *text, size_t begin, size_t end,
+		    bool *in_string, uint64_t *index, size_t counts[2]);
+
+JS_IMPL size_t
+js_json_index_block(const char *text, size_t begin, size_t end,
+		    bool *in_string, uint64_t *index, size_t counts[2])
+{
+	size_t n = 0;
+	bool s = *in_string;
+	size_t i = begin;
+	if (begin > 0 && js_json_escaped(text, begin))
+		i++;
+	for (; i < end; i++) {
+		switch (text[i]) {
+		case '\\':
+			i++;
+			break;
+		case '"':
+			if (index == NULL)
+				counts[s]++;
+			else if (!s)
+				index[n++] = i;
+			s = !s;
+			break;
+		case '{':
+		case '}':
+		case '[':
+		case ']':
+		case ':':
+		case ',':
+			if (index == NULL)
+				counts[s]++;
+			else if (!s)
+				index[n++] = i;
+			break;
+		default:
+			break;
 		}
 	}
-	return result;
+	*in_string = s;
+	return n;
+}
+
+JS_IMPL ptrdiff_t
+js_json_index(const char *text, size_t len, uint64_t *index)
+{
+	bool in_string = false;
+	size_t n = js_json_index_block(text, 0, len, &in_string, index, NULL);
+	if (in_string)
+		return -1;
+	return (ptrdiff_t) n;
+}
+
+JS_IMPL int
+js_schema_decode_uint(const char **data, uint64_t *val)
+{
+	switch (js_typeof(**data)) {
+	case JS_UINT:
+		*val = js_decode_uint(data);
+		return 0;
+	case JS_INT: {
+		int64_t num = js_decode_int(data);
+		if (num < 0)
+			return -1;
+		*val = (uint64_t) num;
+		return 0;
+	}
+	default:
+		return -1;
+	}
 }
 
-JS_IMPL size_t
-js_format(char *data, size_t data_size, const char *format, ...)
+JS_IMPL int
+js_schema_decode_int(const char **data, int64_t *val)
 {
-	va_list args;
-	va_start(args, format);
-	size_t res = js_vformat(data, data_size, format, args);
-	va_end(args);
-	return res;
+	switch (js_typeof(**data)) {
+	case JS_UINT: {
+		uint64_t num = js_decode_uint(data);
+		if (num > INT64_MAX)
+			return -1;
+		*val = (int64_t) num;
+		return 0;
+	}
+	case JS_INT:
+		*val = js_decode_int(data);
+		return 0;
+	default:
+		return -1;
+	}
 }
 
-JS_PROTO int
-js_fprint_internal(FILE *file, const char **data);
-
 JS_IMPL int
-js_fprint_internal(FILE *file, const char **data)
+js_schema_decode_double(const char **data, double *val)
 {
-#define _CHECK_RC(exp) do { if (js_unlikely((exp) < 0)) return -1; } while(0)
 	switch (js_typeof(**data)) {
-	case JS_NIL:
-		js_decode_nil(data);
-		_CHECK_RC(fputs("null", file));
-		break;
 	case JS_UINT:
-		_CHECK_RC(fprintf(file, "%llu", (unsigned long long)
-			      js_decode_uint(data)));
-		break;
+		*val = (double) js_decode_uint(data);
+		return 0;
 	case JS_INT:
-		_CHECK_RC(fprintf(file, "%lld", (long long)
-			      js_decode_int(data)));
-		break;
-	case JS_STR:
-	case JS_BIN:
-	{
-		uint32_t len = js_typeof(**data) == JS_STR ?
-			js_decode_strl(data) : js_decode_binl(data);
-		_CHECK_RC(fputc('"', file));
-		const char *s;
-		for (s = *data; s < *data + len; s++) {
-			unsigned char c = (unsigned char ) *s;
-			if (c < 128 && js_char2escape[c] != NULL) {
-				/* Escape character */
-				_CHECK_RC(fputs(js_char2escape[c], file));
-			} else {
-				_CHECK_RC(fputc(c, file));
-			}
+		*val = (double) js_decode_int(data);
+		return 0;
+	case JS_FLOAT:
+		*val = js_decode_float(data);
+		return 0;
+	case JS_DOUBLE:
+		*val = js_decode_double(data);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+JS_IMPL int
+js_schema_decode_bool(const char **data, bool *val)
+{
+	if (js_typeof(**data) != JS_BOOL)
+		return -1;
+	*val = js_decode_bool(data);
+	return 0;
+}
+
+JS_IMPL int
+js_schema_decode_str(const char **data, struct js_str *val)
+{
+	if (js_typeof(**data) != JS_STR)
+		return -1;
+	val->str = js_decode_str(data, &val->len);
+	return 0;
+}
+
+JS_IMPL char *
+js_schema_encode_uint(char *data, uint64_t val)
+{
+	return js_encode_uint(data, val);
+}
+
+JS_IMPL char *
+js_schema_encode_int(char *data, int64_t val)
+{
+	return js_encode_int(data, val);
+}
+
+JS_IMPL char *
+js_schema_encode_double(char *data, double val)
+{
+	return js_encode_double(data, val);
+}
+
+JS_IMPL char *
+js_schema_encode_bool(char *data, bool val)
+{
+	return js_encode_bool(data, val);
+}
+
+JS_IMPL char *
+js_schema_encode_str(char *data, struct js_str val)
+{
+	return js_encode_str(data, val.str, val.len);
+}
+
+JS_IMPL uint32_t
+js_decode_array_u64(const char **data, uint64_t *out, uint32_t n)
+{
+	uint32_t i = 0;
+	while (i < n) {
+		uint8_t c = (uint8_t) **data;
+		if (c <= 0x7f) {
+			size_t run = js_kernels.fixint_run_u64(*data, n - i,
+							       out + i);
+			*data += run;
+			i += run;
+			continue;
 		}
-		_CHECK_RC(fputc('"', file));
-		*data += len;
-		break;
+		if (js_typeof(c) != JS_UINT)
+			break;
+		out[i++] = js_decode_uint(data);
 	}
-	case JS_ARRAY:
-	{
-		uint32_t size = js_decode_array(data);
-		_CHECK_RC(fputc('[', file));
-		uint32_t i;
-		for (i = 0; i < size; i++) {
-			if (i)
-				_CHECK_RC(fputs(", ", file));
-			_CHECK_RC(js_fprint_internal(file, data));
+	return i;
+}
+
+JS_IMPL uint32_t
+js_decode_array_i64(const char **data, int64_t *out, uint32_t n)
+{
+	uint32_t i = 0;
+	while (i < n) {
+		uint8_t c = (uint8_t) **data;
+		if (c <= 0x7f || c >= 0xe0) {
+			size_t run = js_kernels.fixint_run_i64(*data, n - i,
+							       out + i);
+			*data += run;
+			i += run;
+			continue;
+		}
+		if (js_typeof(c) == JS_INT) {
+			out[i++] = js_decode_int(data);
+		} else if (js_typeof(c) == JS_UINT) {
+			const char *pos = *data;
+			uint64_t num = js_decode_uint(&pos);
+			if (num > INT64_MAX)
+				break;
+			*data = pos;
+			out[i++] = (int64_t) num;
+		} else {
+			break;
 		}
-		_CHECK_RC(fputc(']', file));
-		break;
 	}
-	case JS_MAP:
-	{
-		uint32_t size = js_decode_map(data);
-		_CHECK_RC(fputc('{', file));
-		uint32_t i;
-		for (i = 0; i < size; i++) {
-			if (i)
-				_CHECK_RC(fprintf(file, ", "));
-			_CHECK_RC(js_fprint_internal(file, data));
-			_CHECK_RC(fputs(": ", file));
-			_CHECK_RC(js_fprint_internal(file, data));
+	return i;
+}
+
+JS_IMPL uint32_t
+js_decode_array_f64(const char **data, double *out, uint32_t n)
+{
+	uint32_t i = 0;
+	while (i < n) {
+		uint8_t c = (uint8_t) **data;
+		if (c == 0xcb) {
+			const char *pos = *data;
+			do {
+				pos++;
+				out[i++] = js_load_double(&pos);
+			} while (i < n && (uint8_t) *pos == 0xcb);
+			*data = pos;
+			continue;
+		}
+		switch (js_typeof(c)) {
+		case JS_FLOAT:
+			out[i++] = js_decode_float(data);
+			break;
+		case JS_UINT:
+			out[i++] = (double) js_decode_uint(data);
+			break;
+		case JS_INT:
+			out[i++] = (double) js_decode_int(data);
+			break;
+		default:
+			return i;
 		}
-		_CHECK_RC(fputc('}', file));
-		break;
 	}
-	case JS_BOOL:
-		_CHECK_RC(fputs(js_decode_bool(data) ? "true" : "false", file));
-		break;
-	case JS_FLOAT:
-		_CHECK_RC(fprintf(file, "%g", js_decode_float(data)));
-		break;
-	case JS_DOUBLE:
-		_CHECK_RC(fprintf(file, "%lg", js_decode_double(data)));
+	return i;
+}
+
+/** The longest "%.17g" output: -1.2345678901234567e-308 */
+#define JS_DOUBLE_STR_MAX 24
+
+JS_IMPL size_t
+js_sizeof_array_u64(uint32_t n)
+{
+	/* 20 digits + ", " */
+	return 2 + (size_t) n * 22;
+}
+
+JS_IMPL size_t
+js_sizeof_array_i64(uint32_t n)
+{
+	/* sign + 19 digits + ", " */
+	return 2 + (size_t) n * 22;
+}
+
+JS_IMPL size_t
+js_sizeof_array_f64(uint32_t n)
+{
+	/* snprintf() needs room for the terminating zero */
+	return 2 + (size_t) n * (JS_DOUBLE_STR_MAX + 2) + 1;
+}
+
+/** "00", "01", ..., "99" */
+extern const char js_digits2[200];
+
+/**
+ * Write \a num in decimal. Digits are produced in pairs from the end of a
+ * temporary buffer, then copied with one memcpy().
+ */
+JS_PROTO char *
+js_format_u64(char *data, uint64_t num);
+
+JS_IMPL char *
+js_format_u64(char *data, uint64_t num)
+{
+	char buf[20];
+	char *p = buf + sizeof(buf);
+	while (num >= 100) {
+		uint32_t r = (uint32_t) (num % 100);
+		num /= 100;
+		p -= 2;
+		memcpy(p, &js_digits2[r * 2], 2);
+	}
+	if (num >= 10) {
+		p -= 2;
+		memcpy(p, &js_digits2[num * 2], 2);
+	} else {
+		*--p = (char) ('0' + num);
+	}
+	size_t len = buf + sizeof(buf) - p;
+	memcpy(data, p, len);
+	return data + len;
+}
+
+JS_PROTO char *
+js_format_i64(char *data, int64_t num);
+
+JS_IMPL char *
+js_format_i64(char *data, int64_t num)
+{
+	if (num < 0) {
+		*data++ = '-';
+		return js_format_u64(data, -(uint64_t) num);
+	}
+	return js_format_u64(data, (uint64_t) num);
+}
+
+/**
+ * Write \a num with up to 6 fractional digits if it is exactly the double
+ * nearest to such a decimal, e.g. 0.25 or 12.5 (typical for metrics).
+ * The decimal is then read back as \a num. Return NULL otherwise.
+ */
+JS_PROTO char *
+js_format_f64_fixed(char *data, double num);
+
+JS_IMPL char *
+js_format_f64_fixed(char *data, double num)
+{
+	double a = num < 0 ? -num : num;
+	if (!(a >= 1e-6 && a < 1e9))
+		return NULL;
+	uint64_t scale = 10;
+	for (int k = 1; k <= 6; k++, scale *= 10) {
+		double m = a * (double) scale;
+		uint64_t im = (uint64_t) m;
+		if ((double) im != m || (double) im / (double) scale != a)
+			continue;
+		if (num < 0)
+			*data++ = '-';
+		data = js_format_u64(data, im / scale);
+		*data++ = '.';
+		uint64_t frac = im % scale;
+		for (int i = k - 1; i >= 0; i--) {
+			data[i] = (char) ('0' + frac % 10);
+			frac /= 10;
+		}
+		return data + k;
+	}
+	return NULL;
+}
+
+JS_IMPL char *
+js_encode_array_u64(char *data, const uint64_t *values, uint32_t n)
+{
+	*data++ = '[';
+	for (uint32_t i = 0; i < n; i++) {
+		if (i > 0) {
+			memcpy(data, ", ", 2);
+			data += 2;
+		}
+		data = js_format_u64(data, values[i]);
+	}
+	*data++ = ']';
+	return data;
+}
+
+JS_IMPL char *
+js_encode_array_i64(char *data, const int64_t *values, uint32_t n)
+{
+	*data++ = '[';
+	for (uint32_t i = 0; i < n; i++) {
+		if (i > 0) {
+			memcpy(data, ", ", 2);
+			data += 2;
+		}
+		data = js_format_i64(data, values[i]);
+	}
+	*data++ = ']';
+	return data;
+}
+
+JS_IMPL char *
+js_encode_array_f64(char *data, const double *values, uint32_t n)
+{
+	*data++ = '[';
+	for (uint32_t i = 0; i < n; i++) {
+		if (i > 0) {
+			memcpy(data, ", ", 2);
+			data += 2;
+		}
+		double num = values[i];
+		char *end;
+		if (num > -1e15 && num < 1e15 && num == (double) (int64_t) num &&
+		    !(num == 0 && __builtin_signbit(num))) {
+			/* Same output as "%.17g" for these */
+			data = js_format_i64(data, (int64_t) num);
+		} else if ((end = js_format_f64_fixed(data, num)) != NULL) {
+			data = end;
+		} else if (num - num != 0) {
+			/* NaN or infinity */
+			memcpy(data, "null", 4);
+			data += 4;
+		} else {
+			data += snprintf(data, JS_DOUBLE_STR_MAX + 1, "%.17g",
+					 num);
+		}
+	}
+	*data++ = ']';
+	return data;
+}
+
+/**
+ * Decode a value at \a data to row \a row of \a column.
+ * Return true if the value has a compatible type.
+ */
+JS_PROTO bool
+js_decode_column_value(const char **data, struct js_column *column,
+		       uint32_t row);
+
+JS_IMPL bool
+js_decode_column_value(const char **data, struct js_column *column,
+		       uint32_t row)
+{
+	enum js_type type = js_typeof(**data);
+	switch (column->type) {
+	case JS_COLUMN_UINT:
+		if (type != JS_UINT)
+			break;
+		column->values.u64[row] = js_decode_uint(data);
+		return true;
+	case JS_COLUMN_INT:
+		if (type == JS_INT) {
+			column->values.i64[row] = js_decode_int(data);
+			return true;
+		} else if (type == JS_UINT) {
+			const char *pos = *data;
+			uint64_t num = js_decode_uint(&pos);
+			if (num > INT64_MAX)
+				break;
+			*data = pos;
+			column->values.i64[row] = (int64_t) num;
+			return true;
+		}
 		break;
-	case JS_EXT:
-		js_next(data);
-		_CHECK_RC(fputs("undefined", file));
+	case JS_COLUMN_DOUBLE:
+		switch (type) {
+		case JS_DOUBLE:
+			column->values.f64[row] = js_decode_double(data);
+			return true;
+		case JS_FLOAT:
+			column->values.f64[row] = js_decode_float(data);
+			return true;
+		case JS_UINT:
+			column->values.f64[row] = (double) js_decode_uint(data);
+			return true;
+		case JS_INT:
+			column->values.f64[row] = (double) js_decode_int(data);
+			return true;
+		default:
+			break;
+		}
 		break;
+	case JS_COLUMN_STR:
+		if (type != JS_STR)
+			break;
+		column->values.str[row].str =
+			js_decode_str(data, &column->values.str[row].len);
+		return true;
 	default:
 		js_unreachable();
-		return -1;
 	}
-	return 0;
-#undef _CHECK_RC
+	js_next(data);
+	return false;
 }
 
 JS_IMPL int
-js_fprint(FILE *file, const char *data)
+js_decode_columns(const char **data, struct js_column *columns,
+		  uint32_t column_count, struct js_arena *arena,
+		  uint32_t *row_count)
 {
-	if (!file)
-		file = stdout;
-	int res = js_fprint_internal(file, &data);
-	return res;
+	if (js_typeof(**data) != JS_ARRAY)
+		return -1;
+	uint32_t rows = js_decode_array(data);
+	if (rows == 0) {
+		/* Nothing to decode, leave the columns without buffers */
+		for (uint32_t c = 0; c < column_count; c++) {
+			columns[c].values.u64 = NULL;
+			columns[c].validity = NULL;
+			columns[c].null_count = 0;
+		}
+		*row_count = 0;
+		return 0;
+	}
+	size_t validity_size = (rows + 7) / 8;
+	for (uint32_t c = 0; c < column_count; c++) {
+		struct js_column *column = &columns[c];
+		size_t value_size = column->type == JS_COLUMN_STR ?
+			sizeof(struct js_str) : sizeof(uint64_t);
+		void *values = js_arena_alloc(arena, value_size * rows);
+		column->validity = (uint8_t *) js_arena_alloc(arena,
+							     validity_size);
+		if (values == NULL || column->validity == NULL)
+			return -1;
+		memset(values, 0, value_size * rows);
+		memset(column->validity, 0, validity_size);
+		column->values.u64 = (uint64_t *) values;
+		column->null_count = rows;
+	}
+	for (uint32_t row = 0; row < rows; row++) {
+		if (js_typeof(**data) != JS_MAP) {
+			js_next(data);
+			continue;
+		}
+		uint32_t expected = 0;
+		for (uint32_t i = js_decode_map(data); i > 0; i--) {
+			if (js_typeof(**data) != JS_STR) {
+				js_next(data);
+				js_next(data);
+				continue;
+			}
+			uint32_t len;
+			const char *key = js_decode_str(data, &len);
+			struct js_column *column = NULL;
+			for (uint32_t k = 0; k < column_count; k++) {
+				uint32_t c = expected + k;
+				if (c >= column_count)
+					c -= column_count;
+				if (columns[c].key_len == len &&
+				    memcmp(columns[c].key, key, len) == 0) {
+					column = &columns[c];
+					expected = c + 1 < column_count ? c + 1 : 0;
+					break;
+				}
+			}
+			if (column == NULL) {
+				js_next(data);
+				continue;
+			}
+			if (js_decode_column_value(data, column, row) &&
+			    (column->validity[row / 8] & (1 << (row % 8))) == 0) {
+				column->validity[row / 8] |= 1 << (row % 8);
+				column->null_count--;
+			}
+		}
+	}
+	*row_count = rows;
+	return 0;
 }
 
 /** \endcond */
@@ -2675,6 +6968,40 @@ const char *js_char2escape[128] = {
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, "\\u007f"
 };
 
+static void *
+js_allocator_malloc_alloc(void *ctx, size_t size)
+{
+	(void) ctx;
+	return malloc(size);
+}
+
+static void
+js_allocator_malloc_free(void *ctx, void *ptr, size_t size)
+{
+	(void) ctx;
+	(void) size;
+	free(ptr);
+}
+
+const char js_digits2[200] = {
+	'0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+	'1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+	'2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+	'3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+	'4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+	'5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+	'6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+	'7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+	'8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+	'9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+};
+
+const struct js_allocator js_allocator_malloc = {
+	/* .alloc = */ js_allocator_malloc_alloc,
+	/* .free = */ js_allocator_malloc_free,
+	/* .ctx = */ NULL
+};
+
 #endif /* defined(JS_SOURCE) */
 
 /** \endcond */
@@ -2691,6 +7018,8 @@ const char *js_char2escape[128] = {
 #undef JS_PROTO
 #undef JS_IMPL
 #undef JS_ALWAYSINLINE
+#undef JS_STAT_INC
+#undef JS_STAT_ADD
 #undef JS_GCC_VERSION
 
 #endif /* JSONPUCK_H_INCLUDED */
@@ -0,0 +1,554 @@
+#ifndef JSONPUCK_HPP_INCLUDED
+#define JSONPUCK_HPP_INCLUDED
+
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ * C++17 struct binding for jsonpuck.
+ *
+ * JS_REFLECT(Struct, field1, field2, ...) makes jsonpuck::decode() and
+ * jsonpuck::encode() work with Struct. Both are resolved at compile time:
+ * fields are visited through a tuple of member pointers, and keys are
+ * looked up with a perfect hash table built by a constexpr search for a
+ * seed under which all field names fall into distinct slots. Decoding a
+ * key costs one hash, one table load and one memcmp(); there is no
+ * virtual dispatch and no run-time registry.
+ *
+ * Supported field types are bool, integers, float, double, std::string,
+ * std::string_view (points into the decoded buffer), std::vector<T>,
+ * std::optional<T> (nil is nullopt) and other reflected structs.
+ *
+ * Example usage:
+ * \code
+ * struct Point { int64_t x; int64_t y; std::string label; };
+ * JS_REFLECT(Point, x, y, label)
+ *
+ * Point p;
+ * if (!jsonpuck::decode(&data, p))
+ *     return -1;
+ * std::string json = jsonpuck::to_json(p);
+ * \endcode
+ *
+ * As with the C API, JSONPack must be validated by js_check() before
+ * decoding, and the encoder produces JSON text.
+ */
+
+#include "jsonpuck.h"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace jsonpuck {
+
+/**
+ * \brief Reflection data of struct T, specialized by JS_REFLECT().
+ */
+template <class T>
+struct reflect {
+	static constexpr bool defined = false;
+};
+
+/** \cond false */
+namespace detail {
+
+/** FNV-1a with a seeded offset basis */
+constexpr uint32_t
+hash(std::string_view s, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+	for (char c : s) {
+		h ^= (uint8_t) c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/** The smallest power of two >= 2 * n */
+constexpr size_t
+table_size(size_t n)
+{
+	size_t size = 1;
+	while (size < 2 * n)
+		size *= 2;
+	return size;
+}
+
+/**
+ * A perfect hash table of N keys: slots[hash(key, seed) & (Size - 1)] is
+ * the key index + 1 or 0 for an empty slot.
+ */
+template <size_t N>
+struct key_table {
+	static constexpr size_t size = table_size(N);
+	uint32_t seed = 0;
+	std::array<uint8_t, size> slots{};
+
+	constexpr
+	key_table(const std::array<std::string_view, N> &keys)
+	{
+		static_assert(N < UINT8_MAX, "too many fields");
+		for (;; seed++) {
+			slots = {};
+			size_t i = 0;
+			for (; i < N; i++) {
+				size_t slot = hash(keys[i], seed) & (size - 1);
+				if (slots[slot] != 0)
+					break;
+				slots[slot] = (uint8_t) (i + 1);
+			}
+			if (i == N)
+				return;
+		}
+	}
+
+	/** Return the index of \a key or -1 */
+	int
+	find(const std::array<std::string_view, N> &keys,
+	     std::string_view key) const
+	{
+		uint8_t slot = slots[hash(key, seed) & (size - 1)];
+		if (slot == 0 || keys[slot - 1] != key)
+			return -1;
+		return slot - 1;
+	}
+};
+
+/** Split "a, b, c" produced by #__VA_ARGS__ into names */
+template <size_t N>
+constexpr std::array<std::string_view, N>
+split_names(std::string_view list)
+{
+	std::array<std::string_view, N> names{};
+	size_t n = 0;
+	size_t pos = 0;
+	while (n < N) {
+		while (list[pos] == ' ' || list[pos] == '\t' ||
+		       list[pos] == '\n')
+			pos++;
+		size_t end = pos;
+		while (end < list.size() && list[end] != ',' &&
+		       list[end] != ' ' && list[end] != '\t' &&
+		       list[end] != '\n')
+			end++;
+		names[n++] = list.substr(pos, end - pos);
+		pos = list.find(',', end);
+		if (pos == std::string_view::npos)
+			break;
+		pos++;
+	}
+	return names;
+}
+
+constexpr size_t
+count_names(std::string_view list)
+{
+	size_t n = 1;
+	for (char c : list)
+		n += c == ',';
+	return n;
+}
+
+template <class T>
+struct is_vector : std::false_type {};
+template <class T, class A>
+struct is_vector<std::vector<T, A>> : std::true_type {};
+
+template <class T>
+struct is_optional : std::false_type {};
+template <class T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+/** Max length of js_encode_double() output: %f of -DBL_MAX */
+constexpr size_t double_size_max = 1 + 309 + 1 + 6;
+
+} /* namespace detail */
+/** \endcond */
+
+template <class T>
+bool
+decode(const char **data, T &val);
+
+template <class T>
+char *
+encode(char *data, const T &val);
+
+template <class T>
+size_t
+encoded_size_max(const T &val);
+
+/** \cond false */
+namespace detail {
+
+template <class T, size_t... I>
+bool
+decode_field(const char **data, T &obj, int field, std::index_sequence<I...>)
+{
+	bool ok = false;
+	((field == (int) I ?
+	  (ok = jsonpuck::decode(data, obj.*std::get<I>(reflect<T>::fields)),
+	   true) : false) || ...);
+	return ok;
+}
+
+template <class T>
+bool
+decode_struct(const char **data, T &obj)
+{
+	using R = reflect<T>;
+	if (js_typeof(**data) != JS_MAP)
+		return false;
+	constexpr size_t n = R::count;
+	for (uint32_t i = js_decode_map(data); i > 0; i--) {
+		if (js_typeof(**data) != JS_STR) {
+			js_next(data);
+			js_next(data);
+			continue;
+		}
+		uint32_t len;
+		const char *key = js_decode_str(data, &len);
+		int field = R::table.find(R::names,
+					  std::string_view(key, len));
+		if (field < 0) {
+			js_next(data);
+			continue;
+		}
+		if (!decode_field(data, obj, field,
+				  std::make_index_sequence<n>()))
+			return false;
+	}
+	return true;
+}
+
+template <class T, size_t... I>
+char *
+encode_struct(char *data, const T &obj, std::index_sequence<I...>)
+{
+	using R = reflect<T>;
+	*data++ = '{';
+	((data = I == 0 ? data : (memcpy(data, ", ", 2), data + 2),
+	  data = js_encode_str(data, R::names[I].data(),
+			       (uint32_t) R::names[I].size()),
+	  memcpy(data, ": ", 2), data += 2,
+	  data = jsonpuck::encode(data, obj.*std::get<I>(R::fields))), ...);
+	*data++ = '}';
+	return data;
+}
+
+template <class T, size_t... I>
+size_t
+encoded_size_max_struct(const T &obj, std::index_sequence<I...>)
+{
+	using R = reflect<T>;
+	return 2 + ((4 + 2 + 6 * R::names[I].size() +
+		     jsonpuck::encoded_size_max(obj.*std::get<I>(R::fields)))
+		    + ... + 0);
+}
+
+} /* namespace detail */
+/** \endcond */
+
+/**
+ * \brief Decode a value of type T from \a data.
+ * \param data - the pointer to a buffer
+ * \param[out] val - a value
+ * \retval true on success
+ * \retval false if the type of a value in \a data doesn't match T or
+ * a number is out of range, *data is not defined then
+ * \post *data = *data + js_sizeof_TYPE() on success
+ */
+template <class T>
+bool
+decode(const char **data, T &val)
+{
+	if constexpr (std::is_same_v<T, bool>) {
+		if (js_typeof(**data) != JS_BOOL)
+			return false;
+		val = js_decode_bool(data);
+		return true;
+	} else if constexpr (std::is_integral_v<T>) {
+		using limits = std::numeric_limits<T>;
+		switch (js_typeof(**data)) {
+		case JS_UINT: {
+			uint64_t num = js_decode_uint(data);
+			if (num > (uint64_t) limits::max())
+				return false;
+			val = (T) num;
+			return true;
+		}
+		case JS_INT: {
+			int64_t num = js_decode_int(data);
+			if constexpr (std::is_signed_v<T>) {
+				if (num < (int64_t) limits::min() ||
+				    num > (int64_t) limits::max())
+					return false;
+			} else {
+				/* Non-negative JS_INT, as in the C schema */
+				if (num < 0 ||
+				    (uint64_t) num > (uint64_t) limits::max())
+					return false;
+			}
+			val = (T) num;
+			return true;
+		}
+		default:
+			return false;
+		}
+	} else if constexpr (std::is_floating_point_v<T>) {
+		switch (js_typeof(**data)) {
+		case JS_UINT:
+			val = (T) js_decode_uint(data);
+			return true;
+		case JS_INT:
+			val = (T) js_decode_int(data);
+			return true;
+		case JS_FLOAT:
+			val = (T) js_decode_float(data);
+			return true;
+		case JS_DOUBLE:
+			val = (T) js_decode_double(data);
+			return true;
+		default:
+			return false;
+		}
+	} else if constexpr (std::is_same_v<T, std::string> ||
+			     std::is_same_v<T, std::string_view>) {
+		if (js_typeof(**data) != JS_STR)
+			return false;
+		uint32_t len;
+		const char *str = js_decode_str(data, &len);
+		val = T(str, len);
+		return true;
+	} else if constexpr (detail::is_optional<T>::value) {
+		if (js_typeof(**data) == JS_NIL) {
+			js_decode_nil(data);
+			val.reset();
+			return true;
+		}
+		return jsonpuck::decode(data, val.emplace());
+	} else if constexpr (detail::is_vector<T>::value) {
+		if (js_typeof(**data) != JS_ARRAY)
+			return false;
+		uint32_t size = js_decode_array(data);
+		val.clear();
+		val.resize(size);
+		for (auto &item : val) {
+			if (!jsonpuck::decode(data, item))
+				return false;
+		}
+		return true;
+	} else {
+		static_assert(reflect<T>::defined,
+			      "the type is not supported, use JS_REFLECT()");
+		return detail::decode_struct(data, val);
+	}
+}
+
+/**
+ * \brief Encode \a val to JSON.
+ * It is your responsibility to ensure that \a data has enough space, see
+ * encoded_size_max().
+ * \param data - a buffer
+ * \param val - a value
+ * \return the end of the encoded value in \a data
+ */
+template <class T>
+char *
+encode(char *data, const T &val)
+{
+	if constexpr (std::is_same_v<T, bool>) {
+		return js_encode_bool(data, val);
+	} else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+		return js_encode_int(data, val);
+	} else if constexpr (std::is_integral_v<T>) {
+		return js_encode_uint(data, val);
+	} else if constexpr (std::is_same_v<T, float>) {
+		return js_encode_float(data, val);
+	} else if constexpr (std::is_floating_point_v<T>) {
+		return js_encode_double(data, (double) val);
+	} else if constexpr (std::is_same_v<T, std::string> ||
+			     std::is_same_v<T, std::string_view>) {
+		return js_encode_str(data, val.data(), (uint32_t) val.size());
+	} else if constexpr (detail::is_optional<T>::value) {
+		if (!val)
+			return js_encode_nil(data);
+		return jsonpuck::encode(data, *val);
+	} else if constexpr (detail::is_vector<T>::value) {
+		*data++ = '[';
+		bool first = true;
+		for (const auto &item : val) {
+			if (!first) {
+				memcpy(data, ", ", 2);
+				data += 2;
+			}
+			first = false;
+			data = jsonpuck::encode(data, item);
+		}
+		*data++ = ']';
+		return data;
+	} else {
+		static_assert(reflect<T>::defined,
+			      "the type is not supported, use JS_REFLECT()");
+		constexpr size_t n = reflect<T>::count;
+		return detail::encode_struct(data, val,
+					     std::make_index_sequence<n>());
+	}
+}
+
+/**
+ * \brief Return an upper bound of the size of encode(data, val) output.
+ * \param val - a value
+ * \return a size in bytes
+ */
+template <class T>
+size_t
+encoded_size_max(const T &val)
+{
+	if constexpr (std::is_same_v<T, bool>) {
+		return 5;
+	} else if constexpr (std::is_integral_v<T>) {
+		return 20;
+	} else if constexpr (std::is_floating_point_v<T>) {
+		/* sprintf() writes a terminating zero */
+		return detail::double_size_max + 1;
+	} else if constexpr (std::is_same_v<T, std::string> ||
+			     std::is_same_v<T, std::string_view>) {
+		return 2 + 6 * val.size();
+	} else if constexpr (detail::is_optional<T>::value) {
+		return val ? jsonpuck::encoded_size_max(*val) : 4 + 1;
+	} else if constexpr (detail::is_vector<T>::value) {
+		size_t size = 2;
+		for (const auto &item : val)
+			size += 2 + jsonpuck::encoded_size_max(item);
+		return size;
+	} else {
+		constexpr size_t n = reflect<T>::count;
+		return detail::encoded_size_max_struct(
+			val, std::make_index_sequence<n>());
+	}
+}
+
+/**
+ * \brief Encode \a val to a JSON string.
+ * \param val - a value
+ * \return JSON text
+ */
+template <class T>
+std::string
+to_json(const T &val)
+{
+	std::string json(encoded_size_max(val), '\0');
+	char *end = jsonpuck::encode(&json[0], val);
+	json.resize(end - json.data());
+	return json;
+}
+
+} /* namespace jsonpuck */
+
+/** \cond false */
+#define JS_REFLECT_EXPAND(x) x
+#define JS_REFLECT_MEMBER(Struct, field) &Struct::field,
+#define JS_REFLECT_FOR_EACH_1(m, s, a) m(s, a)
+#define JS_REFLECT_FOR_EACH_2(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_1(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_3(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_2(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_4(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_3(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_5(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_4(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_6(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_5(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_7(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_6(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_8(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_7(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_9(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_8(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_10(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_9(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_11(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_10(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_12(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_11(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_13(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_12(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_14(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_13(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_15(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_14(m, s, __VA_ARGS__))
+#define JS_REFLECT_FOR_EACH_16(m, s, a, ...) m(s, a) \
+	JS_REFLECT_EXPAND(JS_REFLECT_FOR_EACH_15(m, s, __VA_ARGS__))
+#define JS_REFLECT_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, \
+			  _13, _14, _15, _16, name, ...) name
+#define JS_REFLECT_FOR_EACH(m, s, ...) \
+	JS_REFLECT_EXPAND(JS_REFLECT_SELECT(__VA_ARGS__, \
+		JS_REFLECT_FOR_EACH_16, JS_REFLECT_FOR_EACH_15, \
+		JS_REFLECT_FOR_EACH_14, JS_REFLECT_FOR_EACH_13, \
+		JS_REFLECT_FOR_EACH_12, JS_REFLECT_FOR_EACH_11, \
+		JS_REFLECT_FOR_EACH_10, JS_REFLECT_FOR_EACH_9, \
+		JS_REFLECT_FOR_EACH_8, JS_REFLECT_FOR_EACH_7, \
+		JS_REFLECT_FOR_EACH_6, JS_REFLECT_FOR_EACH_5, \
+		JS_REFLECT_FOR_EACH_4, JS_REFLECT_FOR_EACH_3, \
+		JS_REFLECT_FOR_EACH_2, JS_REFLECT_FOR_EACH_1)(m, s, __VA_ARGS__))
+/** \endcond */
+
+/**
+ * \brief Make struct \a Struct with fields \a ... (up to 16) encodable and
+ * decodable by jsonpuck::encode() and jsonpuck::decode(). Field names are
+ * used as map keys. Must be used at global namespace scope.
+ */
+#define JS_REFLECT(Struct, ...) \
+template <> \
+struct jsonpuck::reflect<Struct> { \
+	static constexpr bool defined = true; \
+	static constexpr size_t count = \
+		jsonpuck::detail::count_names(#__VA_ARGS__); \
+	static constexpr std::array<std::string_view, count> names = \
+		jsonpuck::detail::split_names<count>(#__VA_ARGS__); \
+	static constexpr jsonpuck::detail::key_table<count> table{names}; \
+	/* The trailing nullptr absorbs the last comma */ \
+	static constexpr auto fields = std::make_tuple( \
+		JS_REFLECT_FOR_EACH(JS_REFLECT_MEMBER, Struct, __VA_ARGS__) \
+		nullptr); \
+};
+
+#endif /* JSONPUCK_HPP_INCLUDED */
@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SIMD variants of the hot kernels.
+ *
+ * This file is compiled once per instruction set (see CMakeLists.txt)
+ * with JS_SIMD_ISA set to the variant suffix, e.g. -DJS_SIMD_ISA=avx2.
+ * jsonpuck.c provides the scalar variants and selects the best variant
+ * available on the running CPU.
+ */
+
+#include "jsonpuck.h"
+
+#include <immintrin.h>
+
+#if !defined(JS_SIMD_ISA)
+#error JS_SIMD_ISA must be defined
+#endif
+
+#define JS_SIMD_NAME2(name, isa) name##_##isa
+#define JS_SIMD_NAME1(name, isa) JS_SIMD_NAME2(name, isa)
+#define JS_SIMD(name) JS_SIMD_NAME1(name, JS_SIMD_ISA)
+
+const char *
+js_escape_scan_scalar(const char *s, const char *end);
+
+const char *
+JS_SIMD(js_escape_scan)(const char *s, const char *end);
+
+size_t
+js_fixint_run_u64_scalar(const char *s, size_t n, uint64_t *out);
+
+size_t
+JS_SIMD(js_fixint_run_u64)(const char *s, size_t n, uint64_t *out);
+
+size_t
+js_fixint_run_i64_scalar(const char *s, size_t n, int64_t *out);
+
+size_t
+JS_SIMD(js_fixint_run_i64)(const char *s, size_t n, int64_t *out);
+
+bool
+JS_SIMD(js_utf8_valid)(const char *s, const char *end);
+
+/*
+ * {{{ js_escape_scan()
+ */
+
+const char *
+JS_SIMD(js_escape_scan)(const char *s, const char *end)
+{
+#if defined(__AVX512BW__)
+	const __m512i ctrl64 = _mm512_set1_epi8(0x1f);
+	const __m512i quote64 = _mm512_set1_epi8('"');
+	const __m512i slash64 = _mm512_set1_epi8('/');
+	const __m512i bslash64 = _mm512_set1_epi8('\\');
+	const __m512i del64 = _mm512_set1_epi8(0x7f);
+	for (; end - s >= 64; s += 64) {
+		__m512i v = _mm512_loadu_si512((const void *) s);
+		__mmask64 mask = _mm512_cmple_epu8_mask(v, ctrl64) |
+			_mm512_cmpeq_epi8_mask(v, quote64) |
+			_mm512_cmpeq_epi8_mask(v, slash64) |
+			_mm512_cmpeq_epi8_mask(v, bslash64) |
+			_mm512_cmpeq_epi8_mask(v, del64);
+		if (mask != 0)
+			return s + __builtin_ctzll(mask);
+	}
+#endif
+#if defined(__AVX2__)
+	const __m256i ctrl = _mm256_set1_epi8(0x1f);
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	for (; end - s >= 32; s += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) s);
+		/* v <= 0x1f (unsigned) */
+		__m256i m = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl);
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, slash));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bslash));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, del));
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(m);
+		if (mask != 0)
+			return s + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE4_2__)
+	const __m128i ctrl16 = _mm_set1_epi8(0x1f);
+	const __m128i quote16 = _mm_set1_epi8('"');
+	const __m128i slash16 = _mm_set1_epi8('/');
+	const __m128i bslash16 = _mm_set1_epi8('\\');
+	const __m128i del16 = _mm_set1_epi8(0x7f);
+	for (; end - s >= 16; s += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) s);
+		__m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl16), ctrl16);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote16));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, slash16));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bslash16));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, del16));
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(m);
+		if (mask != 0)
+			return s + __builtin_ctz(mask);
+	}
+#endif
+	return js_escape_scan_scalar(s, end);
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ js_fixint_run_u64(), js_fixint_run_i64()
+ */
+
+/*
+ * Both kernels check eight tag bytes at a time and widen them to eight
+ * 64-bit integers; the scalar variant finishes the run.
+ */
+
+size_t
+JS_SIMD(js_fixint_run_u64)(const char *s, size_t n, uint64_t *out)
+{
+	size_t i = 0;
+	for (; n - i >= 8; i += 8) {
+		__m128i v = _mm_loadl_epi64((const __m128i *) (s + i));
+		/* The sign bit is set for bytes > 0x7f */
+		if ((_mm_movemask_epi8(v) & 0xff) != 0)
+			break;
+#if defined(__AVX512F__)
+		_mm512_storeu_si512((void *) (out + i), _mm512_cvtepu8_epi64(v));
+#elif defined(__AVX2__)
+		_mm256_storeu_si256((__m256i *) (out + i),
+				    _mm256_cvtepu8_epi64(v));
+		_mm256_storeu_si256((__m256i *) (out + i + 4),
+				    _mm256_cvtepu8_epi64(_mm_srli_si128(v, 4)));
+#else
+		_mm_storeu_si128((__m128i *) (out + i), _mm_cvtepu8_epi64(v));
+		_mm_storeu_si128((__m128i *) (out + i + 2),
+				 _mm_cvtepu8_epi64(_mm_srli_si128(v, 2)));
+		_mm_storeu_si128((__m128i *) (out + i + 4),
+				 _mm_cvtepu8_epi64(_mm_srli_si128(v, 4)));
+		_mm_storeu_si128((__m128i *) (out + i + 6),
+				 _mm_cvtepu8_epi64(_mm_srli_si128(v, 6)));
+#endif
+	}
+	return i + js_fixint_run_u64_scalar(s + i, n - i, out + i);
+}
+
+size_t
+JS_SIMD(js_fixint_run_i64)(const char *s, size_t n, int64_t *out)
+{
+	const __m128i min = _mm_set1_epi8(-33);
+	size_t i = 0;
+	for (; n - i >= 8; i += 8) {
+		__m128i v = _mm_loadl_epi64((const __m128i *) (s + i));
+		/* Fixints are >= -32 as int8_t */
+		if ((_mm_movemask_epi8(_mm_cmpgt_epi8(v, min)) & 0xff) != 0xff)
+			break;
+#if defined(__AVX512F__)
+		_mm512_storeu_si512((void *) (out + i), _mm512_cvtepi8_epi64(v));
+#elif defined(__AVX2__)
+		_mm256_storeu_si256((__m256i *) (out + i),
+				    _mm256_cvtepi8_epi64(v));
+		_mm256_storeu_si256((__m256i *) (out + i + 4),
+				    _mm256_cvtepi8_epi64(_mm_srli_si128(v, 4)));
+#else
+		_mm_storeu_si128((__m128i *) (out + i), _mm_cvtepi8_epi64(v));
+		_mm_storeu_si128((__m128i *) (out + i + 2),
+				 _mm_cvtepi8_epi64(_mm_srli_si128(v, 2)));
+		_mm_storeu_si128((__m128i *) (out + i + 4),
+				 _mm_cvtepi8_epi64(_mm_srli_si128(v, 4)));
+		_mm_storeu_si128((__m128i *) (out + i + 6),
+				 _mm_cvtepi8_epi64(_mm_srli_si128(v, 6)));
+#endif
+	}
+	return i + js_fixint_run_i64_scalar(s + i, n - i, out + i);
+}
+
+/*
+ * }}}
+ */
+
+/*
+ * {{{ js_utf8_valid()
+ */
+
+/*
+ * The lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte". Every pair of adjacent bytes is
+ * classified by three 16-entry tables indexed by the high nibble of the
+ * first byte, the low nibble of the first byte and the high nibble of
+ * the second byte. A bit survives the AND of the three lookups only for
+ * an invalid pair. Third and fourth bytes of a sequence are checked to
+ * be continuations separately.
+ */
+
+#define JS_UTF8_TOO_SHORT	(1 << 0)
+#define JS_UTF8_TOO_LONG	(1 << 1)
+#define JS_UTF8_OVERLONG_3	(1 << 2)
+#define JS_UTF8_TOO_LARGE	(1 << 3)
+#define JS_UTF8_SURROGATE	(1 << 4)
+#define JS_UTF8_OVERLONG_2	(1 << 5)
+#define JS_UTF8_TOO_LARGE_1000	(1 << 6)
+#define JS_UTF8_OVERLONG_4	(1 << 6)
+#define JS_UTF8_TWO_CONTS	(1 << 7)
+#define JS_UTF8_CARRY	(JS_UTF8_TOO_SHORT | JS_UTF8_TOO_LONG | \
+			 JS_UTF8_TWO_CONTS)
+
+/** By the high nibble of the first byte */
+static const uint8_t js_utf8_byte1_high[16] = {
+	/* 0xxx: ASCII */
+	JS_UTF8_TOO_LONG, JS_UTF8_TOO_LONG, JS_UTF8_TOO_LONG, JS_UTF8_TOO_LONG,
+	JS_UTF8_TOO_LONG, JS_UTF8_TOO_LONG, JS_UTF8_TOO_LONG, JS_UTF8_TOO_LONG,
+	/* 10xx: continuation */
+	JS_UTF8_TWO_CONTS, JS_UTF8_TWO_CONTS, JS_UTF8_TWO_CONTS,
+	JS_UTF8_TWO_CONTS,
+	/* 1100: two byte lead, 0xc0 and 0xc1 are overlong */
+	JS_UTF8_TOO_SHORT | JS_UTF8_OVERLONG_2,
+	/* 1101: two byte lead */
+	JS_UTF8_TOO_SHORT,
+	/* 1110: three byte lead */
+	JS_UTF8_TOO_SHORT | JS_UTF8_OVERLONG_3 | JS_UTF8_SURROGATE,
+	/* 1111: four byte lead */
+	JS_UTF8_TOO_SHORT | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000 |
+	JS_UTF8_OVERLONG_4,
+};
+
+/** By the low nibble of the first byte */
+static const uint8_t js_utf8_byte1_low[16] = {
+	/* 0000 */
+	JS_UTF8_CARRY | JS_UTF8_OVERLONG_3 | JS_UTF8_OVERLONG_2 |
+	JS_UTF8_OVERLONG_4,
+	/* 0001 */
+	JS_UTF8_CARRY | JS_UTF8_OVERLONG_2,
+	/* 001x */
+	JS_UTF8_CARRY,
+	JS_UTF8_CARRY,
+	/* 0100 */
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE,
+	/* 0101..1100 */
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	/* 1101: 0xed may start a surrogate */
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000 |
+	JS_UTF8_SURROGATE,
+	/* 111x */
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+	JS_UTF8_CARRY | JS_UTF8_TOO_LARGE | JS_UTF8_TOO_LARGE_1000,
+};
+
+/** By the high nibble of the second byte */
+static const uint8_t js_utf8_byte2_high[16] = {
+	/* 0xxx: ASCII */
+	JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT,
+	JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT,
+	JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT,
+	/* 1000 */
+	JS_UTF8_TOO_LONG | JS_UTF8_OVERLONG_2 | JS_UTF8_TWO_CONTS |
+	JS_UTF8_OVERLONG_3 | JS_UTF8_TOO_LARGE_1000 | JS_UTF8_OVERLONG_4,
+	/* 1001 */
+	JS_UTF8_TOO_LONG | JS_UTF8_OVERLONG_2 | JS_UTF8_TWO_CONTS |
+	JS_UTF8_OVERLONG_3 | JS_UTF8_TOO_LARGE,
+	/* 101x */
+	JS_UTF8_TOO_LONG | JS_UTF8_OVERLONG_2 | JS_UTF8_TWO_CONTS |
+	JS_UTF8_SURROGATE | JS_UTF8_TOO_LARGE,
+	JS_UTF8_TOO_LONG | JS_UTF8_OVERLONG_2 | JS_UTF8_TWO_CONTS |
+	JS_UTF8_SURROGATE | JS_UTF8_TOO_LARGE,
+	/* 11xx: lead */
+	JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT, JS_UTF8_TOO_SHORT,
+	JS_UTF8_TOO_SHORT,
+};
+
+/**
+ * Bytes above these limits in the last three positions of a block start
+ * a sequence which continues in the next block.
+ */
+static const uint8_t js_utf8_max_value[32] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf,
+};
+
+#if defined(__AVX2__)
+
+#define JS_UTF8_BLOCK 32
+typedef __m256i js_utf8_vec;
+
+/** The last \a n bytes of \a prev followed by \a in */
+#define js_utf8_prev(in, prev, n)						\
+	_mm256_alignr_epi8((in),						\
+			   _mm256_permute2x128_si256((prev), (in), 0x21),	\
+			   16 - (n))
+
+static inline js_utf8_vec
+js_utf8_table(const uint8_t *table)
+{
+	return _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *) table));
+}
+
+#define js_utf8_load(p) _mm256_loadu_si256((const __m256i *) (p))
+#define js_utf8_zero() _mm256_setzero_si256()
+#define js_utf8_set1(c) _mm256_set1_epi8((char) (c))
+#define js_utf8_and _mm256_and_si256
+#define js_utf8_or _mm256_or_si256
+#define js_utf8_xor _mm256_xor_si256
+#define js_utf8_subs _mm256_subs_epu8
+#define js_utf8_shuffle _mm256_shuffle_epi8
+#define js_utf8_srli16 _mm256_srli_epi16
+#define js_utf8_movemask _mm256_movemask_epi8
+#define js_utf8_is_zero(v) _mm256_testz_si256((v), (v))
+
+#else /* SSE4.2 */
+
+#define JS_UTF8_BLOCK 16
+typedef __m128i js_utf8_vec;
+
+#define js_utf8_prev(in, prev, n) _mm_alignr_epi8((in), (prev), 16 - (n))
+
+static inline js_utf8_vec
+js_utf8_table(const uint8_t *table)
+{
+	return _mm_loadu_si128((const __m128i *) table);
+}
+
+#define js_utf8_load(p) _mm_loadu_si128((const __m128i *) (p))
+#define js_utf8_zero() _mm_setzero_si128()
+#define js_utf8_set1(c) _mm_set1_epi8((char) (c))
+#define js_utf8_and _mm_and_si128
+#define js_utf8_or _mm_or_si128
+#define js_utf8_xor _mm_xor_si128
+#define js_utf8_subs _mm_subs_epu8
+#define js_utf8_shuffle _mm_shuffle_epi8
+#define js_utf8_srli16 _mm_srli_epi16
+#define js_utf8_movemask _mm_movemask_epi8
+#define js_utf8_is_zero(v) _mm_testz_si128((v), (v))
+
+#endif
+
+/** Error bits of the block \a in preceded by the block \a prev */
+static inline js_utf8_vec
+js_utf8_block_errors(js_utf8_vec in, js_utf8_vec prev)
+{
+	const js_utf8_vec nibble = js_utf8_set1(0x0f);
+	js_utf8_vec prev1 = js_utf8_prev(in, prev, 1);
+	js_utf8_vec e = js_utf8_shuffle(js_utf8_table(js_utf8_byte1_high),
+		js_utf8_and(js_utf8_srli16(prev1, 4), nibble));
+	e = js_utf8_and(e, js_utf8_shuffle(js_utf8_table(js_utf8_byte1_low),
+		js_utf8_and(prev1, nibble)));
+	e = js_utf8_and(e, js_utf8_shuffle(js_utf8_table(js_utf8_byte2_high),
+		js_utf8_and(js_utf8_srli16(in, 4), nibble)));
+	/* 0x80 where a third or a fourth byte of a sequence is expected */
+	js_utf8_vec prev2 = js_utf8_prev(in, prev, 2);
+	js_utf8_vec prev3 = js_utf8_prev(in, prev, 3);
+	js_utf8_vec must23 = js_utf8_or(
+		js_utf8_subs(prev2, js_utf8_set1(0xe0 - 0x80)),
+		js_utf8_subs(prev3, js_utf8_set1(0xf0 - 0x80)));
+	must23 = js_utf8_and(must23, js_utf8_set1(0x80));
+	return js_utf8_xor(must23, e);
+}
+
+bool
+JS_SIMD(js_utf8_valid)(const char *s, const char *end)
+{
+	const js_utf8_vec max_value =
+		js_utf8_load(js_utf8_max_value + 32 - JS_UTF8_BLOCK);
+	js_utf8_vec prev = js_utf8_zero();
+	js_utf8_vec incomplete = js_utf8_zero();
+	js_utf8_vec error = js_utf8_zero();
+	char tail[JS_UTF8_BLOCK];
+	while (s < end) {
+		js_utf8_vec in;
+		if (end - s >= JS_UTF8_BLOCK) {
+			in = js_utf8_load(s);
+			s += JS_UTF8_BLOCK;
+		} else {
+			/* Zero padding is ASCII, which ends any sequence */
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, s, end - s);
+			in = js_utf8_load(tail);
+			s = end;
+		}
+		if (js_utf8_movemask(in) == 0) {
+			/* ASCII: only a sequence from the previous block fails */
+			error = js_utf8_or(error, incomplete);
+			incomplete = js_utf8_zero();
+		} else {
+			error = js_utf8_or(error, js_utf8_block_errors(in, prev));
+			incomplete = js_utf8_subs(in, max_value);
+		}
+		prev = in;
+	}
+	error = js_utf8_or(error, incomplete);
+	return js_utf8_is_zero(error);
+}
+
+#undef js_utf8_prev
+#undef js_utf8_load
+#undef js_utf8_zero
+#undef js_utf8_set1
+#undef js_utf8_and
+#undef js_utf8_or
+#undef js_utf8_xor
+#undef js_utf8_subs
+#undef js_utf8_shuffle
+#undef js_utf8_srli16
+#undef js_utf8_movemask
+#undef js_utf8_is_zero
+
+/*
+ * }}}
+ */
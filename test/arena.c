@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static void
+test_arena(void)
+{
+	struct js_arena arena;
+	js_arena_create(&arena, NULL, 64);
+	bool aligned = true, intact = true;
+	char *prev = NULL;
+	size_t prev_size = 0;
+	for (size_t size = 1; size < 300; size += 7) {
+		char *p = js_arena_alloc(&arena, size);
+		if (p == NULL || (uintptr_t) p % JS_ARENA_ALIGN != 0) {
+			aligned = false;
+			continue;
+		}
+		/* Filling a block must not touch the previous one */
+		memset(p, (int) size, size);
+		if (prev != NULL && prev[prev_size - 1] != (char) prev_size)
+			intact = false;
+		prev = p;
+		prev_size = size;
+	}
+	ok(aligned, "allocations are aligned");
+	ok(intact, "allocations do not overlap");
+	ok(js_arena_alloc(&arena, 0) != NULL, "0 bytes");
+	ok(js_arena_alloc(&arena, SIZE_MAX) == NULL, "SIZE_MAX bytes");
+	ok(js_arena_alloc(&arena, SIZE_MAX - JS_ARENA_ALIGN) == NULL,
+	   "too large to round up");
+
+	char *big = js_arena_alloc(&arena, 1 << 16);
+	ok(big != NULL, "larger than a chunk");
+	memset(big, 0, 1 << 16);
+
+	uint64_t generation = arena.generation;
+	js_arena_reset(&arena);
+	ok(arena.generation != generation, "reset bumps the generation");
+	char *p = js_arena_alloc(&arena, 1 << 16);
+	ok(p != NULL, "the largest chunk is reused");
+	js_arena_destroy(&arena);
+}
+
+int
+main(void)
+{
+	test_arena();
+	check_plan();
+}
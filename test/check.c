@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static int
+check(const char *data, const char *end, const struct js_check_opts *opts)
+{
+	const char *pos = data;
+	int rc = js_check_opts(&pos, end, opts);
+	if (rc == 0 && pos != end)
+		return -1;
+	return rc != 0;
+}
+
+static void
+test_check_opts(void)
+{
+	/* [[1], "abc", {"k": 2}] */
+	const char *doc = MP(0x93, 0x91, 0x01, 0xa3, 'a', 'b', 'c',
+			     0x81, 0xa1, 'k', 0x02);
+	const char *end = doc + 11;
+	struct js_check_opts opts;
+
+	is(check(doc, end, NULL), 0, "no limits");
+	memset(&opts, 0, sizeof(opts));
+	is(check(doc, end, &opts), 0, "zero limits are no limits");
+
+	opts.max_depth = 2;
+	is(check(doc, end, &opts), 0, "max_depth == depth");
+	opts.max_depth = 1;
+	is(check(doc, end, &opts), 1, "max_depth < depth");
+
+	memset(&opts, 0, sizeof(opts));
+	opts.max_elements = 7;
+	is(check(doc, end, &opts), 0, "max_elements == elements");
+	opts.max_elements = 6;
+	is(check(doc, end, &opts), 1, "max_elements < elements");
+
+	memset(&opts, 0, sizeof(opts));
+	opts.max_str_len = 3;
+	is(check(doc, end, &opts), 0, "max_str_len == longest string");
+	opts.max_str_len = 2;
+	is(check(doc, end, &opts), 1, "max_str_len < longest string");
+
+	memset(&opts, 0, sizeof(opts));
+	opts.check_utf8 = true;
+	is(check(doc, end, &opts), 0, "valid UTF-8");
+	const char *bad = MP(0x91, 0xa2, 0xc0, 0x80);
+	is(check(bad, bad + 4, NULL), 0, "UTF-8 is not checked by default");
+	is(check(bad, bad + 4, &opts), 1, "invalid UTF-8");
+	const char *bin = MP(0x91, 0xc4, 0x02, 0xc0, 0x80);
+	is(check(bin, bin + 5, &opts), 0, "bins are not checked for UTF-8");
+
+	/* An array32 claiming 2^32 - 1 elements in 5 bytes */
+	const char *hostile = MP(0xdd, 0xff, 0xff, 0xff, 0xff, 0x01);
+	is(check(hostile, hostile + 6, NULL), 1, "hostile header");
+
+	/* JS_CHECK_MAX_DEPTH always applies */
+	static char deep[JS_CHECK_MAX_DEPTH + 2];
+	memset(deep, 0x91, sizeof(deep));
+	deep[JS_CHECK_MAX_DEPTH] = 0x01;
+	is(check(deep, deep + JS_CHECK_MAX_DEPTH + 1, NULL), 0,
+	   "JS_CHECK_MAX_DEPTH levels");
+	deep[JS_CHECK_MAX_DEPTH] = (char) 0x91;
+	deep[JS_CHECK_MAX_DEPTH + 1] = 0x01;
+	is(check(deep, deep + JS_CHECK_MAX_DEPTH + 2, NULL), 1,
+	   "deeper than JS_CHECK_MAX_DEPTH");
+
+	is(check(doc, end - 1, NULL), 1, "truncated");
+}
+
+int
+main(void)
+{
+	test_check_opts();
+	check_plan();
+}
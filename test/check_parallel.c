@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+enum { ROWS = 20000 };
+
+/**
+ * [["row 0", 0], ["row 1", 1], ...], \a mark is set to the string of
+ * a row near the end
+ */
+static size_t
+pack_rows(char *buf, char **mark)
+{
+	char *w = js_pack_array(buf, ROWS);
+	for (uint32_t i = 0; i < ROWS; i++) {
+		char str[16];
+		int len = snprintf(str, sizeof(str), "row %u", (unsigned) i);
+		w = js_pack_array(w, 2);
+		if (i == ROWS - 10)
+			*mark = w + 1;
+		w = js_pack_str(w, str, len);
+		w = js_pack_uint(w, i);
+	}
+	return w - buf;
+}
+
+/** Check that js_check_parallel() agrees with js_check_opts() */
+static void
+check_parallel(const char *buf, size_t size,
+	       const struct js_check_opts *opts, bool valid, const char *name)
+{
+	const char *pos = buf;
+	int expected = js_check_opts(&pos, buf + size, opts);
+	is(expected == 0, valid, "%s: js_check_opts()", name);
+	bool same = true;
+	for (int nthreads = 1; nthreads <= 4; nthreads++) {
+		pos = buf;
+		int rc = js_check_parallel(&pos, buf + size, opts, nthreads);
+		if ((rc != 0) != (expected != 0) ||
+		    (rc == 0 && pos != buf + size))
+			same = false;
+	}
+	ok(same, "%s: js_check_parallel() == js_check_opts()", name);
+}
+
+static void
+test_check_parallel(void)
+{
+	static char buf[ROWS * 16];
+	char *s = NULL;
+	size_t size = pack_rows(buf, &s);
+	struct js_check_opts opts;
+	memset(&opts, 0, sizeof(opts));
+	opts.check_utf8 = true;
+	check_parallel(buf, size, NULL, true, "no opts");
+	check_parallel(buf, size, &opts, true, "utf8");
+
+	opts.max_depth = 2;
+	check_parallel(buf, size, &opts, true, "max_depth");
+	opts.max_depth = 1;
+	check_parallel(buf, size, &opts, false, "max_depth exceeded");
+
+	opts.max_depth = 0;
+	opts.max_elements = 1 + 3 * ROWS;
+	check_parallel(buf, size, &opts, true, "max_elements");
+	opts.max_elements--;
+	check_parallel(buf, size, &opts, false,
+		       "max_elements exceeded");
+	opts.max_elements = 0;
+
+	/* Break UTF-8 in a string near the end */
+	*s = (char) 0xc0;
+	check_parallel(buf, size, &opts, false, "utf8 error");
+	*s = 'r';
+
+	check_parallel(buf, size - 1, &opts, false, "truncated");
+
+	/* An element nested deeper than JS_CHECK_MAX_DEPTH */
+	char *w = js_pack_array(buf, ROWS);
+	for (uint32_t i = 0; i < JS_CHECK_MAX_DEPTH; i++)
+		w = js_pack_array(w, 1);
+	w = js_pack_uint(w, 1);
+	for (uint32_t i = 1; i < ROWS; i++)
+		w = js_pack_uint(w, i);
+	size = w - buf;
+	check_parallel(buf, size, NULL, false, "too deep");
+	check_parallel(buf, size, &opts, false, "too deep, utf8");
+}
+
+int
+main(void)
+{
+	test_check_parallel();
+	check_plan();
+}
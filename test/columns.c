@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static void
+test_columns(void)
+{
+	/* [{"ts": 1, "v": 0.5}, {"v": 2, "ts": 2}, [], {"ts": "x"}] */
+	char doc[64];
+	char *w = js_pack_array(doc, 4);
+	w = js_pack_map(w, 2);
+	w = js_pack_str(w, "ts", 2);
+	w = js_pack_uint(w, 1);
+	w = js_pack_str(w, "v", 1);
+	w = js_pack_double(w, 0.5);
+	w = js_pack_map(w, 2);
+	w = js_pack_str(w, "v", 1);
+	w = js_pack_uint(w, 2);
+	w = js_pack_str(w, "ts", 2);
+	w = js_pack_uint(w, 2);
+	w = js_pack_array(w, 0);
+	w = js_pack_map(w, 1);
+	w = js_pack_str(w, "ts", 2);
+	w = js_pack_str(w, "x", 1);
+
+	struct js_column columns[] = {
+		{ .key = "ts", .key_len = 2, .type = JS_COLUMN_UINT },
+		{ .key = "v", .key_len = 1, .type = JS_COLUMN_DOUBLE },
+	};
+	struct js_arena arena;
+	js_arena_create(&arena, NULL, 1024);
+	const char *pos = doc;
+	uint32_t rows;
+	is(js_decode_columns(&pos, columns, 2, &arena, &rows), 0, "decode");
+	is(pos, (const char *) w, "data advanced");
+	is(rows, 4u, "rows");
+	const uint64_t *ts = columns[0].values.u64;
+	const double *v = columns[1].values.f64;
+	ok(ts[0] == 1 && ts[1] == 2 && ts[2] == 0 && ts[3] == 0, "ts values");
+	ok(v[0] == 0.5 && v[1] == 2.0 && v[2] == 0 && v[3] == 0,
+	   "v values");
+	is(columns[0].validity[0], 0x03, "ts validity");
+	is(columns[1].validity[0], 0x03, "v validity");
+	is(columns[0].null_count, 2u, "ts null_count");
+	is(columns[1].null_count, 2u, "v null_count");
+
+	const char *empty = MP(0x90);
+	pos = empty;
+	is(js_decode_columns(&pos, columns, 2, &arena, &rows), 0,
+	   "decode an empty array");
+	ok(rows == 0 && columns[0].values.u64 == NULL &&
+	   columns[0].validity == NULL && columns[0].null_count == 0,
+	   "empty columns");
+
+	const char *not_array = MP(0x80);
+	pos = not_array;
+	is(js_decode_columns(&pos, columns, 2, &arena, &rows), -1,
+	   "not an array");
+	js_arena_destroy(&arena);
+}
+
+int
+main(void)
+{
+	test_columns();
+	check_plan();
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static int
+sign(int r)
+{
+	return (r > 0) - (r < 0);
+}
+
+static void
+test_compare_int_uint(void)
+{
+	/* int8 7 vs fixint 5 */
+	is(sign(js_compare(MP(0xd0, 0x07), MP(0x05))), 1, "int 7 > uint 5");
+	is(sign(js_compare(MP(0x05), MP(0xd0, 0x07))), -1, "uint 5 < int 7");
+	is(js_compare(MP(0xd0, 0x05), MP(0x05)), 0, "int 5 == uint 5");
+	is(js_compare(MP(0xd1, 0x00, 0x00), MP(0x00)), 0, "int16 0 == uint 0");
+	is(js_compare(MP(0xd0, 0x05), MP(0xcc, 0x05)), 0,
+	   "int 5 == uint8 5");
+	is(sign(js_compare(MP(0xd0, 0xff), MP(0x00))), -1, "int -1 < uint 0");
+	is(sign(js_compare(MP(0xd0, 0x05), MP(0xd0, 0xff))), 1,
+	   "int 5 > int -1");
+
+	char dbl[16];
+	js_pack_double(dbl, 5.0);
+	is(js_compare(MP(0xd0, 0x05), dbl), 0, "int 5 == double 5.0");
+	js_pack_double(dbl, 6.5);
+	is(sign(js_compare(MP(0xd0, 0x07), dbl)), 1, "int 7 > double 6.5");
+}
+
+static void
+test_canonicalize_int_keys(void)
+{
+	/* {7 (as int8): nil, 5: nil} sorts as {5: nil, 7: nil} */
+	const char *src = MP(0x82, 0xd0, 0x07, 0xc0, 0x05, 0xc0);
+	const char *expected = MP(0x82, 0x05, 0xc0, 0x07, 0xc0);
+	struct js_arena arena;
+	js_arena_create(&arena, NULL, 1024);
+	char out[16];
+	const char *pos = src;
+	size_t n = js_canonicalize(&pos, out, JS_CANONICAL_SORT_KEYS, &arena);
+	is(n, (size_t) 5, "canonical size");
+	ok(memcmp(out, expected, 5) == 0, "int keys sorted as numbers");
+	is(pos, src + 6, "data advanced");
+	js_arena_destroy(&arena);
+}
+
+static void
+test_canonicalize_arena(void)
+{
+	/* {2: {4: nil, 3: nil}, 1: nil} */
+	const char *src = MP(0x82, 0x02, 0x82, 0x04, 0xc0, 0x03, 0xc0,
+			     0x01, 0xc0);
+	const char *expected = MP(0x82, 0x01, 0xc0, 0x02, 0x82, 0x03, 0xc0,
+				  0x04, 0xc0);
+	struct js_arena arena;
+	js_arena_create(&arena, NULL, 1024);
+	void *kept = js_arena_alloc(&arena, 8);
+	char *mark = arena.pos;
+	bool same = true;
+	for (int i = 0; i < 1000; i++) {
+		char out[16];
+		const char *pos = src;
+		size_t n = js_canonicalize(&pos, NULL, JS_CANONICAL_SORT_KEYS,
+					   &arena);
+		pos = src;
+		n = js_canonicalize(&pos, out, JS_CANONICAL_SORT_KEYS, &arena);
+		same = same && n == 9 && memcmp(out, expected, n) == 0;
+	}
+	ok(same, "nested maps sorted");
+	is(arena.pos, mark, "sort memory given back to the arena");
+	ok(kept != NULL && (char *) kept < mark, "caller memory kept");
+	js_arena_destroy(&arena);
+}
+
+int
+main(void)
+{
+	test_compare_int_uint();
+	test_canonicalize_int_keys();
+	test_canonicalize_arena();
+	check_plan();
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static void
+test_cursor(void)
+{
+	/* {"users": [{"name": "a"}, {"name": "b"}], "n": 2} */
+	const char *doc = MP(0x82, 0xa5, 'u', 's', 'e', 'r', 's', 0x92,
+			     0x81, 0xa4, 'n', 'a', 'm', 'e', 0xa1, 'a',
+			     0x81, 0xa4, 'n', 'a', 'm', 'e', 0xa1, 'b',
+			     0xa1, 'n', 0x02);
+	struct js_arena arena;
+	js_arena_create(&arena, NULL, 256);
+	struct js_cursor root;
+	js_cursor_create(&root, doc);
+	is(js_cursor_type(&root), JS_MAP, "root type");
+	is(js_cursor_size(&root), 2u, "root size");
+
+	struct js_cursor *users = js_cursor_find(&root, "users", 5, &arena);
+	ok(users != NULL && js_cursor_type(users) == JS_ARRAY, "find users");
+	is(js_cursor_size(users), 2u, "users size");
+	struct js_cursor *user = js_cursor_child(users, 0, &arena);
+	char names[8] = "";
+	for (size_t len = 0; user != NULL;
+	     user = js_cursor_next_sibling(user)) {
+		struct js_cursor *name = js_cursor_find(user, "name", 4,
+							&arena);
+		const char *pos = name->data;
+		uint32_t n;
+		const char *str = js_decode_str(&pos, &n);
+		memcpy(names + len, str, n);
+		len += n;
+	}
+	is(strcmp(names, "ab"), 0, "siblings: %s", names);
+	ok(js_cursor_child(users, 2, &arena) == NULL, "no such child");
+	ok(js_cursor_find(&root, "none", 4, &arena) == NULL, "no such key");
+
+	struct js_cursor *key = js_cursor_key(&root, 1, &arena);
+	ok(key != NULL && js_cursor_type(key) == JS_STR, "key");
+	struct js_cursor *n = js_cursor_next_sibling(key);
+	ok(n == NULL, "the last key has no sibling");
+	n = js_cursor_child(&root, 1, &arena);
+	ok(n != NULL && js_decode_uint(&(const char *) { n->data }) == 2,
+	   "value of the last pair");
+
+	/* Children of the root are rebuilt after the arena is reset */
+	js_arena_reset(&arena);
+	users = js_cursor_find(&root, "users", 5, &arena);
+	ok(users != NULL && js_cursor_size(users) == 2,
+	   "find after js_arena_reset()");
+	user = js_cursor_child(users, 1, &arena);
+	ok(user != NULL && js_cursor_type(user) == JS_MAP,
+	   "child after js_arena_reset()");
+	js_arena_destroy(&arena);
+}
+
+int
+main(void)
+{
+	test_cursor();
+	check_plan();
+}
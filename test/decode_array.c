@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+enum { COUNT = 1000 };
+
+/** A deterministic pseudo-random sequence */
+static uint64_t
+next_random(uint64_t *state)
+{
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *state >> 11;
+}
+
+/**
+ * Pack \a COUNT integers: long runs of fixints, broken by wider
+ * encodings (and negative values when \a negative is set) at random.
+ */
+static size_t
+pack_ints(char *buf, int64_t *values, bool negative)
+{
+	uint64_t state = 42;
+	char *w = buf;
+	for (uint32_t i = 0; i < COUNT; i++) {
+		uint64_t r = next_random(&state);
+		int64_t v;
+		if (r % 8 != 0)
+			v = (int64_t) (r % 128);
+		else if (r % 3 == 0)
+			v = (int64_t) (r % 70000);
+		else if (negative)
+			v = -(int64_t) (r % 100000);
+		else
+			v = (int64_t) (r >> 20);
+		values[i] = v;
+		w = v < 0 ? js_pack_int(w, v) : js_pack_uint(w, (uint64_t) v);
+	}
+	return w - buf;
+}
+
+static void
+test_decode_u64(const char *isa)
+{
+	static char buf[COUNT * 9];
+	static int64_t values[COUNT];
+	static uint64_t out[COUNT];
+	size_t size = pack_ints(buf, values, false);
+	const char *pos = buf;
+	is(js_decode_array_u64(&pos, out, COUNT), (uint32_t) COUNT,
+	   "%s: u64 count", isa);
+	is(pos, buf + size, "%s: u64 data advanced", isa);
+	bool same = true;
+	for (uint32_t i = 0; i < COUNT; i++)
+		same = same && out[i] == (uint64_t) values[i];
+	ok(same, "%s: u64 values", isa);
+
+	/* A negative value in the middle of a fixint run stops decoding */
+	const char *stop = MP(0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+			      0x09, 0xff, 0x0a);
+	pos = stop;
+	is(js_decode_array_u64(&pos, out, 11), 9u, "%s: u64 stops", isa);
+	is(pos, stop + 9, "%s: u64 points to the value", isa);
+	/* Non-negative JS_INT is not JS_UINT */
+	const char *int8 = MP(0x01, 0xd0, 0x05);
+	pos = int8;
+	is(js_decode_array_u64(&pos, out, 2), 1u, "%s: u64 stops at int8",
+	   isa);
+}
+
+static void
+test_decode_i64(const char *isa)
+{
+	static char buf[COUNT * 9];
+	static int64_t values[COUNT];
+	static int64_t out[COUNT];
+	size_t size = pack_ints(buf, values, true);
+	const char *pos = buf;
+	is(js_decode_array_i64(&pos, out, COUNT), (uint32_t) COUNT,
+	   "%s: i64 count", isa);
+	is(pos, buf + size, "%s: i64 data advanced", isa);
+	bool same = true;
+	for (uint32_t i = 0; i < COUNT; i++)
+		same = same && out[i] == values[i];
+	ok(same, "%s: i64 values", isa);
+
+	char big[16];
+	char *w = js_pack_uint(js_pack_int(big, -1), (uint64_t) INT64_MAX + 1);
+	pos = big;
+	is(js_decode_array_i64(&pos, out, 2), 1u,
+	   "%s: i64 stops above INT64_MAX", isa);
+	is(pos, (const char *) w - 9, "%s: i64 points to the value", isa);
+}
+
+static void
+test_decode_f64(const char *isa)
+{
+	static char buf[COUNT * 9];
+	static double out[COUNT];
+	double expected[COUNT];
+	char *w = buf;
+	for (uint32_t i = 0; i < COUNT; i++) {
+		if (i % 50 == 7) {
+			w = js_pack_int(w, -(int64_t) i);
+			expected[i] = -(double) i;
+		} else if (i % 50 == 9) {
+			*w++ = (char) 0xca;
+			float f = 0.25f * i;
+			memcpy(w, &f, sizeof(f));
+			w += sizeof(f);
+			expected[i] = 0.25 * i;
+		} else if (i % 50 == 11) {
+			w = js_pack_uint(w, i);
+			expected[i] = i;
+		} else {
+			expected[i] = i + 0.5;
+			w = js_pack_double(w, expected[i]);
+		}
+	}
+	const char *pos = buf;
+	is(js_decode_array_f64(&pos, out, COUNT), (uint32_t) COUNT,
+	   "%s: f64 count", isa);
+	is(pos, (const char *) w, "%s: f64 data advanced", isa);
+	ok(memcmp(out, expected, sizeof(expected)) == 0, "%s: f64 values",
+	   isa);
+
+	w = js_pack_double(buf, 1.5);
+	js_pack_str(w, "x", 1);
+	pos = buf;
+	is(js_decode_array_f64(&pos, out, 2), 1u, "%s: f64 stops at a str",
+	   isa);
+	is(pos, (const char *) w, "%s: f64 points to the value", isa);
+}
+
+int
+main(void)
+{
+	for (int isa = 0; isa < JS_ISA_MAX; isa++) {
+		if (js_isa_set((enum js_isa) isa) != 0)
+			continue;
+		const char *name = js_isa_name((enum js_isa) isa);
+		test_decode_u64(name);
+		test_decode_i64(name);
+		test_decode_f64(name);
+	}
+	check_plan();
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+/** {"k0": base + 0, "k1": base + 1, ...} with \a n pairs */
+static char *
+pack_flat(char *w, uint32_t n, uint64_t base)
+{
+	w = js_pack_map(w, n);
+	for (uint32_t i = 0; i < n; i++) {
+		char key[16];
+		int len = snprintf(key, sizeof(key), "k%u", (unsigned) i);
+		w = js_pack_str(w, key, len);
+		w = js_pack_uint(w, base + i);
+	}
+	return w;
+}
+
+/** {"a": {"a": ... {"x": leaf} ...}} nested \a depth times */
+static char *
+pack_deep(char *w, uint32_t depth, uint64_t leaf)
+{
+	for (uint32_t i = 0; i < depth; i++) {
+		w = js_pack_map(w, 1);
+		w = js_pack_str(w, "a", 1);
+	}
+	w = js_pack_map(w, 1);
+	w = js_pack_str(w, "x", 1);
+	return js_pack_uint(w, leaf);
+}
+
+/** Check that js_diff() and js_merge_apply() round-trip \a a to \a b */
+static void
+check_roundtrip(const char *a, const char *b, const char *name)
+{
+	static char patch[1 << 16], merged[1 << 16];
+	size_t size = js_diff(a, b, NULL);
+	ok(size <= sizeof(patch), "%s: patch size", name);
+	memset(patch, 0xc1, sizeof(patch));
+	is(js_diff(a, b, patch), size, "%s: patch written", name);
+	is((unsigned char) patch[size], 0xc1, "%s: no write past the end",
+	   name);
+	const char *end = patch;
+	is(js_check(&end, patch + size), 0, "%s: patch is valid", name);
+	is(end, patch + size, "%s: patch is one value", name);
+
+	size_t merged_size = js_merge_apply(a, patch, NULL);
+	memset(merged, 0xc1, sizeof(merged));
+	is(js_merge_apply(a, patch, merged), merged_size, "%s: merged", name);
+	is((unsigned char) merged[merged_size], 0xc1,
+	   "%s: no merge past the end", name);
+	/* Added keys go last, so compare regardless of key order */
+	is(js_hash_unordered(merged, 0), js_hash_unordered(b, 0),
+	   "%s: merge(a, diff(a, b)) == b", name);
+}
+
+static void
+test_diff_flat(void)
+{
+	static char a[4096], b[4096];
+	pack_flat(a, 100, 0);
+	pack_flat(b, 100, 0);
+	is(js_diff(a, b, NULL), (size_t) 1, "equal maps give {}");
+
+	/* Every value changes, the patch needs a map16 header */
+	pack_flat(b, 100, 1000);
+	check_roundtrip(a, b, "flat changed");
+
+	/* Keys removed */
+	pack_flat(b, 40, 0);
+	check_roundtrip(a, b, "flat removed");
+}
+
+static void
+test_diff_nested(void)
+{
+	static char a[4096], b[4096];
+	pack_deep(a, 64, 1);
+	pack_deep(b, 64, 2);
+	check_roundtrip(a, b, "deep");
+
+	char *w = js_pack_map(b, 2);
+	w = js_pack_str(w, "a", 1);
+	w = pack_flat(w, 20, 7);
+	w = js_pack_str(w, "b", 1);
+	pack_deep(w, 3, 1);
+	w = js_pack_map(a, 2);
+	w = js_pack_str(w, "b", 1);
+	pack_deep(w, 3, 1);
+	check_roundtrip(a, b, "nested added");
+	check_roundtrip(b, a, "nested removed");
+
+	/* A nested map which differs only in encoding is left out */
+	const char *x = MP(0x81, 0xa1, 'm', 0x81, 0xa1, 'n', 0x05);
+	char y[16] = { (char) 0x81, (char) 0xa1, 'm', (char) 0xde };
+	uint16_t one = 1;
+	memcpy(y + 4, &one, sizeof(one));
+	memcpy(y + 6, MP(0xa1, 'n', 0x05), 3);
+	char patch[8];
+	is(js_diff(x, y, patch), (size_t) 1, "encoding-only change: size");
+	is((unsigned char) patch[0], 0x80, "encoding-only change: {}");
+}
+
+static void
+test_merge_remove(void)
+{
+	/* {"a": 1, "b": 2} + {"a": nil, "c": 3} = {"b": 2, "c": 3} */
+	const char *target = MP(0x82, 0xa1, 'a', 0x01, 0xa1, 'b', 0x02);
+	const char *patch = MP(0x82, 0xa1, 'a', 0xc0, 0xa1, 'c', 0x03);
+	const char *expected = MP(0x82, 0xa1, 'b', 0x02, 0xa1, 'c', 0x03);
+	char out[16];
+	is(js_merge_apply(target, patch, out), (size_t) 7, "merge size");
+	ok(memcmp(out, expected, 7) == 0, "merge result");
+}
+
+int
+main(void)
+{
+	test_diff_flat();
+	test_diff_nested();
+	test_merge_remove();
+	check_plan();
+}
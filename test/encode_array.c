@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include <inttypes.h>
+#include <math.h>
+
+#include "test.h"
+
+/** Format \a n values with printf() to compare with */
+static void
+expect_u64(char *buf, const uint64_t *values, uint32_t n)
+{
+	char *w = buf;
+	*w++ = '[';
+	for (uint32_t i = 0; i < n; i++)
+		w += sprintf(w, "%s%" PRIu64, i > 0 ? ", " : "", values[i]);
+	strcpy(w, "]");
+}
+
+static void
+expect_i64(char *buf, const int64_t *values, uint32_t n)
+{
+	char *w = buf;
+	*w++ = '[';
+	for (uint32_t i = 0; i < n; i++)
+		w += sprintf(w, "%s%" PRId64, i > 0 ? ", " : "", values[i]);
+	strcpy(w, "]");
+}
+
+static void
+test_encode_ints(void)
+{
+	static const uint64_t u[] = {
+		0, 9, 10, 99, 100, 101, 999, 1000, 123456789,
+		UINT32_MAX, (uint64_t) UINT32_MAX + 1, 10000000000000000000ULL,
+		UINT64_MAX,
+	};
+	uint32_t n = sizeof(u) / sizeof(u[0]);
+	char out[1024], expected[1024];
+	char *end = js_encode_array_u64(out, u, n);
+	*end = '\0';
+	expect_u64(expected, u, n);
+	is(strcmp(out, expected), 0, "u64: %s", out);
+	ok((size_t) (end - out) <= js_sizeof_array_u64(n), "u64 size bound");
+
+	static const int64_t i[] = {
+		0, -1, 1, -9, -10, 99, -100, INT32_MIN, INT32_MAX,
+		INT64_MAX, INT64_MIN,
+	};
+	n = sizeof(i) / sizeof(i[0]);
+	end = js_encode_array_i64(out, i, n);
+	*end = '\0';
+	expect_i64(expected, i, n);
+	is(strcmp(out, expected), 0, "i64: %s", out);
+	ok((size_t) (end - out) <= js_sizeof_array_i64(n), "i64 size bound");
+
+	end = js_encode_array_u64(out, NULL, 0);
+	*end = '\0';
+	is(strcmp(out, "[]"), 0, "empty array");
+
+	/* Every power of ten and its neighbours */
+	bool same = true;
+	uint64_t p = 1;
+	for (int k = 0; k < 20; k++, p *= 10) {
+		uint64_t v[3] = { p - 1, p, p + 1 };
+		end = js_encode_array_u64(out, v, 3);
+		*end = '\0';
+		expect_u64(expected, v, 3);
+		same = same && strcmp(out, expected) == 0;
+	}
+	ok(same, "powers of ten");
+}
+
+static void
+test_encode_f64(void)
+{
+	static const double d[] = {
+		0, 1, -1, 0.5, 12.25, -0.001, 1e-6, 123456.789012, 1e15,
+		1e300, 5e-324, 0.1, 1.0 / 3, -0.0, 999999999.5,
+	};
+	uint32_t n = sizeof(d) / sizeof(d[0]);
+	char out[2048];
+	char *end = js_encode_array_f64(out, d, n);
+	*end = '\0';
+	ok((size_t) (end - out) <= js_sizeof_array_f64(n), "f64 size bound");
+
+	/* Every value is read back exactly */
+	bool exact = true;
+	const char *pos = out + 1;
+	for (uint32_t i = 0; i < n; i++) {
+		char *next;
+		double v = strtod(pos, &next);
+		if (next == pos || memcmp(&v, &d[i], sizeof(v)) != 0)
+			exact = false;
+		pos = next + (i + 1 < n ? 2 : 0);
+	}
+	ok(exact && *pos == ']', "f64 round trip: %s", out);
+
+	static const double simple[] = { 1, -2, 0.25, 12.5 };
+	end = js_encode_array_f64(out, simple, 4);
+	*end = '\0';
+	is(strcmp(out, "[1, -2, 0.25, 12.5]"), 0, "short values: %s", out);
+
+	const double special[] = { NAN, INFINITY, -INFINITY };
+	end = js_encode_array_f64(out, special, 3);
+	*end = '\0';
+	is(strcmp(out, "[null, null, null]"), 0, "NaN and infinities: %s",
+	   out);
+}
+
+int
+main(void)
+{
+	test_encode_ints();
+	test_encode_f64();
+	check_plan();
+}
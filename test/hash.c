@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static void
+test_hash_numbers(void)
+{
+	uint64_t h5 = js_hash(MP(0x05), 0);
+	is(js_hash(MP(0xd0, 0x05), 0), h5, "int 5 hashes as uint 5");
+	is(js_hash(MP(0xcc, 0x05), 0), h5, "uint8 5 hashes as uint 5");
+	char i16[3] = { (char) 0xd1 };
+	int16_t five = 5;
+	memcpy(i16 + 1, &five, sizeof(five));
+	is(js_hash(i16, 0), h5, "int16 5 hashes as uint 5");
+	char dbl[16];
+	js_pack_double(dbl, 5.0);
+	is(js_hash(dbl, 0), h5, "double 5.0 hashes as uint 5");
+	ok(js_hash(MP(0xd0, 0x07), 0) != h5, "int 7 differs from uint 5");
+	is(js_hash(MP(0xd0, 0xff), 0), js_hash(MP(0xff), 0),
+	   "int8 -1 hashes as fixint -1");
+	is(js_hash_unordered(MP(0xd0, 0x05), 0), js_hash_unordered(MP(0x05), 0),
+	   "unordered: int 5 hashes as uint 5");
+}
+
+static void
+test_hash_unordered(void)
+{
+	/* {1: 2, 3: 4} and {3: 4, 1: 2} */
+	const char *a = MP(0x82, 0x01, 0x02, 0x03, 0x04);
+	const char *b = MP(0x82, 0x03, 0x04, 0x01, 0x02);
+	/* {1: 4, 3: 2} */
+	const char *c = MP(0x82, 0x01, 0x04, 0x03, 0x02);
+	is(js_hash_unordered(a, 7), js_hash_unordered(b, 7),
+	   "key order is ignored");
+	ok(js_hash(a, 7) != js_hash(b, 7), "js_hash() keeps key order");
+	ok(js_hash_unordered(a, 7) != js_hash_unordered(c, 7),
+	   "pairs are hashed as a whole");
+	ok(js_hash_unordered(a, 1) != js_hash_unordered(a, 2),
+	   "seed changes the hash");
+}
+
+int
+main(void)
+{
+	test_hash_numbers();
+	test_hash_unordered();
+	check_plan();
+}
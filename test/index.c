@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+enum { RECORDS = 100 };
+
+static void
+test_record_index(void)
+{
+	/* A log of records {"n": i} */
+	static char log[RECORDS * 16];
+	static const char *records[RECORDS];
+	char *w = log;
+	for (uint32_t i = 0; i < RECORDS; i++) {
+		records[i] = w;
+		w = js_pack_map(w, 1);
+		w = js_pack_str(w, "n", 1);
+		w = js_pack_uint(w, i * 1000);
+	}
+	size_t size = w - log;
+
+	struct js_record_index index;
+	js_record_index_create(&index, NULL, 8);
+	/* The last record is cut in the middle, as if being appended */
+	size_t half = records[RECORDS - 1] - log + 2;
+	is(js_record_index_update(&index, log, half), (int64_t) RECORDS - 1,
+	   "records before a truncated tail");
+	is(js_record_index_update(&index, log, size), (int64_t) 1,
+	   "the tail once it is complete");
+	is(js_record_index_update(&index, log, size), (int64_t) 0,
+	   "nothing new");
+	is(js_record_index_update(&index, log, half), (int64_t) -1,
+	   "a log which has shrunk");
+	is(index.count, (uint64_t) RECORDS, "count");
+
+	bool found = true;
+	for (uint32_t i = 0; i < RECORDS; i++) {
+		if (js_record_index_seek(&index, log, i) != records[i])
+			found = false;
+		uint64_t offset = records[i] - log + 1;
+		if (js_record_index_find(&index, log, offset) != i)
+			found = false;
+	}
+	ok(found, "seek and find every record");
+	ok(js_record_index_seek(&index, log, RECORDS) == NULL,
+	   "seek past the end");
+	is(js_record_index_find(&index, log, size), UINT64_MAX,
+	   "find past the end");
+
+	FILE *file = tmpfile();
+	is(js_record_index_save(&index, file), 0, "save");
+	struct js_record_index loaded;
+	js_record_index_create(&loaded, NULL, 0);
+	rewind(file);
+	is(js_record_index_load(&loaded, file, size), 0, "load");
+	ok(loaded.count == index.count && loaded.scanned == index.scanned &&
+	   loaded.stride == index.stride, "loaded header");
+	ok(js_record_index_seek(&loaded, log, 42) == records[42],
+	   "seek in the loaded index");
+	js_record_index_destroy(&loaded);
+
+	js_record_index_create(&loaded, NULL, 0);
+	rewind(file);
+	is(js_record_index_load(&loaded, file, size - 1), -1,
+	   "load for a shorter log");
+	js_record_index_destroy(&loaded);
+
+	/*
+	 * The log is rewritten with the same size: str32 headers claiming
+	 * 4 GB everywhere must not be followed beyond the log.
+	 */
+	char *other = malloc(size);
+	memset(other, 0xdb, size);
+	js_record_index_create(&loaded, NULL, 0);
+	rewind(file);
+	is(js_record_index_load(&loaded, file, size), 0,
+	   "load for a rewritten log");
+	bool rejected = true;
+	for (uint32_t i = 0; i < RECORDS; i++) {
+		if (js_record_index_seek(&loaded, other, i) != NULL ||
+		    js_record_index_find(&loaded, other, records[i] - log) !=
+		    UINT64_MAX)
+			rejected = false;
+	}
+	ok(rejected, "seek and find fail on a rewritten log");
+
+	/* Records shifted by one byte: whatever is found is in the log */
+	memcpy(other, log + 1, size - 1);
+	bool bounded = true;
+	for (uint32_t i = 0; i < RECORDS; i++) {
+		const char *record = js_record_index_seek(&loaded, other, i);
+		if (record == NULL)
+			continue;
+		const char *pos = record;
+		if (record < other || js_check(&pos, other + size) != 0)
+			bounded = false;
+	}
+	ok(bounded, "records of a shifted log are within the log");
+	js_record_index_destroy(&loaded);
+	free(other);
+	fclose(file);
+
+	file = tmpfile();
+	fputs("not an index", file);
+	rewind(file);
+	js_record_index_create(&loaded, NULL, 0);
+	is(js_record_index_load(&loaded, file, size), -1, "load garbage");
+	js_record_index_destroy(&loaded);
+	fclose(file);
+	js_record_index_destroy(&index);
+}
+
+int
+main(void)
+{
+	test_record_index();
+	check_plan();
+}
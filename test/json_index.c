@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+/** Check that \a text is indexed at \a expected positions */
+static void
+check_index(const char *text, const uint64_t *expected, ptrdiff_t count,
+	    const char *name)
+{
+	uint64_t index[64];
+	size_t len = strlen(text);
+	ptrdiff_t n = js_json_index(text, len, index);
+	is(n, count, "%s: count", name);
+	ok(n == count && (n <= 0 ||
+			  memcmp(index, expected, n * sizeof(*index)) == 0),
+	   "%s: positions", name);
+	for (int nthreads = 1; nthreads <= 3; nthreads++) {
+		uint64_t par[64];
+		ptrdiff_t m = js_json_index_parallel(text, len, par, nthreads);
+		ok(m == n && (n <= 0 || memcmp(par, index,
+					       n * sizeof(*par)) == 0),
+		   "%s: %d threads", name, nthreads);
+	}
+}
+
+static void
+test_json_index(void)
+{
+	static const uint64_t obj[] = { 0, 1, 4, 6, 7, 10, 11, 13, 14 };
+	check_index("{\"a\":1,\"b\":[2]}", obj, 9, "object");
+
+	/* Structural characters and escaped quotes inside strings */
+	static const uint64_t str[] = { 0, 1, 13, 15 };
+	check_index("[\"{,:\\\"]\\\\\\\"\",1]", str, 4, "escapes");
+
+	check_index("", NULL, 0, "empty");
+	check_index("[\"open", NULL, -1, "unterminated string");
+}
+
+static void
+test_json_index_large(void)
+{
+	/* Strings of various lengths with escapes, across block borders */
+	enum { LEN = 1 << 20 };
+	char *text = malloc(LEN);
+	size_t len = 0;
+	text[len++] = '[';
+	for (uint32_t i = 0; len + 64 < LEN; i++) {
+		len += sprintf(text + len, "{\"k%u\":\"%.*s\\\"]\",\"v\":[%u]},",
+			       (unsigned) i, (int) (i % 37),
+			       "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx",
+			       (unsigned) i);
+	}
+	text[len - 1] = ']';
+	uint64_t *index = malloc(len * sizeof(*index));
+	uint64_t *par = malloc(len * sizeof(*par));
+	ptrdiff_t n = js_json_index(text, len, index);
+	ok(n > 0, "large text");
+	bool ordered = true;
+	for (ptrdiff_t i = 1; i < n; i++) {
+		if (index[i] <= index[i - 1])
+			ordered = false;
+	}
+	ok(ordered, "positions ascend");
+	for (int nthreads = 2; nthreads <= 4; nthreads++) {
+		ptrdiff_t m = js_json_index_parallel(text, len, par, nthreads);
+		ok(m == n && memcmp(par, index, n * sizeof(*par)) == 0,
+		   "large text: %d threads", nthreads);
+	}
+	free(par);
+	free(index);
+	free(text);
+}
+
+int
+main(void)
+{
+	test_json_index();
+	test_json_index_large();
+	check_plan();
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/** Write \a size bytes to a new temporary file, return its path */
+static char *
+write_tmp(const char *data, size_t size)
+{
+	static char path[64];
+	strcpy(path, "/tmp/jsonpuck-mmap-XXXXXX");
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return NULL;
+	if (size > 0 && write(fd, data, size) != (ssize_t) size) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	return path;
+}
+
+static void
+test_mmap_reader(void)
+{
+	/* Documents {"n": i, "pad": "..."} spanning a few read-ahead windows */
+	enum { PAD = 1000 };
+	uint32_t count = 3 * JS_MMAP_READAHEAD / PAD;
+	char *log = malloc((size_t) count * (PAD + 32));
+	static char pad[PAD];
+	memset(pad, 'p', sizeof(pad));
+	char *w = log;
+	for (uint32_t i = 0; i < count; i++) {
+		w = js_pack_map(w, 2);
+		w = js_pack_str(w, "n", 1);
+		w = js_pack_uint(w, i);
+		w = js_pack_str(w, "pad", 3);
+		w = js_pack_str(w, pad, PAD);
+	}
+	size_t size = w - log;
+	char *path = write_tmp(log, size);
+	ok(path != NULL, "write a log");
+
+	struct js_mmap_reader reader;
+	is(js_mmap_reader_open(&reader, path), 0, "open");
+	is(reader.size, size, "size");
+	const char *doc, *doc_end, *first = NULL;
+	uint32_t n = 0;
+	bool same = true;
+	int rc;
+	while ((rc = js_mmap_reader_next(&reader, &doc, &doc_end)) > 0) {
+		if (n == 0)
+			first = doc;
+		size_t offset = doc - reader.data;
+		if (offset >= size || doc_end - doc > (ptrdiff_t) (PAD + 32) ||
+		    memcmp(doc, log + offset, doc_end - doc) != 0)
+			same = false;
+		n++;
+	}
+	is(rc, 0, "end of file");
+	is(n, count, "documents");
+	ok(same, "documents match the log");
+	/* Released pages are faulted in again */
+	ok(first != NULL && memcmp(first, log, 16) == 0,
+	   "the first document is still readable");
+	js_mmap_reader_close(&reader);
+	unlink(path);
+
+	/* A truncated last document */
+	path = write_tmp(log, size - 1);
+	is(js_mmap_reader_open(&reader, path), 0, "open a truncated log");
+	n = 0;
+	while ((rc = js_mmap_reader_next(&reader, &doc, &doc_end)) > 0)
+		n++;
+	is(rc, -1, "truncated tail");
+	is(n, count - 1, "documents before the tail");
+	js_mmap_reader_close(&reader);
+	unlink(path);
+
+	path = write_tmp(log, 0);
+	is(js_mmap_reader_open(&reader, path), 0, "open an empty file");
+	is(js_mmap_reader_next(&reader, &doc, &doc_end), 0, "no documents");
+	js_mmap_reader_close(&reader);
+	unlink(path);
+
+	errno = 0;
+	is(js_mmap_reader_open(&reader, "/nonexistent/jsonpuck.log"), -1,
+	   "open a missing file");
+	is(errno, ENOENT, "errno");
+	free(log);
+}
+
+int
+main(void)
+{
+	test_mmap_reader();
+	check_plan();
+}
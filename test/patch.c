@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static const char *doc;
+
+/** Apply a patch to doc and compare with \a expected */
+static bool
+patch_is(enum js_patch_op op, const char *path, const char *value,
+	 const char *expected, size_t expected_size)
+{
+	char out[64];
+	size_t size = js_patch(doc, NULL, op, path, value);
+	if (size != expected_size || size > sizeof(out))
+		return false;
+	return js_patch(doc, out, op, path, value) == size &&
+	       memcmp(out, expected, size) == 0;
+}
+
+static void
+test_patch(void)
+{
+	/* {"a": [1, 2], "b": nil} */
+	doc = MP(0x82, 0xa1, 'a', 0x92, 0x01, 0x02, 0xa1, 'b', 0xc0);
+
+	ok(patch_is(JS_PATCH_SET, "/a/1", MP(0x05),
+		    MP(0x82, 0xa1, 'a', 0x92, 0x01, 0x05, 0xa1, 'b', 0xc0), 9),
+	   "set an array element");
+	ok(patch_is(JS_PATCH_SET, "/b", MP(0x07),
+		    MP(0x82, 0xa1, 'a', 0x92, 0x01, 0x02, 0xa1, 'b', 0x07), 9),
+	   "set an existing key");
+	ok(patch_is(JS_PATCH_SET, "/c", MP(0xc3),
+		    MP(0x83, 0xa1, 'a', 0x92, 0x01, 0x02, 0xa1, 'b', 0xc0,
+		       0xa1, 'c', 0xc3), 12),
+	   "set a missing key");
+	ok(patch_is(JS_PATCH_SET, "/a~1b", MP(0x01),
+		    MP(0x83, 0xa1, 'a', 0x92, 0x01, 0x02, 0xa1, 'b', 0xc0,
+		       0xa3, 'a', '/', 'b', 0x01), 14),
+	   "set an escaped key");
+	ok(patch_is(JS_PATCH_SET, "", MP(0xc0), MP(0xc0), 1),
+	   "set the root");
+
+	ok(patch_is(JS_PATCH_INSERT, "/a/0", MP(0x09),
+		    MP(0x82, 0xa1, 'a', 0x93, 0x09, 0x01, 0x02, 0xa1, 'b',
+		       0xc0), 10),
+	   "insert before an element");
+	ok(patch_is(JS_PATCH_INSERT, "/a/-", MP(0x09),
+		    MP(0x82, 0xa1, 'a', 0x93, 0x01, 0x02, 0x09, 0xa1, 'b',
+		       0xc0), 10),
+	   "append to an array");
+
+	ok(patch_is(JS_PATCH_DELETE, "/a/0", NULL,
+		    MP(0x82, 0xa1, 'a', 0x91, 0x02, 0xa1, 'b', 0xc0), 8),
+	   "delete an element");
+	ok(patch_is(JS_PATCH_DELETE, "/b", NULL,
+		    MP(0x81, 0xa1, 'a', 0x92, 0x01, 0x02), 6),
+	   "delete the last pair");
+	ok(patch_is(JS_PATCH_DELETE, "/a", NULL,
+		    MP(0x81, 0xa1, 'b', 0xc0), 4),
+	   "delete a container");
+
+	is(js_patch(doc, NULL, JS_PATCH_INSERT, "/b", MP(0x01)), SIZE_MAX,
+	   "insert an existing key");
+	is(js_patch(doc, NULL, JS_PATCH_SET, "/a/2", MP(0x01)), SIZE_MAX,
+	   "set past the end");
+	is(js_patch(doc, NULL, JS_PATCH_SET, "/a/01", MP(0x01)), SIZE_MAX,
+	   "leading zero");
+	is(js_patch(doc, NULL, JS_PATCH_SET, "/x/y", MP(0x01)), SIZE_MAX,
+	   "missing parent");
+	is(js_patch(doc, NULL, JS_PATCH_SET, "/b/0", MP(0x01)), SIZE_MAX,
+	   "scalar parent");
+	is(js_patch(doc, NULL, JS_PATCH_DELETE, "/c", NULL), SIZE_MAX,
+	   "delete a missing key");
+	is(js_patch(doc, NULL, JS_PATCH_DELETE, "", NULL), SIZE_MAX,
+	   "delete the root");
+	is(js_patch(doc, NULL, JS_PATCH_SET, "a", MP(0x01)), SIZE_MAX,
+	   "malformed path");
+}
+
+static void
+test_patch_header_growth(void)
+{
+	/* fixarray of 15 nils becomes array16 of 16 elements */
+	char src[16], expected[19], out[19];
+	src[0] = (char) 0x9f;
+	memset(src + 1, 0xc0, 15);
+	expected[0] = (char) 0xdc;
+	uint16_t len = 16;
+	memcpy(expected + 1, &len, sizeof(len));
+	expected[3] = 0x01;
+	memset(expected + 4, 0xc0, 15);
+	size_t size = js_patch(src, NULL, JS_PATCH_INSERT, "/0", MP(0x01));
+	is(size, sizeof(expected), "array16 size");
+	js_patch(src, out, JS_PATCH_INSERT, "/0", MP(0x01));
+	ok(memcmp(out, expected, sizeof(expected)) == 0, "array16 header");
+	const char *pos = out;
+	ok(js_check(&pos, out + size) == 0 && pos == out + size,
+	   "patched document is valid");
+}
+
+int
+main(void)
+{
+	test_patch();
+	test_patch_header_growth();
+	check_plan();
+}
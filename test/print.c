@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+static void
+test_snprint(void)
+{
+	/* {"a": [1, -2, nil, true], "b": "q\""} */
+	const char *doc = MP(0x82, 0xa1, 'a', 0x94, 0x01, 0xfe, 0xc0, 0xc3,
+			     0xa1, 'b', 0xa2, 'q', '"');
+	const char *expected = "{\"a\": [1, -2, null, true], \"b\": \"q\\\"\"}";
+	size_t len = strlen(expected);
+	char buf[64];
+	is(js_snprint(buf, sizeof(buf), doc), len, "length");
+	is(strcmp(buf, expected), 0, "output: %s", buf);
+	is(js_snprint(NULL, 0, doc), len, "length without a buffer");
+	memset(buf, 'x', sizeof(buf));
+	is(js_snprint(buf, 6, doc), len, "length of truncated output");
+	ok(memcmp(buf, expected, 5) == 0 && buf[5] == '\0' && buf[6] == 'x',
+	   "truncated output");
+}
+
+/** Read \a file from the start into a malloc()ed string */
+static char *
+slurp(FILE *file, size_t *size)
+{
+	fflush(file);
+	*size = ftell(file);
+	char *buf = malloc(*size + 1);
+	rewind(file);
+	if (fread(buf, 1, *size, file) != *size)
+		*size = 0;
+	buf[*size] = '\0';
+	return buf;
+}
+
+static void
+test_fprint_parallel(void)
+{
+	/* Several slices worth of ["row 0", {"n": 0}, ...] */
+	uint32_t count = 3 * JS_PRINT_SLICE_SIZE / 8;
+	char *doc = malloc(5 + (size_t) count * 24);
+	char *w = js_pack_array(doc, count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (i % 2 == 0) {
+			char str[16];
+			int len = snprintf(str, sizeof(str), "row %u",
+					   (unsigned) i);
+			w = js_pack_str(w, str, len);
+		} else {
+			w = js_pack_map(w, 1);
+			w = js_pack_str(w, "n", 1);
+			w = js_pack_uint(w, i);
+		}
+	}
+
+	FILE *file = tmpfile();
+	ok(file != NULL, "tmpfile");
+	is(js_fprint(file, doc), 0, "js_fprint()");
+	size_t ref_size;
+	char *ref = slurp(file, &ref_size);
+	fclose(file);
+
+	for (int nthreads = 0; nthreads <= 3; nthreads++) {
+		file = tmpfile();
+		is(js_fprint_parallel(file, doc, nthreads, NULL), 0,
+		   "js_fprint_parallel(%d)", nthreads);
+		size_t size;
+		char *out = slurp(file, &size);
+		ok(size == ref_size && memcmp(out, ref, size) == 0,
+		   "%d threads: same output as js_fprint()", nthreads);
+		free(out);
+		fclose(file);
+	}
+
+	/* A scalar goes through js_fprint() */
+	file = tmpfile();
+	is(js_fprint_parallel(file, MP(0x05), 2, NULL), 0, "scalar");
+	size_t size;
+	char *out = slurp(file, &size);
+	is(strcmp(out, "5"), 0, "scalar output: %s", out);
+	free(out);
+	fclose(file);
+	free(ref);
+	free(doc);
+}
+
+int
+main(void)
+{
+	test_snprint();
+	test_fprint_parallel();
+	check_plan();
+}
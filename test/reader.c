@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+/* [1, {"a": [2, 3], "b": nil, 4: 5}, 6] */
+static const unsigned char doc[] = {
+	0x93, 0x01, 0x83, 0xa1, 'a', 0x92, 0x02, 0x03, 0xa1, 'b', 0xc0,
+	0x04, 0x05, 0x06
+};
+
+static void
+test_reader(void)
+{
+	const char *end = (const char *) doc + sizeof(doc);
+	struct js_reader reader;
+	struct js_token token;
+	char buf[256];
+	size_t len = 0;
+	int rc;
+	js_reader_init(&reader, (const char *) doc, end);
+	while ((rc = js_reader_next_token(&reader, &token)) == 1) {
+		len += snprintf(buf + len, sizeof(buf) - len, "%u%s%d/%u ",
+				(unsigned) token.depth,
+				token.is_key ? "k" : ":", (int) token.type,
+				(unsigned) (token.type == JS_UINT ?
+					    token.u : token.len));
+	}
+	is(rc, 0, "read");
+	is(reader.pos, end, "reader.pos");
+	char expected[256];
+	snprintf(expected, sizeof(expected),
+		 "0:%d/3 1:%d/1 1:%d/3 2k%d/1 2:%d/2 3:%d/2 3:%d/3 2k%d/1 "
+		 "2:%d/0 2k%d/4 2:%d/5 1:%d/6 ",
+		 JS_ARRAY, JS_UINT, JS_MAP, JS_STR, JS_ARRAY, JS_UINT, JS_UINT,
+		 JS_STR, JS_NIL, JS_UINT, JS_UINT, JS_UINT);
+	is(strcmp(buf, expected), 0, "tokens: %s", buf);
+
+	/* Skip the map after its token */
+	js_reader_init(&reader, (const char *) doc, end);
+	for (int i = 0; i < 3; i++)
+		js_reader_next_token(&reader, &token);
+	is(token.type, JS_MAP, "at the map");
+	is(js_reader_skip(&reader), 0, "skip");
+	is(js_reader_next_token(&reader, &token), 1, "next after skip");
+	ok(token.depth == 1 && token.type == JS_UINT && token.u == 6,
+	   "the element after the map");
+	is(js_reader_next_token(&reader, &token), 0, "end");
+
+	js_reader_init(&reader, (const char *) doc, end - 1);
+	while ((rc = js_reader_next_token(&reader, &token)) == 1)
+		;
+	is(rc, -1, "truncated");
+
+	static char deep[JS_READER_MAX_DEPTH + 2];
+	memset(deep, 0x91, sizeof(deep));
+	deep[JS_READER_MAX_DEPTH + 1] = 0x01;
+	js_reader_init(&reader, deep, deep + sizeof(deep));
+	while ((rc = js_reader_next_token(&reader, &token)) == 1)
+		;
+	is(rc, -1, "deeper than JS_READER_MAX_DEPTH");
+}
+
+int
+main(void)
+{
+	test_reader();
+	check_plan();
+}
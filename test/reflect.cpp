@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.hpp>
+
+#include "test.h"
+
+struct Point {
+	int16_t x;
+	uint16_t y;
+	std::string label;
+};
+JS_REFLECT(Point, x, y, label)
+
+struct Shape {
+	std::vector<Point> points;
+	std::optional<double> area;
+	std::string_view name;
+	bool closed;
+};
+JS_REFLECT(Shape, points, area, name, closed)
+
+/** Decode \a data of \a size bytes into \a val, checking the whole input */
+template <class T>
+static bool
+decode_all(const unsigned char *data, size_t size, T &val)
+{
+	const char *pos = (const char *) data;
+	const char *end = pos + size;
+	const char *check = pos;
+	if (js_check(&check, end) != 0 || check != end)
+		return false;
+	return jsonpuck::decode(&pos, val) && pos == end;
+}
+
+static void
+test_integers()
+{
+	int16_t i16;
+	uint16_t u16;
+	uint8_t u8;
+
+	/* int32 100000 does not fit int16_t */
+	static const unsigned char big[] = { 0xd2, 0, 0, 0, 0 };
+	unsigned char buf[5];
+	memcpy(buf, big, sizeof(buf));
+	int32_t n = 100000;
+	memcpy(buf + 1, &n, sizeof(n));
+	ok(!decode_all(buf, sizeof(buf), i16), "int32 100000 to int16_t");
+	n = -100000;
+	memcpy(buf + 1, &n, sizeof(n));
+	ok(!decode_all(buf, sizeof(buf), i16), "int32 -100000 to int16_t");
+	n = -30000;
+	memcpy(buf + 1, &n, sizeof(n));
+	ok(decode_all(buf, sizeof(buf), i16) && i16 == -30000,
+	   "int32 -30000 to int16_t");
+
+	/* Non-negative JS_INT for unsigned fields */
+	static const unsigned char five[] = { 0xd0, 0x05 };
+	ok(decode_all(five, sizeof(five), u16) && u16 == 5,
+	   "int8 5 to uint16_t");
+	static const unsigned char minus[] = { 0xff };
+	ok(!decode_all(minus, sizeof(minus), u16), "-1 to uint16_t");
+	n = 300;
+	memcpy(buf + 1, &n, sizeof(n));
+	ok(!decode_all(buf, sizeof(buf), u8), "int32 300 to uint8_t");
+
+	unsigned char u300[3] = { 0xcd };
+	uint16_t n16 = 300;
+	memcpy(u300 + 1, &n16, sizeof(n16));
+	ok(!decode_all(u300, sizeof(u300), u8), "uint16 300 to uint8_t");
+}
+
+static void
+test_struct()
+{
+	/*
+	 * {"name": "tri", "points": [{"x": -1, "y": 2, "label": "a"}],
+	 *  "closed": true, "extra": nil}
+	 */
+	static const unsigned char doc[] = {
+		0x84,
+		0xa4, 'n', 'a', 'm', 'e', 0xa3, 't', 'r', 'i',
+		0xa6, 'p', 'o', 'i', 'n', 't', 's', 0x91,
+		0x83, 0xa1, 'x', 0xff, 0xa1, 'y', 0x02,
+		0xa5, 'l', 'a', 'b', 'e', 'l', 0xa1, 'a',
+		0xa6, 'c', 'l', 'o', 's', 'e', 'd', 0xc3,
+		0xa5, 'e', 'x', 't', 'r', 'a', 0xc0,
+	};
+	Shape shape{};
+	ok(decode_all(doc, sizeof(doc), shape), "decode a struct");
+	ok(shape.name == "tri" && shape.closed && !shape.area,
+	   "scalar fields");
+	ok(shape.points.size() == 1 && shape.points[0].x == -1 &&
+	   shape.points[0].y == 2 && shape.points[0].label == "a",
+	   "nested fields");
+
+	std::string json = jsonpuck::to_json(shape);
+	const char *expected = "{\"points\": [{\"x\": -1, \"y\": 2, "
+		"\"label\": \"a\"}], \"area\": null, \"name\": \"tri\", "
+		"\"closed\": true}";
+	ok(json == expected, "to_json: %s", json.c_str());
+	ok(json.size() <= jsonpuck::encoded_size_max(shape),
+	   "encoded_size_max");
+
+	/* "points" is not an array */
+	static const unsigned char bad[] = {
+		0x81, 0xa6, 'p', 'o', 'i', 'n', 't', 's', 0x01,
+	};
+	ok(!decode_all(bad, sizeof(bad), shape), "type mismatch");
+}
+
+int
+main()
+{
+	test_integers();
+	test_struct();
+	check_plan();
+}
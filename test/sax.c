@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+/** Callbacks append events to a log, e.g. "[2 1 {1 k 5 } ]" */
+struct sax_log {
+	char buf[256];
+	size_t len;
+	/** return JS_SAX_SKIP for this key or container size */
+	const char *skip_key;
+	uint32_t skip_size;
+	/** return this action from the value callback */
+	int value_action;
+};
+
+static void
+sax_append(struct sax_log *log, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(log->buf + log->len, sizeof(log->buf) - log->len,
+			  fmt, ap);
+	va_end(ap);
+	/* Deep documents only check the result, keep the log truncated */
+	if (n > 0 && log->len + n < sizeof(log->buf))
+		log->len += n;
+	else
+		log->len = sizeof(log->buf) - 1;
+}
+
+static int
+on_start_array(void *ctx, uint32_t size)
+{
+	struct sax_log *log = ctx;
+	sax_append(log, "[%u ", (unsigned) size);
+	return size == log->skip_size ? JS_SAX_SKIP : JS_SAX_OK;
+}
+
+static int
+on_end_array(void *ctx)
+{
+	sax_append(ctx, "] ");
+	return JS_SAX_OK;
+}
+
+static int
+on_start_map(void *ctx, uint32_t size)
+{
+	struct sax_log *log = ctx;
+	sax_append(log, "{%u ", (unsigned) size);
+	return size == log->skip_size ? JS_SAX_SKIP : JS_SAX_OK;
+}
+
+static int
+on_end_map(void *ctx)
+{
+	sax_append(ctx, "} ");
+	return JS_SAX_OK;
+}
+
+static int
+on_key(void *ctx, const char *str, uint32_t len)
+{
+	struct sax_log *log = ctx;
+	if (str == NULL) {
+		sax_append(log, "key:");
+		return JS_SAX_OK;
+	}
+	sax_append(log, "%.*s:", (int) len, str);
+	if (log->skip_key != NULL && strlen(log->skip_key) == len &&
+	    memcmp(log->skip_key, str, len) == 0)
+		return JS_SAX_SKIP;
+	return JS_SAX_OK;
+}
+
+static int
+on_value(void *ctx, const char *data)
+{
+	struct sax_log *log = ctx;
+	switch (js_typeof(*data)) {
+	case JS_UINT:
+		sax_append(log, "%llu ",
+			   (unsigned long long) js_decode_uint(&data));
+		break;
+	case JS_NIL:
+		sax_append(log, "nil ");
+		break;
+	default:
+		sax_append(log, "? ");
+		break;
+	}
+	return log->value_action;
+}
+
+static const struct js_sax_handler handler = {
+	.start_array = on_start_array,
+	.end_array = on_end_array,
+	.start_map = on_start_map,
+	.key = on_key,
+	.end_map = on_end_map,
+	.value = on_value,
+};
+
+/* [1, {"a": [2, 3], "b": nil, 4: 5}, 6] */
+static const unsigned char doc[] = {
+	0x93, 0x01, 0x83, 0xa1, 'a', 0x92, 0x02, 0x03, 0xa1, 'b', 0xc0,
+	0x04, 0x05, 0x06
+};
+
+static int
+parse(struct sax_log *log, const char *end)
+{
+	const char *pos = (const char *) doc;
+	log->len = 0;
+	log->buf[0] = '\0';
+	int rc = js_sax_parse(&pos, end, &handler, log);
+	if (rc == 0 && pos != end)
+		return -2;
+	return rc;
+}
+
+static void
+test_sax(void)
+{
+	const char *end = (const char *) doc + sizeof(doc);
+	struct sax_log log;
+	memset(&log, 0, sizeof(log));
+	is(parse(&log, end), 0, "parse");
+	is(strcmp(log.buf, "[3 1 {3 a:[2 2 3 ] b:nil key:4 5 } 6 ] "), 0,
+	   "events: %s", log.buf);
+
+	log.skip_key = "a";
+	is(parse(&log, end), 0, "skip a key");
+	is(strcmp(log.buf, "[3 1 {3 a:b:nil key:4 5 } 6 ] "), 0,
+	   "events: %s", log.buf);
+
+	log.skip_key = NULL;
+	log.skip_size = 2;
+	is(parse(&log, end), 0, "skip a container");
+	is(strcmp(log.buf, "[3 1 {3 a:[2 b:nil key:4 5 } 6 ] "), 0,
+	   "events: %s", log.buf);
+
+	log.skip_size = 0;
+	log.value_action = JS_SAX_STOP;
+	is(parse(&log, end), JS_SAX_STOP, "stop");
+	is(strcmp(log.buf, "[3 1 "), 0, "events: %s", log.buf);
+
+	log.value_action = JS_SAX_ERROR;
+	is(parse(&log, end), -1, "error");
+
+	log.value_action = JS_SAX_OK;
+	is(parse(&log, end - 1), -1, "truncated");
+	log.skip_size = 3;
+	is(parse(&log, end - 1), -1, "truncated in a skipped container");
+
+	static char deep[JS_SAX_MAX_DEPTH + 2];
+	memset(deep, 0x91, sizeof(deep));
+	deep[JS_SAX_MAX_DEPTH] = 0x01;
+	const char *pos = deep;
+	is(js_sax_parse(&pos, deep + JS_SAX_MAX_DEPTH + 1, &handler, &log), 0,
+	   "JS_SAX_MAX_DEPTH levels");
+	deep[JS_SAX_MAX_DEPTH] = (char) 0x91;
+	deep[JS_SAX_MAX_DEPTH + 1] = 0x01;
+	pos = deep;
+	is(js_sax_parse(&pos, deep + JS_SAX_MAX_DEPTH + 2, &handler, &log), -1,
+	   "deeper than JS_SAX_MAX_DEPTH");
+
+	static const struct js_sax_handler empty;
+	pos = (const char *) doc;
+	is(js_sax_parse(&pos, end, &empty, NULL), 0, "no callbacks");
+	is(pos, end, "data advanced");
+}
+
+int
+main(void)
+{
+	test_sax();
+	check_plan();
+}
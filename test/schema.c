@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+#define person_schema(FIELD) \
+	FIELD(uint, id) \
+	FIELD(int, delta) \
+	FIELD(str, name) \
+	FIELD(bool, admin)
+JS_SCHEMA_DEFINE(person, person_schema)
+
+static void
+test_schema(void)
+{
+	/* {"id": 7 (as int8), "name": "ann", "extra": [1], "delta": -2} */
+	const char *doc = MP(0x84, 0xa2, 'i', 'd', 0xd0, 0x07,
+			     0xa4, 'n', 'a', 'm', 'e', 0xa3, 'a', 'n', 'n',
+			     0xa5, 'e', 'x', 't', 'r', 'a', 0x91, 0x01,
+			     0xa5, 'd', 'e', 'l', 't', 'a', 0xfe);
+	struct person p;
+	const char *pos = doc;
+	is(person_decode(&pos, &p), 0, "decode");
+	ok(p.js_has.id && p.id == 7, "non-negative int for a uint field");
+	ok(p.js_has.delta && p.delta == -2, "int field");
+	ok(p.js_has.name && p.name.len == 3 &&
+	   memcmp(p.name.str, "ann", 3) == 0, "str field");
+	ok(!p.js_has.admin && !p.admin, "absent field");
+
+	char json[128];
+	*person_encode(json, &p) = '\0';
+	is(strcmp(json, "{\"id\": 7, \"delta\": -2, \"name\": \"ann\"}"), 0,
+	   "absent fields are not encoded: %s", json);
+
+	const char *negative = MP(0x81, 0xa2, 'i', 'd', 0xff);
+	pos = negative;
+	is(person_decode(&pos, &p), -1, "negative int for a uint field");
+	const char *not_map = MP(0x90);
+	pos = not_map;
+	is(person_decode(&pos, &p), -1, "not a map");
+}
+
+int
+main(void)
+{
+	test_schema();
+	check_plan();
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+/* {"a": [1, "xy"], "b": nil} */
+static const char *doc;
+
+static bool
+slice_is(const char *path, const char *expected, size_t expected_size)
+{
+	const char *begin, *end;
+	if (js_slice(doc, path, &begin, &end) != 0)
+		return false;
+	return (size_t) (end - begin) == expected_size &&
+	       memcmp(begin, expected, expected_size) == 0;
+}
+
+static void
+test_slice(void)
+{
+	const char *begin, *end;
+	ok(slice_is("", doc, 11), "the whole document");
+	ok(slice_is("/a", MP(0x92, 0x01, 0xa2, 'x', 'y'), 5), "a map value");
+	ok(slice_is("/a/1", MP(0xa2, 'x', 'y'), 3), "an array element");
+	ok(slice_is("/b", MP(0xc0), 1), "the last value");
+	is(js_slice(doc, "/c", &begin, &end), -1, "missing key");
+	is(js_slice(doc, "/a/2", &begin, &end), -1, "missing element");
+	is(js_slice(doc, "/a/-", &begin, &end), -1, "end of an array");
+	is(js_slice(doc, "/b/0", &begin, &end), -1, "scalar parent");
+}
+
+#if !defined(_WIN32)
+/** Concatenate \a iov like writev() would */
+static size_t
+gather(char *out, const struct iovec *iov, int iovcnt)
+{
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(out + size, iov[i].iov_base, iov[i].iov_len);
+		size += iov[i].iov_len;
+	}
+	return size;
+}
+
+static void
+test_splice(void)
+{
+	struct iovec spans[16], iov[17];
+	char header[5], key[16], out[64];
+	const char *begin, *end;
+
+	js_slice(doc, "/a/1", &begin, &end);
+	char *key_end = js_pack_str(key, "payload", 7);
+	spans[0] = (struct iovec) { key, key_end - key };
+	spans[1] = (struct iovec) { (void *) begin, end - begin };
+	int iovcnt = js_splice(JS_MAP, spans, 2, header, iov);
+	is(iovcnt, 3, "map iovcnt");
+	size_t size = gather(out, iov, iovcnt);
+	const char *expected = MP(0x81, 0xa7, 'p', 'a', 'y', 'l', 'o', 'a',
+				  'd', 0xa2, 'x', 'y');
+	ok(size == 12 && memcmp(out, expected, size) == 0, "map spliced");
+
+	iovcnt = js_splice(JS_ARRAY, spans, 2, header, iov);
+	size = gather(out, iov, iovcnt);
+	ok(iovcnt == 3 && size == 12 && out[0] == (char) 0x92 &&
+	   memcmp(out + 1, expected + 1, 11) == 0, "array spliced");
+
+	iovcnt = js_splice(JS_ARRAY, spans, 0, header, iov);
+	ok(iovcnt == 1 && gather(out, iov, iovcnt) == 1 &&
+	   out[0] == (char) 0x90, "empty array");
+
+	/* 16 elements need an array16 header */
+	static char nil = (char) 0xc0;
+	for (int i = 0; i < 16; i++)
+		spans[i] = (struct iovec) { &nil, 1 };
+	iovcnt = js_splice(JS_ARRAY, spans, 16, header, iov);
+	size = gather(out, iov, iovcnt);
+	const char *pos = out;
+	ok(iovcnt == 17 && size == 19 && out[0] == (char) 0xdc &&
+	   js_check(&pos, out + size) == 0 && pos == out + size,
+	   "array16 header");
+
+	is(js_splice(JS_MAP, spans, 3, header, iov), -1, "odd map count");
+	is(js_splice(JS_STR, spans, 2, header, iov), -1, "not a container");
+	is(js_splice(JS_ARRAY, NULL, INT32_MAX, header, NULL), -1,
+	   "count does not fit the result");
+	is(js_splice(JS_ARRAY, NULL, UINT32_MAX, header, NULL), -1,
+	   "count overflows the result");
+}
+#endif /* !defined(_WIN32) */
+
+int
+main(void)
+{
+	doc = MP(0x82, 0xa1, 'a', 0x92, 0x01, 0xa2, 'x', 'y', 0xa1, 'b',
+		 0xc0);
+	test_slice();
+#if !defined(_WIN32)
+	test_splice();
+#endif
+	check_plan();
+}
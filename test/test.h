@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A minimal TAP-style harness shared by the tests: every check prints
+ * "ok N - ..." or "not ok N - ...", and check_plan() turns failures into
+ * the exit status seen by ctest.
+ */
+
+#ifndef JSONPUCK_TEST_H_INCLUDED
+#define JSONPUCK_TEST_H_INCLUDED
+
+#include <stdio.h>
+
+static int test_count;
+static int test_failed;
+
+#define ok(cond, ...) do {						\
+	int test_ok_ = !!(cond);					\
+	test_count++;							\
+	if (!test_ok_)							\
+		test_failed++;						\
+	printf("%s %d - ", test_ok_ ? "ok" : "not ok", test_count);	\
+	printf(__VA_ARGS__);						\
+	printf("\n");							\
+	if (!test_ok_)							\
+		printf("#   failed at %s:%d\n", __FILE__, __LINE__);	\
+} while (0)
+
+#define is(a, b, ...) ok((a) == (b), __VA_ARGS__)
+
+#define check_plan() do {						\
+	printf("1..%d\n", test_count);					\
+	return test_failed == 0 ? 0 : 1;				\
+} while (0)
+
+/** Shorthand for a JSONPack literal of raw bytes */
+#define MP(...) ((const char *) (const unsigned char []) { __VA_ARGS__ })
+
+#endif /* JSONPUCK_TEST_H_INCLUDED */
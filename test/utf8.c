@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <jsonpuck.h>
+
+#include "test.h"
+
+/** Invalid sequences, each placed at every offset of a longer string */
+static const struct {
+	const char *bytes;
+	uint32_t len;
+	const char *name;
+} invalid[] = {
+	{ "\x80", 1, "lone continuation" },
+	{ "\xc0\x80", 2, "overlong 2-byte" },
+	{ "\xc1\xbf", 2, "overlong 2-byte (c1)" },
+	{ "\xe0\x80\x80", 3, "overlong 3-byte" },
+	{ "\xed\xa0\x80", 3, "surrogate" },
+	{ "\xf0\x80\x80\x80", 4, "overlong 4-byte" },
+	{ "\xf4\x90\x80\x80", 4, "above U+10FFFF" },
+	{ "\xf5\x80\x80\x80", 4, "f5 lead byte" },
+	{ "\xff", 1, "ff byte" },
+	{ "\xe2\x82", 2, "truncated 3-byte" },
+	{ "\xc3\x28", 2, "bad continuation" },
+};
+
+/** Valid multibyte text of every sequence length */
+static const char valid[] = "plain \xc3\xa9t\xc3\xa9 \xe2\x82\xac "
+	"\xf0\x9f\x98\x80 \xed\x9f\xbf \xee\x80\x80 \xf4\x8f\xbf\xbf";
+
+static void
+test_utf8(const char *isa)
+{
+	char buf[256], enc[2048], ref[2048];
+	ok(js_utf8_valid("", 0), "%s: empty string", isa);
+
+	/* Long enough for every vector width, with a multibyte tail */
+	uint32_t len = 0;
+	while (len + sizeof(valid) - 1 <= sizeof(buf)) {
+		memcpy(buf + len, valid, sizeof(valid) - 1);
+		len += sizeof(valid) - 1;
+	}
+	bool all_valid = true, all_encoded = true;
+	for (uint32_t n = 0; n <= len; n++) {
+		/* Prefixes which cut a sequence are invalid */
+		bool expected = n == len || (buf[n] & 0xc0) != 0x80;
+		if (js_utf8_valid(buf, n) != expected)
+			all_valid = false;
+		char *end = js_encode_str_utf8(enc, buf, n);
+		if (expected) {
+			char *ref_end = js_encode_str(ref, buf, n);
+			if (end == NULL || end - enc != ref_end - ref ||
+			    memcmp(enc, ref, end - enc) != 0)
+				all_encoded = false;
+		} else if (end != NULL) {
+			all_encoded = false;
+		}
+	}
+	ok(all_valid, "%s: js_utf8_valid() on prefixes of valid text", isa);
+	ok(all_encoded, "%s: js_encode_str_utf8() matches js_encode_str()",
+	   isa);
+
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		bool rejected = true;
+		for (uint32_t off = 0; off + invalid[i].len <= 128; off++) {
+			/* ASCII with a quote to be escaped around the error */
+			memset(buf, 'a', 128);
+			buf[off / 2] = '"';
+			memcpy(buf + off, invalid[i].bytes, invalid[i].len);
+			if (js_utf8_valid(buf, 128) ||
+			    js_encode_str_utf8(enc, buf, 128) != NULL)
+				rejected = false;
+		}
+		ok(rejected, "%s: %s is rejected", isa, invalid[i].name);
+	}
+}
+
+int
+main(void)
+{
+	for (int isa = 0; isa < JS_ISA_MAX; isa++) {
+		if (js_isa_set((enum js_isa) isa) != 0)
+			continue;
+		test_utf8(js_isa_name((enum js_isa) isa));
+	}
+	check_plan();
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2013-2016 JSONPuck Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * jsonpuck-index - build or update a sparse record index of a log of
+ * concatenated JSONPack documents, or print a record using the index.
+ *
+ *   jsonpuck-index [-k STRIDE] LOG [INDEX]    build or update INDEX
+ *   jsonpuck-index -s N LOG [INDEX]           print record N as JSON
+ *
+ * INDEX defaults to LOG.idx. An existing index is updated in place: only
+ * records appended since the previous run are scanned. An existing index
+ * with a stride other than the one given with -k is rebuilt.
+ */
+
+#include "jsonpuck.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jsonpuck-index [-k STRIDE] LOG [INDEX]\n"
+			"       jsonpuck-index -s N LOG [INDEX]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t stride = JS_RECORD_INDEX_STRIDE;
+	int stride_set = 0;
+	int seek = 0;
+	uint64_t n = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "k:s:")) != -1) {
+		switch (opt) {
+		case 'k':
+			stride = strtoul(optarg, NULL, 10);
+			if (stride == 0)
+				usage();
+			stride_set = 1;
+			break;
+		case 's':
+			seek = 1;
+			n = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind < 1 || argc - optind > 2)
+		usage();
+	const char *log_path = argv[optind];
+	char default_path[4096];
+	const char *index_path = argv[optind + 1];
+	if (index_path == NULL) {
+		snprintf(default_path, sizeof(default_path), "%s.idx",
+			 log_path);
+		index_path = default_path;
+	}
+
+	struct js_mmap_reader log;
+	if (js_mmap_reader_open(&log, log_path) != 0) {
+		fprintf(stderr, "%s: %s\n", log_path, strerror(errno));
+		return 1;
+	}
+	struct js_record_index index;
+	js_record_index_create(&index, NULL, stride);
+	FILE *file = fopen(index_path, "rb");
+	if (file != NULL) {
+		int rc = js_record_index_load(&index, file, log.size);
+		fclose(file);
+		if (rc != 0 || (stride_set && index.stride != stride)) {
+			/*
+			 * Not ours, the log was rewritten or another stride
+			 * is requested: start over
+			 */
+			js_record_index_destroy(&index);
+			js_record_index_create(&index, NULL, stride);
+		}
+	}
+
+	int rc = 0;
+	uint64_t old_count = index.count;
+	if (js_record_index_update(&index, log.data, log.size) < 0) {
+		fprintf(stderr, "%s: out of memory\n", log_path);
+		rc = 1;
+		goto out;
+	}
+	if (seek) {
+		const char *record = js_record_index_seek(&index, log.data, n);
+		if (record == NULL && n < index.count) {
+			fprintf(stderr, "%s: record %llu does not match %s\n",
+				log_path, (unsigned long long) n, index_path);
+			rc = 1;
+			goto out;
+		}
+		if (record == NULL) {
+			fprintf(stderr, "%s: no record %llu, %llu records\n",
+				log_path, (unsigned long long) n,
+				(unsigned long long) index.count);
+			rc = 1;
+			goto out;
+		}
+		js_fprint(stdout, record);
+		fputc('\n', stdout);
+	}
+	if (index.count == old_count && file != NULL)
+		goto out;
+	file = fopen(index_path, "wb");
+	if (file == NULL || js_record_index_save(&index, file) != 0) {
+		fprintf(stderr, "%s: %s\n", index_path, strerror(errno));
+		rc = 1;
+	}
+	if (file != NULL)
+		fclose(file);
+	if (!seek && rc == 0) {
+		printf("%llu records, %llu bytes indexed",
+		       (unsigned long long) index.count,
+		       (unsigned long long) index.scanned);
+		if (index.scanned < log.size) {
+			printf(", %llu trailing bytes pending",
+			       (unsigned long long) (log.size - index.scanned));
+		}
+		printf("\n");
+	}
+out:
+	js_record_index_destroy(&index);
+	js_mmap_reader_close(&log);
+	return rc;
+}